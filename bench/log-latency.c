@@ -0,0 +1,216 @@
+/*
+ * log-latency: tail a k8s-file log written by conmon and measure how long
+ * records take to get from the container into the file.
+ *
+ *   log-latency [-n COUNT] [-t TIMEOUT_MS] LOG_PATH
+ *
+ * The container is bench/stub-runtime's writer with STUB_TIMESTAMPS=1, which
+ * starts every record with the CLOCK_MONOTONIC time it wrote it at. Each
+ * stdout record carrying such a time is compared with the time it could be
+ * read from the log; the file is followed with inotify, the way log shippers
+ * follow it. The log does not need to exist yet.
+ *
+ * Stops after COUNT records, or when nothing was written for TIMEOUT_MS
+ * (default 5000), and prints "count N p50 X p99 Y p999 Z max W", the delays
+ * in microseconds.
+ */
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <libgen.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+
+#define STAMP_DIGITS 19
+#define READ_BUF_SIZE (1024 * 1024)
+
+struct samples {
+	uint64_t *v;
+	size_t len;
+	size_t cap;
+};
+
+static void die(const char *msg)
+{
+	fprintf(stderr, "log-latency: %s: %s\n", msg, strerror(errno));
+	exit(EXIT_FAILURE);
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void add_sample(struct samples *s, uint64_t value)
+{
+	if (s->len == s->cap) {
+		s->cap = s->cap ? s->cap * 2 : 4096;
+		s->v = realloc(s->v, s->cap * sizeof(*s->v));
+		if (s->v == NULL)
+			die("Failed to allocate samples");
+	}
+	s->v[s->len++] = value;
+}
+
+/* "TIMESTAMP STREAM TAG MESSAGE": return the message of a stdout record, or NULL. */
+static const char *stdout_message(const char *line)
+{
+	const char *p = strchr(line, ' ');
+
+	if (p == NULL || strncmp(p + 1, "stdout ", 7) != 0)
+		return NULL;
+	p = strchr(p + 8, ' ');
+	return p != NULL ? p + 1 : NULL;
+}
+
+static void process_line(const char *line, uint64_t seen, struct samples *s)
+{
+	const char *msg = stdout_message(line);
+	uint64_t written = 0;
+
+	if (msg == NULL)
+		return;
+	for (int i = 0; i < STAMP_DIGITS; i++) {
+		if (msg[i] < '0' || msg[i] > '9')
+			return;
+		written = written * 10 + (msg[i] - '0');
+	}
+	if (msg[STAMP_DIGITS] != ' ')
+		return;
+	add_sample(s, seen > written ? seen - written : 0);
+}
+
+/* Read what was appended to the log and process the complete lines. Returns the bytes read. */
+static size_t read_log(int fd, char *buf, size_t *len, int *skipping, struct samples *s)
+{
+	size_t total = 0;
+	ssize_t n;
+
+	while ((n = read(fd, buf + *len, READ_BUF_SIZE - *len)) > 0) {
+		uint64_t seen = now_ns();
+		char *beg = buf, *nl;
+
+		total += n;
+		*len += n;
+		while ((nl = memchr(beg, '\n', buf + *len - beg)) != NULL) {
+			*nl = '\0';
+			if (!*skipping)
+				process_line(beg, seen, s);
+			*skipping = 0;
+			beg = nl + 1;
+		}
+		*len -= beg - buf;
+		memmove(buf, beg, *len);
+		/* A line longer than the buffer carries no timestamp we are after */
+		if (*len == READ_BUF_SIZE) {
+			*len = 0;
+			*skipping = 1;
+		}
+	}
+	if (n < 0)
+		die("Failed to read the log");
+	return total;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return x < y ? -1 : x > y;
+}
+
+static double percentile_us(const struct samples *s, double p)
+{
+	size_t i = (size_t)(p * s->len);
+
+	if (i >= s->len)
+		i = s->len - 1;
+	return s->v[i] / 1000.0;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned long count = 0;
+	int timeout_ms = 5000;
+	struct samples s = {NULL, 0, 0};
+	size_t len = 0;
+	int skipping = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:t:")) != -1) {
+		switch (opt) {
+		case 'n':
+			count = strtoul(optarg, NULL, 10);
+			break;
+		case 't':
+			timeout_ms = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: log-latency [-n COUNT] [-t TIMEOUT_MS] LOG_PATH\n");
+			return EXIT_FAILURE;
+		}
+	}
+	if (optind != argc - 1) {
+		fprintf(stderr, "usage: log-latency [-n COUNT] [-t TIMEOUT_MS] LOG_PATH\n");
+		return EXIT_FAILURE;
+	}
+	const char *path = argv[optind];
+	char *dir_copy = strdup(path);
+	char *buf = malloc(READ_BUF_SIZE + 1);
+	char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+	if (dir_copy == NULL || buf == NULL)
+		die("Failed to allocate buffers");
+
+	int ifd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+	if (ifd < 0)
+		die("Failed to set up inotify");
+	/* Watch the directory first, so the log cannot be created unnoticed between the two. */
+	if (inotify_add_watch(ifd, dirname(dir_copy), IN_CREATE | IN_MOVED_TO) < 0)
+		die("Failed to watch the log directory");
+
+	int fd = -1;
+	uint64_t last_data = now_ns();
+	while (count == 0 || s.len < count) {
+		if (fd < 0) {
+			fd = open(path, O_RDONLY | O_CLOEXEC);
+			if (fd < 0 && errno != ENOENT)
+				die("Failed to open the log");
+			if (fd >= 0 && inotify_add_watch(ifd, path, IN_MODIFY) < 0)
+				die("Failed to watch the log");
+		}
+		if (fd >= 0 && read_log(fd, buf, &len, &skipping, &s) > 0) {
+			last_data = now_ns();
+			continue;
+		}
+
+		int left_ms = timeout_ms - (int)((now_ns() - last_data) / 1000000);
+		if (left_ms <= 0)
+			break;
+		struct pollfd pfd = {ifd, POLLIN, 0};
+		if (poll(&pfd, 1, left_ms) < 0 && errno != EINTR)
+			die("Failed to wait for the log");
+		while (read(ifd, events, sizeof(events)) > 0)
+			;
+	}
+
+	if (count > 0 && s.len < count)
+		fprintf(stderr, "log-latency: saw %zu of %lu records\n", s.len, count);
+	if (s.len == 0) {
+		fprintf(stderr, "log-latency: no timestamped records in %s\n", path);
+		return EXIT_FAILURE;
+	}
+	qsort(s.v, s.len, sizeof(*s.v), cmp_u64);
+	printf("count %zu p50 %.1f p99 %.1f p999 %.1f max %.1f\n", s.len, percentile_us(&s, 0.5), percentile_us(&s, 0.99),
+	       percentile_us(&s, 0.999), s.v[s.len - 1] / 1000.0);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,591 @@
+/*
+ * microbench: time the log formatting engine, process spawning and cgroup
+ * file parsing (libconmon-core) on synthetic input, without a container or
+ * a runtime.
+ *
+ *   conmon-bench [NAME_PREFIX]
+ *
+ * Each benchmark is run for long enough to be timed reliably, five times
+ * over, and the median is reported as ns/op along with the input bytes one
+ * op handles. Output goes to /dev/null, so only conmon's own work counts.
+ */
+#define _GNU_SOURCE
+
+#include "cgroup_read.h"
+#include "cgroup_stats.h"
+#include "config.h"
+#include "log_dedup.h"
+#include "log_driver.h"
+#include "log_format.h"
+#include "log_index.h"
+#include "rate_limit.h"
+#include "spawn.h"
+#include "utils.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#define RUNS 5
+#define MIN_RUN_NS 50000000ULL
+#define READ_SIZE STDIO_BUF_SIZE
+#define LINE_SIZE 100
+#define INDEX_ENTRIES 81920 /* a 5 GiB log indexed every 64 KiB */
+#define BALLAST_SIZE (64 * 1024 * 1024)
+
+struct benchmark {
+	const char *name;
+	/* Runs n ops and returns the input bytes they handled. */
+	size_t (*run)(unsigned long n);
+};
+
+static int null_fd = -1;
+static char lines[READ_SIZE];	      /* LINE_SIZE byte lines, as a container writes them */
+static char no_newline[READ_SIZE];    /* one long partial line */
+static char repeated[READ_SIZE];      /* the same LINE_SIZE byte line over and over */
+static char json_input[256];	      /* text with quotes, slashes and control characters */
+static int index_fd = -1;		      /* INDEX_ENTRIES entries, a millisecond apart */
+static volatile size_t sink;	      /* keeps results from being optimized out */
+
+/* Copies of cgroup v2 files, as a busy container's cgroup would show them */
+static char cgroup_dir[] = "/tmp/conmon-bench.XXXXXX";
+static const char memory_events[] = "low 0\nhigh 18342\nmax 1207\noom 0\noom_kill 0\noom_group_kill 0\n";
+static const char cpu_stat[] = "usage_usec 81234567\nuser_usec 60123456\nsystem_usec 21111111\ncore_sched.force_idle_usec 0\n"
+			       "nr_periods 120345\nnr_throttled 2345\nthrottled_usec 9876543\nnr_bursts 0\nburst_usec 0\n";
+static const char memory_current[] = "1073741824\n";
+static const char memory_stat[] =
+	"anon 805306368\nfile 201326592\nkernel 25165824\nkernel_stack 1048576\npagetables 4194304\nsec_pagetables 0\n"
+	"percpu 262144\nsock 0\nvmalloc 0\nshmem 4096\nzswap 0\nzswapped 0\nfile_mapped 67108864\nfile_dirty 4096\n"
+	"file_writeback 0\nswapcached 0\nanon_thp 0\nfile_thp 0\nshmem_thp 0\ninactive_anon 805306368\nactive_anon 4096\n"
+	"inactive_file 100663296\nactive_file 100663296\nunevictable 0\nslab_reclaimable 12582912\nslab_unreclaimable 6291456\n"
+	"slab 18874368\nworkingset_refault_anon 0\nworkingset_refault_file 1234\nworkingset_activate_anon 0\n"
+	"workingset_activate_file 567\nworkingset_restore_anon 0\nworkingset_restore_file 89\nworkingset_nodereclaim 0\n"
+	"pgscan 45678\npgsteal 43210\npgscan_kswapd 40000\npgscan_direct 5678\npgsteal_kswapd 38000\npgsteal_direct 5210\n"
+	"pgfault 98765432\npgmajfault 1234\npgrefill 4321\npgactivate 87654\npgdeactivate 3456\npglazyfree 0\npglazyfreed 0\n"
+	"zswpin 0\nzswpout 0\nthp_fault_alloc 0\nthp_collapse_alloc 0\n";
+static const char io_stat[] = "8:0 rbytes=123456789 wbytes=987654321 rios=12345 wios=54321 dbytes=0 dios=0\n"
+			      "259:0 rbytes=23456789 wbytes=87654321 rios=2345 wios=4321 dbytes=0 dios=0\n";
+static const char *const cgroup_file_names[] = {"memory.events", "cpu.stat", "memory.current", "memory.stat", "io.stat", "stats"};
+static int memory_events_fd = -1;
+static int cpu_stat_fd = -1;
+static int memory_current_fd = -1;
+static int memory_stat_fd = -1;
+static int io_stat_fd = -1;
+
+static void fill_inputs(void)
+{
+	for (size_t i = 0; i < sizeof(lines); i++)
+		lines[i] = (i % LINE_SIZE == LINE_SIZE - 1) ? '\n' : 'a' + i % 26;
+	memset(no_newline, 'x', sizeof(no_newline));
+	for (size_t i = 0; i < sizeof(repeated); i++)
+		repeated[i] = (i % LINE_SIZE == LINE_SIZE - 1) ? '\n' : 'a' + i % LINE_SIZE % 26;
+	for (size_t i = 0; i < sizeof(json_input) - 1; i++)
+		json_input[i] = "Log \"line\" with a/path\tand\n"[i % 27];
+	json_input[sizeof(json_input) - 1] = '\0';
+}
+
+static void fill_index(void)
+{
+	FILE *f = tmpfile();
+	if (f == NULL) {
+		perror("tmpfile");
+		exit(EXIT_FAILURE);
+	}
+	for (uint64_t i = 0; i < INDEX_ENTRIES; i++) {
+		struct log_index_entry entry = {.time_ns = i * 1000000, .offset = i * 65536};
+		fwrite(&entry, sizeof(entry), 1, f);
+	}
+	fflush(f);
+	index_fd = dup(fileno(f));
+	fclose(f);
+}
+
+static int write_cgroup_file(const char *name, const char *content)
+{
+	_cleanup_free_ char *path = g_build_filename(cgroup_dir, name, NULL);
+	FILE *f = fopen(path, "we");
+	if (f == NULL || fputs(content, f) < 0 || fclose(f) != 0) {
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+	return fd;
+}
+
+static void fill_cgroup_files(void)
+{
+	if (mkdtemp(cgroup_dir) == NULL) {
+		perror("mkdtemp");
+		exit(EXIT_FAILURE);
+	}
+	memory_events_fd = write_cgroup_file("memory.events", memory_events);
+	cpu_stat_fd = write_cgroup_file("cpu.stat", cpu_stat);
+	memory_current_fd = write_cgroup_file("memory.current", memory_current);
+	memory_stat_fd = write_cgroup_file("memory.stat", memory_stat);
+	io_stat_fd = write_cgroup_file("io.stat", io_stat);
+}
+
+static void remove_cgroup_files(void)
+{
+	for (size_t i = 0; i < G_N_ELEMENTS(cgroup_file_names); i++) {
+		_cleanup_free_ char *path = g_build_filename(cgroup_dir, cgroup_file_names[i], NULL);
+		unlink(path);
+	}
+	rmdir(cgroup_dir);
+}
+
+static size_t run_k8s(const char *buf, unsigned long n, int64_t max_line_size)
+{
+	k8s_log_t log = {.fd = null_fd, .size_max = -1, .global_size_max = -1, .reopen = NULL, .max_line_size = max_line_size};
+
+	for (unsigned long i = 0; i < n; i++)
+		write_k8s_log(&log, STDOUT_PIPE, buf, READ_SIZE);
+	return n * READ_SIZE;
+}
+
+static size_t bench_write_k8s_log_lines(unsigned long n)
+{
+	return run_k8s(lines, n, 0);
+}
+
+static size_t bench_write_k8s_log_partial(unsigned long n)
+{
+	return run_k8s(no_newline, n, 0);
+}
+
+/* The partial line held and cut into full records, as with --log-max-line-size. */
+static size_t bench_write_k8s_log_max_line(unsigned long n)
+{
+	return run_k8s(no_newline, n, 3 * READ_SIZE);
+}
+
+static size_t bench_split_log_lines(unsigned long n)
+{
+	log_line_t split[LOG_LINES_MAX];
+	ssize_t consumed;
+
+	for (unsigned long i = 0; i < n; i++)
+		sink += split_log_lines(lines, READ_SIZE, split, LOG_LINES_MAX, &consumed);
+	return n * READ_SIZE;
+}
+
+/* A k8s-file driver writing to null_fd, with its own log */
+struct null_driver {
+	log_driver_t driver; /* first, to get back from it */
+	k8s_log_t log;
+};
+
+static int write_null_k8s(log_driver_t *driver, stdpipe_t pipe, const log_line_t *split, size_t n_lines, const struct timespec *ts)
+{
+	return write_k8s_lines(&((struct null_driver *)driver)->log, pipe, split, n_lines, ts);
+}
+
+static struct null_driver null_drivers[] = {
+	{.driver = {.name = "null-1", .write = write_null_k8s}},
+	{.driver = {.name = "null-2", .write = write_null_k8s}},
+};
+
+/* Two drivers sharing one split of the lines, to compare with write_k8s_log/lines */
+static size_t bench_write_log_drivers(unsigned long n)
+{
+	for (unsigned long i = 0; i < n; i++)
+		write_log_drivers(STDOUT_PIPE, lines, READ_SIZE);
+	return n * READ_SIZE;
+}
+
+/* json-file records for the same lines as write_k8s_log/lines */
+static size_t bench_write_json_lines(unsigned long n)
+{
+	k8s_log_t log = {.fd = null_fd, .size_max = -1, .global_size_max = -1};
+	log_line_t split[LOG_LINES_MAX];
+	struct timespec ts = {0};
+	char timebuf[JSON_TIMEBUFLEN];
+	ssize_t consumed;
+
+	for (unsigned long i = 0; i < n; i++) {
+		size_t n_lines = split_log_lines(lines, READ_SIZE, split, LOG_LINES_MAX, &consumed);
+		clock_gettime(CLOCK_REALTIME, &ts);
+		format_json_timestamp(timebuf, sizeof timebuf, &ts);
+		write_json_lines(&log, STDOUT_PIPE, split, n_lines, timebuf);
+	}
+	return n * READ_SIZE;
+}
+
+static size_t bench_set_k8s_timestamp(unsigned long n)
+{
+	char tsbuf[TSBUFLEN];
+
+	for (unsigned long i = 0; i < n; i++) {
+		set_k8s_timestamp(tsbuf, sizeof tsbuf, "stdout");
+		sink += tsbuf[TSBUFLEN - 10];
+	}
+	return n * (TSBUFLEN - 1);
+}
+
+static size_t bench_get_line_len(unsigned long n)
+{
+	const char *buf = lines;
+	ssize_t left = sizeof(lines);
+	size_t bytes = 0;
+	ptrdiff_t line_len;
+
+	for (unsigned long i = 0; i < n; i++) {
+		get_line_len(&line_len, buf, left);
+		bytes += line_len;
+		buf += line_len;
+		left -= line_len;
+		if (left == 0) {
+			buf = lines;
+			left = sizeof(lines);
+		}
+	}
+	return bytes;
+}
+
+static size_t bench_writev_buffer_flush(unsigned long n)
+{
+	writev_buffer_t bufv = {0};
+
+	for (unsigned long i = 0; i < n; i++) {
+		for (int j = 0; j < WRITEV_BUFFER_N_IOV; j++)
+			writev_buffer_append_segment_no_flush(&bufv, lines, LINE_SIZE);
+		writev_buffer_flush(null_fd, &bufv);
+	}
+	return n * WRITEV_BUFFER_N_IOV * LINE_SIZE;
+}
+
+static size_t bench_parse_priority_prefix(unsigned long n)
+{
+	static const char line[] = "<3>disk is full\n";
+	const char *message;
+	int priority;
+
+	for (unsigned long i = 0; i < n; i++) {
+		parse_priority_prefix(line, sizeof(line) - 1, &priority, &message);
+		sink += priority;
+	}
+	return n * 3;
+}
+
+static size_t bench_escape_json(unsigned long n)
+{
+	static char escaped[JSON_ESCAPED_MAX(sizeof(json_input))];
+
+	for (unsigned long i = 0; i < n; i++)
+		sink += escape_json(escaped, json_input, sizeof(json_input) - 1);
+	return n * (sizeof(json_input) - 1);
+}
+
+static size_t bench_escape_json_string(unsigned long n)
+{
+	for (unsigned long i = 0; i < n; i++) {
+		char *escaped = escape_json_string(json_input);
+		sink += strlen(escaped);
+		g_free(escaped);
+	}
+	return n * (sizeof(json_input) - 1);
+}
+
+static bool discard(G_GNUC_UNUSED stdpipe_t pipe, G_GNUC_UNUSED char *buf, ssize_t len)
+{
+	sink += len;
+	return true;
+}
+
+/* The cost of --log-dedup on top of writing out the lines */
+static size_t run_dedup(char *buf, unsigned long n)
+{
+	log_dedup_t dedup = {0};
+
+	for (unsigned long i = 0; i < n; i++)
+		log_dedup_filter(&dedup, STDOUT_PIPE, buf, READ_SIZE, discard);
+	return n * READ_SIZE;
+}
+
+static size_t bench_log_dedup_unique(unsigned long n)
+{
+	return run_dedup(lines, n);
+}
+
+static size_t bench_log_dedup_repeated(unsigned long n)
+{
+	return run_dedup(repeated, n);
+}
+
+/* The per-buffer budget check of --log-rate-limit, with a limit never reached. */
+static size_t bench_log_rate_limit_admit(unsigned long n)
+{
+	for (unsigned long i = 0; i < n; i++)
+		sink += log_rate_limit_admit(READ_SIZE, READ_SIZE / LINE_SIZE);
+	return n * READ_SIZE;
+}
+
+/* A --since lookup in the time index of a large log. It has no input of its own, so no bytes. */
+static size_t bench_log_index_lookup(unsigned long n)
+{
+	for (unsigned long i = 0; i < n; i++)
+		sink += log_index_lookup(index_fd, (int64_t)(i * 7919 % INDEX_ENTRIES) * 1000000);
+	return 0;
+}
+
+static int exec_true(void *arg)
+{
+	static char *const argv[] = {"true", NULL};
+
+	(void)arg;
+	execv("/bin/true", argv);
+	spawn_child_fail("Failed to exec /bin/true");
+}
+
+/*
+ * Start /bin/true n times and wait until each has exec'd, seen as EOF on a
+ * close-on-exec pipe, then reap it. This is what starting the runtime or the
+ * exit command costs conmon before the new program gets going.
+ */
+static size_t run_spawn(unsigned long n, gboolean share_memory)
+{
+	for (unsigned long i = 0; i < n; i++) {
+		int fds[2];
+		char c;
+
+		if (pipe2(fds, O_CLOEXEC) < 0) {
+			perror("pipe2");
+			exit(EXIT_FAILURE);
+		}
+		pid_t pid = spawn_child(exec_true, NULL, share_memory, NULL);
+		if (pid < 0) {
+			perror("spawn_child");
+			exit(EXIT_FAILURE);
+		}
+		close(fds[1]);
+		while (read(fds[0], &c, 1) < 0 && errno == EINTR)
+			;
+		close(fds[0]);
+		while (waitpid(pid, NULL, 0) < 0 && errno == EINTR)
+			;
+	}
+	return 0;
+}
+
+/* Fault in BALLAST_SIZE of memory, so that copying the page tables on fork() shows. */
+static void add_ballast(void)
+{
+	static char *ballast = NULL;
+
+	if (ballast != NULL)
+		return;
+	ballast = mmap(NULL, BALLAST_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (ballast == MAP_FAILED) {
+		perror("mmap");
+		exit(EXIT_FAILURE);
+	}
+	for (size_t i = 0; i < BALLAST_SIZE; i += 4096)
+		ballast[i] = 1;
+}
+
+static size_t bench_spawn_child_vfork(unsigned long n)
+{
+	return run_spawn(n, TRUE);
+}
+
+static size_t bench_spawn_child_fork(unsigned long n)
+{
+	return run_spawn(n, FALSE);
+}
+
+/* The same with 64 MiB resident, to see how each scales with the parent's memory */
+static size_t bench_spawn_child_vfork_64m(unsigned long n)
+{
+	add_ballast();
+	return run_spawn(n, TRUE);
+}
+
+static size_t bench_spawn_child_fork_64m(unsigned long n)
+{
+	add_ballast();
+	return run_spawn(n, FALSE);
+}
+
+static const char *const oom_event_keys[] = {"oom", "oom_kill", "oom_group_kill"};
+
+/* What the OOM watcher does on each memory.events change: one pread() on the fd it keeps open */
+static size_t bench_memory_events_pread(unsigned long n)
+{
+	int64_t counters[G_N_ELEMENTS(oom_event_keys)] = {0};
+
+	for (unsigned long i = 0; i < n; i++)
+		sink += cgroup_read_keyed(memory_events_fd, oom_event_keys, counters, G_N_ELEMENTS(oom_event_keys));
+	return n * (sizeof(memory_events) - 1);
+}
+
+/* What it used to do: build the path, fopen() it and go through it with getline() */
+static size_t bench_memory_events_fopen(unsigned long n)
+{
+	for (unsigned long i = 0; i < n; i++) {
+		_cleanup_free_ char *path = g_build_filename(cgroup_dir, "memory.events", NULL);
+		_cleanup_fclose_ FILE *fp = fopen(path, "re");
+		_cleanup_free_ char *line = NULL;
+		size_t len = 0;
+		ssize_t read;
+
+		if (fp == NULL) {
+			perror(path);
+			exit(EXIT_FAILURE);
+		}
+		while ((read = getline(&line, &len, fp)) != -1) {
+			size_t prefix_len;
+
+			if ((size_t)read >= 11 && memcmp(line, "oom_kill ", 9) == 0)
+				prefix_len = 9;
+			else if ((size_t)read >= 6 && memcmp(line, "oom ", 4) == 0)
+				prefix_len = 4;
+			else
+				continue;
+			sink += strtol(&line[prefix_len], NULL, 10);
+		}
+	}
+	return n * (sizeof(memory_events) - 1);
+}
+
+/* The keys cgroup_stats.c samples */
+static const char *const cpu_stat_keys[] = {"usage_usec", "user_usec", "system_usec", "nr_throttled", "throttled_usec"};
+static const char *const memory_stat_keys[] = {"anon", "file", "shmem", "pgfault", "pgmajfault"};
+static const char *const io_stat_keys[] = {"rbytes", "wbytes", "rios", "wios"};
+
+/* The reads of one --stats-interval sample */
+static size_t bench_cgroup_stats_sample(unsigned long n)
+{
+	for (unsigned long i = 0; i < n; i++) {
+		int64_t cpu[G_N_ELEMENTS(cpu_stat_keys)] = {0};
+		int64_t memory[G_N_ELEMENTS(memory_stat_keys)] = {0};
+		int64_t io[G_N_ELEMENTS(io_stat_keys)] = {0};
+		int64_t current = 0;
+
+		sink += cgroup_read_keyed(cpu_stat_fd, cpu_stat_keys, cpu, G_N_ELEMENTS(cpu_stat_keys));
+		sink += cgroup_read_value(memory_current_fd, &current);
+		sink += cgroup_read_keyed(memory_stat_fd, memory_stat_keys, memory, G_N_ELEMENTS(memory_stat_keys));
+		sink += cgroup_read_nested_keyed_sum(io_stat_fd, io_stat_keys, io, G_N_ELEMENTS(io_stat_keys));
+	}
+	return n * (sizeof(cpu_stat) + sizeof(memory_current) + sizeof(memory_stat) + sizeof(io_stat) - 4);
+}
+
+/* Replacing the "stats" file once a sample; stats.json costs about the same again */
+static size_t bench_cgroup_stats_publish(unsigned long n)
+{
+	_cleanup_free_ char *path = g_build_filename(cgroup_dir, "stats", NULL);
+	struct cgroup_stats_record record = {.magic = CGROUP_STATS_MAGIC, .version = CGROUP_STATS_VERSION};
+
+	for (unsigned long i = 0; i < n; i++) {
+		record.timestamp_ns = i;
+		if (replace_file(path, &record, sizeof(record)) < 0) {
+			perror(path);
+			exit(EXIT_FAILURE);
+		}
+	}
+	return n * sizeof(record);
+}
+
+static const struct benchmark benchmarks[] = {
+	{"write_k8s_log/lines", bench_write_k8s_log_lines},
+	{"write_k8s_log/partial", bench_write_k8s_log_partial},
+	{"write_k8s_log/max-line", bench_write_k8s_log_max_line},
+	{"write_json_lines", bench_write_json_lines},
+	{"split_log_lines", bench_split_log_lines},
+	{"write_log_drivers/k8s-x2", bench_write_log_drivers},
+	{"set_k8s_timestamp", bench_set_k8s_timestamp},
+	{"get_line_len", bench_get_line_len},
+	{"writev_buffer_flush", bench_writev_buffer_flush},
+	{"parse_priority_prefix", bench_parse_priority_prefix},
+	{"escape_json", bench_escape_json},
+	{"escape_json_string", bench_escape_json_string},
+	{"log_dedup/unique", bench_log_dedup_unique},
+	{"log_dedup/repeated", bench_log_dedup_repeated},
+	{"log_rate_limit_admit", bench_log_rate_limit_admit},
+	{"log_index_lookup", bench_log_index_lookup},
+	{"memory.events/pread", bench_memory_events_pread},
+	{"memory.events/fopen", bench_memory_events_fopen},
+	{"cgroup_stats/sample", bench_cgroup_stats_sample},
+	{"cgroup_stats/publish", bench_cgroup_stats_publish},
+	{"spawn_child/vfork", bench_spawn_child_vfork},
+	{"spawn_child/fork", bench_spawn_child_fork},
+	{"spawn_child/vfork-64m", bench_spawn_child_vfork_64m},
+	{"spawn_child/fork-64m", bench_spawn_child_fork_64m},
+};
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+	return x < y ? -1 : x > y;
+}
+
+static void run_benchmark(const struct benchmark *b)
+{
+	double ns_per_op[RUNS];
+	unsigned long n = 1;
+	unsigned long long elapsed;
+	size_t bytes;
+
+	/* Find an op count that takes at least MIN_RUN_NS, warming up on the way. */
+	for (;;) {
+		unsigned long long start = now_ns();
+		bytes = b->run(n);
+		elapsed = now_ns() - start;
+		if (elapsed >= MIN_RUN_NS)
+			break;
+		n *= 2;
+	}
+
+	for (int i = 0; i < RUNS; i++) {
+		unsigned long long start = now_ns();
+		bytes = b->run(n);
+		ns_per_op[i] = (double)(now_ns() - start) / n;
+	}
+	qsort(ns_per_op, RUNS, sizeof(double), cmp_double);
+
+	double ns = ns_per_op[RUNS / 2];
+	double bytes_per_op = (double)bytes / n;
+	printf("%-24s %12.1f ns/op %10.1f bytes/op %10.1f MB/s\n", b->name, ns, bytes_per_op, bytes_per_op * 1000 / ns);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *prefix = argc > 1 ? argv[1] : "";
+
+	null_fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+	if (null_fd < 0) {
+		perror("open /dev/null");
+		return EXIT_FAILURE;
+	}
+	fill_inputs();
+	fill_index();
+	fill_cgroup_files();
+	configure_log_rate_limit("1000000000000:1000000000000:1000", NULL);
+	for (size_t i = 0; i < G_N_ELEMENTS(null_drivers); i++) {
+		null_drivers[i].log = (k8s_log_t){.fd = null_fd, .size_max = -1, .global_size_max = -1};
+		register_log_driver(&null_drivers[i].driver);
+	}
+
+	for (size_t i = 0; i < G_N_ELEMENTS(benchmarks); i++)
+		if (strncmp(benchmarks[i].name, prefix, strlen(prefix)) == 0)
+			run_benchmark(&benchmarks[i]);
+	remove_cgroup_files();
+	return EXIT_SUCCESS;
+}
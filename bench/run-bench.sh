@@ -0,0 +1,444 @@
+#!/bin/bash
+
+# Log throughput benchmark for conmon, using bench/stub-runtime in place of
+# an OCI runtime, so it runs offline and without root (except for journald).
+
+set -euo pipefail
+
+SCRIPT_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
+PROJECT_ROOT="$(dirname "$SCRIPT_DIR")"
+
+CONMON_BINARY="${CONMON_BINARY:-$PROJECT_ROOT/bin/conmon}"
+STUB_RUNTIME="${STUB_RUNTIME:-$SCRIPT_DIR/stub-runtime}"
+LOG_LATENCY="${LOG_LATENCY:-$SCRIPT_DIR/log-latency}"
+JOURNAL_SOCKET="/run/systemd/journal/socket"
+
+MODES="k8s-file journald passthrough terminal"
+DURABILITY_MODES="fsync nosync tmpfile"
+RUNS=3
+LATENCY=0
+LOAD=100000
+EXITS=0
+EXIT_DIR=""
+FORKERS=0
+CGROUP_ROOT="/sys/fs/cgroup"
+# The defaults of STUB_LINES and STUB_RATE depend on --latency
+STUB_LINES="${STUB_LINES:-}"
+STUB_RATE="${STUB_RATE:-}"
+export STUB_LINE_SIZE="${STUB_LINE_SIZE:-100}"
+export STUB_NEWLINE_PERCENT="${STUB_NEWLINE_PERCENT:-100}"
+export STUB_STDERR_PERCENT="${STUB_STDERR_PERCENT:-0}"
+
+usage() {
+    cat << EOF
+Usage: $0 [OPTIONS]
+
+Measure conmon's log throughput and CPU use for each log mode. The container
+is bench/stub-runtime's writer, which writes a configurable pattern of lines
+as fast as it can, or at a set rate.
+
+With --latency, measure instead how long lines take to show up in the
+k8s-file log: the writer stamps each line with the time it writes it, and
+bench/log-latency follows the log with inotify. This runs twice per mode,
+idle and with a second process loading conmon with stderr output.
+
+With --exits N, measure instead how long N containers take to start and
+exit all at once, as when a node drains, for each --exit-durability mode.
+The writers exit without writing anything, so what differs between the
+modes is the writing of the exit files.
+
+With --teardown N, measure instead how long --timeout takes to tear down a
+container whose writer has N processes forking as fast as they can, half of
+them in sessions of their own, with and without --cgroup-kill, and how many
+processes are left behind. Needs root and cgroup v2.
+
+OPTIONS:
+    -h, --help                  Show this help message
+    -c, --conmon BINARY         Path to conmon binary (default: $CONMON_BINARY)
+    -m, --modes "MODE..."       Modes to run (default: $MODES)
+    -n, --runs N                Runs per mode, the median is reported (default: $RUNS)
+    -l, --latency               Measure log latency rather than throughput
+    --lines N                   Records per run (default: 200000, 10000 with --latency)
+    --line-size BYTES           Bytes per record, newline included (default: $STUB_LINE_SIZE)
+    --rate N                    Records per second, 0 for unlimited (default: 0, 1000 with --latency)
+    --load N                    Records per second of load with --latency (default: $LOAD)
+    --newline-percent P         Share of records ending a line (default: $STUB_NEWLINE_PERCENT)
+    --stderr-percent P          Share of records written to stderr (default: $STUB_STDERR_PERCENT)
+    --exits N                   Start and exit N containers at once per durability mode instead
+    --durability "MODE..."      Durability modes to run with --exits (default: $DURABILITY_MODES)
+    --exit-dir DIR              Where the exit files go with --exits, best on the file system
+                                they normally go to (default: a directory under /tmp)
+    --teardown N                Tear down a container with N forking processes instead
+
+MODES:
+    k8s-file       --log-path k8s-file:FILE
+    journald       --log-path journald:, against a sink standing in for journald.
+                   Needs root, unshare, and conmon built with journald support.
+    passthrough    --log-path passthrough, the container writes to /dev/null itself
+    terminal       -t with k8s-file
+Only k8s-file and terminal write a log --latency can follow.
+
+"conmon CPU" is the CPU time of conmon and the runtime, without that of the
+writer and of the journald sink.
+EOF
+}
+
+log_info() {
+    echo "[INFO] $*" >&2
+}
+
+# Prints "wall_seconds cpu_seconds" for one run of conmon in the given mode.
+run_once() {
+    local mode="$1"
+    local dir
+    dir=$(mktemp -d /tmp/conmon-bench.XXXXXX)
+    local id
+    id="bench-$(basename "$dir" | tr -dc 'a-zA-Z0-9')"
+    export STUB_RUSAGE_FILE="$dir/writer-rusage"
+    export STUB_SINK_RUSAGE_FILE="$dir/sink-rusage"
+    echo "0 0" > "$STUB_SINK_RUSAGE_FILE"
+
+    local args=(
+        --cid "$id" --cuuid "$id"
+        --runtime "$STUB_RUNTIME"
+        --bundle "$dir"
+        --socket-dir-path "$dir"
+        --container-pidfile "$dir/pidfile"
+        --sync
+        --no-sync-log
+    )
+    case "$mode" in
+        k8s-file)    args+=(--log-path "k8s-file:$dir/ctr.log") ;;
+        journald)    args+=(--log-path "journald:") ;;
+        passthrough) args+=(--log-path passthrough) ;;
+        terminal)    args+=(--log-path "k8s-file:$dir/ctr.log" -t) ;;
+    esac
+
+    local times
+    TIMEFORMAT='%R %U %S'
+    if [[ "$mode" == journald ]]; then
+        # Put the sink where sd-journal sends to, in a mount namespace of our own.
+        times=$( { time unshare -m bash -c '
+            "$1" journald-sink "$2/journal.sock" > "$2/sink.out" &
+            sink=$!
+            while [ ! -S "$2/journal.sock" ]; do sleep 0.01; done
+            mount --bind "$2/journal.sock" '"$JOURNAL_SOCKET"'
+            shift 2
+            "$@" > /dev/null 2>&1
+            kill -TERM $sink; wait $sink
+        ' bash "$STUB_RUNTIME" "$dir" "$CONMON_BINARY" "${args[@]}" ; } 2>&1 )
+    else
+        times=$( { time "$CONMON_BINARY" "${args[@]}" > /dev/null 2>&1 ; } 2>&1 )
+    fi
+
+    local wall user sys writer_user writer_sys sink_user sink_sys
+    read -r wall user sys <<< "$times"
+    read -r writer_user writer_sys < "$STUB_RUSAGE_FILE"
+    read -r sink_user sink_sys < "$STUB_SINK_RUSAGE_FILE"
+
+    if [[ "$mode" == k8s-file ]]; then
+        local logged
+        logged=$(grep -c ' F ' "$dir/ctr.log" || true)
+        if [[ "$logged" -ne $(expected_lines) ]]; then
+            log_info "$mode: expected $(expected_lines) lines in the log, found $logged"
+        fi
+    fi
+
+    awk -v wall="$wall" -v user="$user" -v sys="$sys" -v others=$((writer_user + writer_sys + sink_user + sink_sys)) \
+        'BEGIN { printf "%s %.3f\n", wall, user + sys - others / 1000000 }'
+    rm -rf "$dir"
+}
+
+# Prints "count N p50 X p99 Y p999 Z max W" for one run, the delays in microseconds.
+latency_once() {
+    local mode="$1" load="$2"
+    local dir
+    dir=$(mktemp -d /tmp/conmon-bench.XXXXXX)
+    local id
+    id="bench-$(basename "$dir" | tr -dc 'a-zA-Z0-9')"
+
+    local args=(
+        --cid "$id" --cuuid "$id"
+        --runtime "$STUB_RUNTIME"
+        --bundle "$dir"
+        --socket-dir-path "$dir"
+        --container-pidfile "$dir/pidfile"
+        --log-path "k8s-file:$dir/ctr.log"
+        --sync
+        --no-sync-log
+    )
+    if [[ "$mode" == terminal ]]; then
+        args+=(-t)
+    fi
+
+    "$LOG_LATENCY" -n "$STUB_LINES" "$dir/ctr.log" > "$dir/latency" &
+    local reader=$!
+    STUB_TIMESTAMPS=1 STUB_LOAD="$load" "$CONMON_BINARY" "${args[@]}" > /dev/null 2>&1
+    wait $reader || true
+    cat "$dir/latency"
+    rm -rf "$dir"
+}
+
+latency_mode() {
+    local mode="$1"
+    local scenario load count p50 p99 p999 max i
+
+    for scenario in idle loaded; do
+        load=0
+        if [[ "$scenario" == loaded ]]; then
+            load="$LOAD"
+        fi
+        # Report the median run by p99
+        read -r _ count _ p50 _ p99 _ p999 _ max <<< "$(
+            for ((i = 0; i < RUNS; i++)); do
+                latency_once "$mode" "$load"
+            done | sort -n -k 6 | awk '{ v[NR] = $0 } END { print v[int((NR + 1) / 2)] }'
+        )"
+        printf "%-12s %-8s %8s %10s %10s %10s %10s\n" "$mode" "$scenario" "${count:--}" "${p50:--}" "${p99:--}" "${p999:--}" "${max:--}"
+    done
+}
+
+# Prints the wall seconds it takes $EXITS conmons started at once to all exit.
+mass_exit_once() {
+    local durability="$1"
+    local dir exit_dir i
+    dir=$(mktemp -d /tmp/conmon-bench.XXXXXX)
+    exit_dir="${EXIT_DIR:-$dir/exits}"
+    mkdir -p "$exit_dir"
+    local id
+    id="bench-$(basename "$dir" | tr -dc 'a-zA-Z0-9')"
+
+    local wall
+    TIMEFORMAT='%R'
+    wall=$( { time (
+        for ((i = 0; i < EXITS; i++)); do
+            "$CONMON_BINARY" \
+                --cid "$id-$i" --cuuid "$id-$i" \
+                --runtime "$STUB_RUNTIME" \
+                --bundle "$dir" \
+                --socket-dir-path "$dir" \
+                --container-pidfile "$dir/$i.pid" \
+                --log-path "k8s-file:$dir/$i.log" \
+                --exit-dir "$exit_dir" \
+                --exit-durability "$durability" \
+                --sync \
+                --no-sync-log > /dev/null 2>&1 &
+        done
+        wait
+    ) ; } 2>&1 )
+
+    local written
+    written=$(find "$exit_dir" -maxdepth 1 -name "$id-*" | wc -l)
+    if [[ "$written" -ne "$EXITS" ]]; then
+        log_info "$durability: expected $EXITS exit files, found $written"
+    fi
+    find "$exit_dir" -maxdepth 1 -name "$id-*" -delete
+    echo "$wall"
+    rm -rf "$dir"
+}
+
+mass_exit_mode() {
+    local durability="$1"
+    local wall i
+
+    wall=$(
+        for ((i = 0; i < RUNS; i++)); do
+            mass_exit_once "$durability"
+        done | median
+    )
+    awk -v mode="$durability" -v wall="$wall" -v exits="$EXITS" \
+        'BEGIN { printf "%-12s %8d %10.3f %10.0f\n", mode, exits, wall, exits / wall }'
+}
+
+# Prints "teardown_ms left" for one run of conmon --timeout 1, with any extra conmon arguments given.
+teardown_once() {
+    local dir
+    dir=$(mktemp -d /tmp/conmon-bench.XXXXXX)
+    local id
+    id="bench-$(basename "$dir" | tr -dc 'a-zA-Z0-9')"
+    local cgroup="$CGROUP_ROOT/$id"
+
+    local args=(
+        --cid "$id" --cuuid "$id"
+        --runtime "$STUB_RUNTIME"
+        --bundle "$dir"
+        --socket-dir-path "$dir"
+        --container-pidfile "$dir/pidfile"
+        --log-path "k8s-file:$dir/ctr.log"
+        --timeout 1
+        --sync
+        --no-sync-log
+        "$@"
+    )
+
+    local wall
+    TIMEFORMAT='%R'
+    wall=$( { time STUB_LINES=0 STUB_FORKERS="$FORKERS" STUB_CGROUP="$cgroup" \
+        "$CONMON_BINARY" "${args[@]}" > /dev/null 2>&1 ; } 2>&1 )
+
+    local left
+    left=$(wc -l < "$cgroup/cgroup.procs")
+    if [[ -e "$cgroup/cgroup.kill" ]]; then
+        echo 1 > "$cgroup/cgroup.kill"
+    fi
+    while ! grep -q '^populated 0$' "$cgroup/cgroup.events"; do
+        xargs -r kill -KILL < "$cgroup/cgroup.procs" 2> /dev/null || true
+        sleep 0.01
+    done
+    rmdir "$cgroup"
+
+    awk -v wall="$wall" -v left="$left" 'BEGIN { printf "%.0f %d\n", (wall - 1) * 1000, left }'
+    rm -rf "$dir"
+}
+
+teardown_mode() {
+    local name="$1"
+    shift
+    local ms left i
+
+    # Report the median run by teardown time
+    read -r ms left <<< "$(
+        for ((i = 0; i < RUNS; i++)); do
+            teardown_once "$@"
+        done | sort -n -k 1 | awk '{ v[NR] = $0 } END { print v[int((NR + 1) / 2)] }'
+    )"
+    printf "%-14s %8d %12s %6s\n" "$name" "$FORKERS" "$ms" "$left"
+}
+
+check_teardown() {
+    if [[ $(id -u) -ne 0 ]]; then
+        echo "--teardown needs root, to create cgroups" >&2
+        exit 1
+    fi
+    if [[ "$(stat -fc %T "$CGROUP_ROOT")" != cgroup2fs ]]; then
+        echo "--teardown needs cgroup v2 mounted at $CGROUP_ROOT" >&2
+        exit 1
+    fi
+}
+
+expected_lines() {
+    echo $(( STUB_LINES * STUB_NEWLINE_PERCENT / 100 ))
+}
+
+# Median of the numbers on stdin.
+median() {
+    sort -n | awk '{ v[NR] = $1 } END { print v[int((NR + 1) / 2)] }'
+}
+
+bench_mode() {
+    local mode="$1"
+    local walls=() cpus=() wall cpu i
+
+    for ((i = 0; i < RUNS; i++)); do
+        read -r wall cpu <<< "$(run_once "$mode")"
+        walls+=("$wall")
+        cpus+=("$cpu")
+    done
+    wall=$(printf '%s\n' "${walls[@]}" | median)
+    cpu=$(printf '%s\n' "${cpus[@]}" | median)
+
+    awk -v mode="$mode" -v wall="$wall" -v cpu="$cpu" -v lines="$STUB_LINES" -v size="$STUB_LINE_SIZE" \
+        -v nl="$(expected_lines)" \
+        'BEGIN { printf "%-12s %10.1f %12.0f %10.3f %8.1f%%\n", mode, lines * size / wall / 1e6, nl / wall, cpu, 100 * cpu / wall }'
+}
+
+check_mode() {
+    local mode="$1"
+
+    if [[ "$mode" != journald ]]; then
+        return 0
+    fi
+    if [[ $(id -u) -ne 0 ]] || ! command -v unshare > /dev/null; then
+        log_info "skipping journald: needs root and unshare"
+        return 1
+    fi
+    if [[ ! -S "$JOURNAL_SOCKET" ]]; then
+        log_info "skipping journald: there is no $JOURNAL_SOCKET to stand in for"
+        return 1
+    fi
+    if ! grep -qa sd_journal_sendv "$CONMON_BINARY"; then
+        log_info "skipping journald: $CONMON_BINARY is built without journald support"
+        return 1
+    fi
+}
+
+main() {
+    while [[ $# -gt 0 ]]; do
+        case $1 in
+            -h|--help) usage; exit 0 ;;
+            -c|--conmon) CONMON_BINARY="$2"; shift 2 ;;
+            -m|--modes) MODES="$2"; shift 2 ;;
+            -n|--runs) RUNS="$2"; shift 2 ;;
+            -l|--latency) LATENCY=1; shift ;;
+            --load) LOAD="$2"; shift 2 ;;
+            --lines) STUB_LINES="$2"; shift 2 ;;
+            --line-size) STUB_LINE_SIZE="$2"; shift 2 ;;
+            --rate) STUB_RATE="$2"; shift 2 ;;
+            --newline-percent) STUB_NEWLINE_PERCENT="$2"; shift 2 ;;
+            --stderr-percent) STUB_STDERR_PERCENT="$2"; shift 2 ;;
+            --exits) EXITS="$2"; shift 2 ;;
+            --durability) DURABILITY_MODES="$2"; shift 2 ;;
+            --exit-dir) EXIT_DIR="$2"; shift 2 ;;
+            --teardown) FORKERS="$2"; shift 2 ;;
+            *) echo "Unknown option: $1" >&2; usage; exit 1 ;;
+        esac
+    done
+
+    if [[ "$LATENCY" -eq 1 ]]; then
+        export STUB_LINES="${STUB_LINES:-10000}" STUB_RATE="${STUB_RATE:-1000}"
+    else
+        export STUB_LINES="${STUB_LINES:-200000}" STUB_RATE="${STUB_RATE:-0}"
+    fi
+
+    for binary in "$CONMON_BINARY" "$STUB_RUNTIME" "$LOG_LATENCY"; do
+        if [[ ! -x "$binary" ]]; then
+            echo "$binary not found, run 'make bench'" >&2
+            exit 1
+        fi
+    done
+
+    log_info "conmon: $CONMON_BINARY: $("$CONMON_BINARY" --version 2>&1 | head -1)"
+
+    if [[ "$EXITS" -gt 0 ]]; then
+        export STUB_LINES=0
+        log_info "$EXITS containers exiting at once, exit files in ${EXIT_DIR:-/tmp}, median of $RUNS runs"
+        printf "%-12s %8s %10s %10s\n" durability exits wall exits/s
+        for mode in $DURABILITY_MODES; do
+            mass_exit_mode "$mode"
+        done
+        return
+    fi
+
+    if [[ "$FORKERS" -gt 0 ]]; then
+        check_teardown
+        log_info "--timeout teardown of $FORKERS forking processes, median of $RUNS runs"
+        printf "%-14s %8s %12s %6s\n" kill forkers teardown_ms left
+        teardown_mode "process-group"
+        teardown_mode "cgroup.kill" --cgroup-kill
+        return
+    fi
+
+    log_info "$STUB_LINES records of $STUB_LINE_SIZE bytes, rate $STUB_RATE/s," \
+        "$STUB_NEWLINE_PERCENT% ending a line, $STUB_STDERR_PERCENT% on stderr, median of $RUNS runs"
+
+    if [[ "$LATENCY" -eq 1 ]]; then
+        log_info "latency in microseconds, median of $RUNS runs by p99, load of $LOAD records/s"
+        printf "%-12s %-8s %8s %10s %10s %10s %10s\n" mode scenario lines p50 p99 p999 max
+        for mode in $MODES; do
+            case "$mode" in
+                k8s-file|terminal) latency_mode "$mode" ;;
+                *) log_info "skipping $mode: it writes no log to follow" ;;
+            esac
+        done
+        return
+    fi
+
+    printf "%-12s %10s %12s %10s %9s\n" mode MB/s lines/s "conmon CPU" "CPU/wall"
+    for mode in $MODES; do
+        if check_mode "$mode"; then
+            bench_mode "$mode"
+        fi
+    done
+}
+
+main "$@"
@@ -0,0 +1,529 @@
+/*
+ * stub-runtime: a stand-in for an OCI runtime, for benchmarking conmon
+ * without runc, images or a registry.
+ *
+ * "create" and "exec" fork a writer in place of the container process,
+ * write its pid to --pid-file and exit. With --console-socket the writer
+ * gets a pty whose master is sent to conmon, like runc does. Other runtime
+ * commands (start, kill, delete, state) do nothing.
+ *
+ * What the writer writes is set through the environment, which conmon
+ * passes on to the runtime:
+ *
+ *   STUB_LINES            records to write (default 100000)
+ *   STUB_LINE_SIZE        bytes per record, newline included (default 100)
+ *   STUB_RATE             records per second, 0 for as fast as possible (default 0)
+ *   STUB_NEWLINE_PERCENT  share of records ending in a newline; the others
+ *                         run into the next record (default 100)
+ *   STUB_STDERR_PERCENT   share of records written to stderr (default 0)
+ *   STUB_WRITE_SIZE       largest write(2) the writer makes (default 65536)
+ *   STUB_TIMESTAMPS       if 1, each record starts with the CLOCK_MONOTONIC
+ *                         time it is written at, as 19 digits of nanoseconds
+ *                         and a space, and is written on its own (default 0)
+ *   STUB_LOAD             records per second a second process writes to
+ *                         stderr alongside the writer, 0 for none (default 0)
+ *   STUB_RUSAGE_FILE      if set, the writer's "user_us system_us" CPU time
+ *                         is written here when it is done
+ *   STUB_CGROUP           if set, a cgroup v2 directory the writer is moved
+ *                         into before it starts, created if missing
+ *   STUB_FORKERS          processes the writer starts that fork and reap
+ *                         children as fast as they can, every other one in a
+ *                         session of its own, 0 for none (default 0). With
+ *                         forkers the writer stays around once it is done,
+ *                         until it is killed.
+ *
+ * "stub-runtime journald-sink PATH" binds a datagram socket at PATH and
+ * discards what is sent to it, standing in for journald. It prints the
+ * number of messages and bytes it got when terminated, and writes its CPU
+ * time to STUB_SINK_RUSAGE_FILE if that is set.
+ */
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+/* "%019" PRIu64 " ", the CLOCK_MONOTONIC nanoseconds that start a record with STUB_TIMESTAMPS=1 */
+#define STAMP_LEN 20
+
+struct writer_config {
+	unsigned long lines;
+	size_t line_size;
+	unsigned long rate;
+	unsigned newline_percent;
+	unsigned stderr_percent;
+	size_t write_size;
+	int timestamps;
+	unsigned long load;
+	const char *rusage_file;
+	unsigned long forkers;
+};
+
+struct out_buf {
+	int fd;
+	size_t len;
+	char *data;
+};
+
+static void die(const char *msg)
+{
+	fprintf(stderr, "stub-runtime: %s: %s\n", msg, strerror(errno));
+	exit(EXIT_FAILURE);
+}
+
+static unsigned long env_ulong(const char *name, unsigned long def)
+{
+	const char *value = getenv(name);
+	char *endptr;
+
+	if (value == NULL || *value == '\0')
+		return def;
+	errno = 0;
+	unsigned long v = strtoul(value, &endptr, 10);
+	if (errno != 0 || *endptr != '\0') {
+		fprintf(stderr, "stub-runtime: invalid %s=%s\n", name, value);
+		exit(EXIT_FAILURE);
+	}
+	return v;
+}
+
+static void write_all(int fd, const char *buf, size_t len)
+{
+	while (len > 0) {
+		ssize_t n = write(fd, buf, len);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			/* conmon went away, nobody is reading anymore */
+			_exit(EXIT_FAILURE);
+		}
+		buf += n;
+		len -= n;
+	}
+}
+
+static void flush(struct out_buf *out)
+{
+	write_all(out->fd, out->data, out->len);
+	out->len = 0;
+}
+
+static void sleep_until(const struct timespec *start, unsigned long i, unsigned long rate)
+{
+	struct timespec ts = *start;
+	uint64_t ns = (uint64_t)i * 1000000000 / rate;
+
+	ts.tv_sec += ns / 1000000000;
+	ts.tv_nsec += ns % 1000000000;
+	if (ts.tv_nsec >= 1000000000) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000;
+	}
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+		;
+}
+
+/* Report the CPU time of this process and of its children that were waited for. */
+static void report_rusage(const char *path)
+{
+	struct rusage self, children;
+	char buf[64];
+
+	if (path == NULL || getrusage(RUSAGE_SELF, &self) < 0 || getrusage(RUSAGE_CHILDREN, &children) < 0)
+		return;
+
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0)
+		return;
+	long user = (self.ru_utime.tv_sec + children.ru_utime.tv_sec) * 1000000L + self.ru_utime.tv_usec + children.ru_utime.tv_usec;
+	long sys = (self.ru_stime.tv_sec + children.ru_stime.tv_sec) * 1000000L + self.ru_stime.tv_usec + children.ru_stime.tv_usec;
+	int len = snprintf(buf, sizeof(buf), "%ld %ld\n", user, sys);
+	write_all(fd, buf, len);
+	close(fd);
+}
+
+static void fill_record(char *record, size_t len)
+{
+	for (size_t i = 0; i < len; i++)
+		record[i] = 'a' + i % 26;
+}
+
+/* Write cfg->load records a second to stderr until killed, paced in batches of 100. */
+static pid_t start_load(const struct writer_config *cfg)
+{
+	pid_t pid = fork();
+	if (pid < 0)
+		die("Failed to fork the load writer");
+	if (pid > 0)
+		return pid;
+
+	struct out_buf out = {STDERR_FILENO, 0, malloc(cfg->write_size + cfg->line_size)};
+	char *record = malloc(cfg->line_size);
+	struct timespec start;
+
+	if (out.data == NULL || record == NULL)
+		die("Failed to allocate buffers");
+	fill_record(record, cfg->line_size);
+	record[cfg->line_size - 1] = '\n';
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (unsigned long i = 1;; i++) {
+		memcpy(out.data + out.len, record, cfg->line_size);
+		out.len += cfg->line_size;
+		if (out.len >= cfg->write_size)
+			flush(&out);
+		if (i % 100 == 0) {
+			flush(&out);
+			sleep_until(&start, i, cfg->load);
+		}
+	}
+}
+
+static void stop_load(pid_t pid)
+{
+	kill(pid, SIGKILL);
+	while (waitpid(pid, NULL, 0) < 0 && errno == EINTR)
+		;
+}
+
+static void stamp_record(char *record, size_t len)
+{
+	char stamp[STAMP_LEN + 1];
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	snprintf(stamp, sizeof(stamp), "%019" PRIu64 " ", (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec);
+	memcpy(record, stamp, len < STAMP_LEN ? len : STAMP_LEN);
+}
+
+/* Write cfg->lines records, spreading them over stdout and stderr and over time as configured. */
+static int run_writer(const struct writer_config *cfg)
+{
+	struct out_buf outs[2] = {{STDOUT_FILENO, 0, NULL}, {STDERR_FILENO, 0, NULL}};
+	unsigned newline_acc = 0, stderr_acc = 0;
+	struct timespec start;
+	pid_t load_pid = -1;
+	char *record;
+
+	record = malloc(cfg->line_size);
+	outs[0].data = malloc(cfg->write_size);
+	outs[1].data = malloc(cfg->write_size);
+	if (record == NULL || outs[0].data == NULL || outs[1].data == NULL)
+		die("Failed to allocate buffers");
+
+	fill_record(record, cfg->line_size);
+
+	if (cfg->load > 0)
+		load_pid = start_load(cfg);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (unsigned long i = 0; i < cfg->lines; i++) {
+		struct out_buf *out = &outs[0];
+
+		stderr_acc += cfg->stderr_percent;
+		if (stderr_acc >= 100) {
+			stderr_acc -= 100;
+			out = &outs[1];
+		}
+		newline_acc += cfg->newline_percent;
+		if (newline_acc >= 100) {
+			newline_acc -= 100;
+			record[cfg->line_size - 1] = '\n';
+		} else {
+			record[cfg->line_size - 1] = 'a' + (cfg->line_size - 1) % 26;
+		}
+
+		if (out->len + cfg->line_size > cfg->write_size)
+			flush(out);
+		if (cfg->timestamps)
+			stamp_record(record, cfg->line_size);
+		if (cfg->line_size > cfg->write_size) {
+			write_all(out->fd, record, cfg->line_size);
+		} else {
+			memcpy(out->data + out->len, record, cfg->line_size);
+			out->len += cfg->line_size;
+		}
+		/* The timestamp is for when the record is written, not when it is buffered. */
+		if (cfg->timestamps)
+			flush(out);
+
+		if (cfg->rate > 0) {
+			flush(&outs[0]);
+			flush(&outs[1]);
+			sleep_until(&start, i + 1, cfg->rate);
+		}
+	}
+	flush(&outs[0]);
+	flush(&outs[1]);
+
+	if (load_pid > 0)
+		stop_load(load_pid);
+	report_rusage(cfg->rusage_file);
+	return EXIT_SUCCESS;
+}
+
+/* Keep forking and reaping children until killed; every other forker leaves the process group. */
+static void start_forkers(unsigned long n)
+{
+	for (unsigned long i = 0; i < n; i++) {
+		pid_t pid = fork();
+		if (pid < 0)
+			die("Failed to fork a forker");
+		if (pid > 0)
+			continue;
+		/* Like a daemon, let go of conmon's pipes. */
+		int null_fd = open("/dev/null", O_RDWR);
+		if (null_fd < 0 || dup2(null_fd, STDIN_FILENO) < 0 || dup2(null_fd, STDOUT_FILENO) < 0 || dup2(null_fd, STDERR_FILENO) < 0)
+			die("Failed to redirect a forker's stdio");
+		if (null_fd > STDERR_FILENO)
+			close(null_fd);
+		if (i % 2 == 1)
+			setsid();
+		for (;;) {
+			pid_t child = fork();
+			if (child == 0)
+				_exit(EXIT_SUCCESS);
+			if (child > 0)
+				while (waitpid(child, NULL, 0) < 0 && errno == EINTR)
+					;
+		}
+	}
+}
+
+static void join_cgroup(const char *path)
+{
+	char procs[4096];
+
+	if (mkdir(path, 0755) < 0 && errno != EEXIST)
+		die("Failed to create the cgroup");
+	snprintf(procs, sizeof(procs), "%s/cgroup.procs", path);
+	int fd = open(procs, O_WRONLY | O_CLOEXEC);
+	if (fd < 0 || write(fd, "0", 1) != 1)
+		die("Failed to join the cgroup");
+	close(fd);
+}
+
+/* Send the pty master to conmon the way runc does, along with the pty's name. */
+static void send_console(const char *socket_path, int master, const char *name)
+{
+	struct sockaddr_un addr = {.sun_family = AF_UNIX};
+	union {
+		char buf[CMSG_SPACE(sizeof(int))];
+		struct cmsghdr align;
+	} u;
+	struct iovec iov = {(void *)name, strlen(name) + 1};
+	struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1, .msg_control = u.buf, .msg_controllen = sizeof(u.buf)};
+	struct cmsghdr *cmsg;
+
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		die("Failed to create console socket");
+	strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path) - 1);
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+		die("Failed to connect to the console socket");
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &master, sizeof(int));
+
+	if (sendmsg(fd, &msg, 0) < 0)
+		die("Failed to send the console");
+	close(fd);
+}
+
+static int create(const char *pid_file, const char *console_socket)
+{
+	struct writer_config cfg = {
+		.lines = env_ulong("STUB_LINES", 100000),
+		.line_size = env_ulong("STUB_LINE_SIZE", 100),
+		.rate = env_ulong("STUB_RATE", 0),
+		.newline_percent = env_ulong("STUB_NEWLINE_PERCENT", 100),
+		.stderr_percent = env_ulong("STUB_STDERR_PERCENT", 0),
+		.write_size = env_ulong("STUB_WRITE_SIZE", 65536),
+		.timestamps = env_ulong("STUB_TIMESTAMPS", 0) != 0,
+		.load = env_ulong("STUB_LOAD", 0),
+		.rusage_file = getenv("STUB_RUSAGE_FILE"),
+		.forkers = env_ulong("STUB_FORKERS", 0),
+	};
+	const char *cgroup = getenv("STUB_CGROUP");
+	int ready[2];
+	int master = -1;
+	char *pts_name = NULL;
+
+	if (cfg.line_size == 0 || cfg.write_size == 0 || cfg.newline_percent > 100 || cfg.stderr_percent > 100
+	    || (cfg.timestamps && cfg.line_size <= STAMP_LEN)) {
+		fprintf(stderr, "stub-runtime: invalid writer configuration\n");
+		return EXIT_FAILURE;
+	}
+
+	if (console_socket != NULL) {
+		master = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+		if (master < 0 || grantpt(master) < 0 || unlockpt(master) < 0 || (pts_name = ptsname(master)) == NULL)
+			die("Failed to set up a pty");
+		pts_name = strdup(pts_name);
+	}
+
+	/* The writer closes its end once it is in its cgroup, before conmon gets its pid. */
+	if (pipe2(ready, O_CLOEXEC) < 0)
+		die("Failed to create a pipe");
+
+	pid_t pid = fork();
+	if (pid < 0)
+		die("Failed to fork the writer");
+	if (pid == 0) {
+		close(ready[0]);
+		if (cgroup != NULL && *cgroup != '\0')
+			join_cgroup(cgroup);
+		close(ready[1]);
+		if (pts_name != NULL) {
+			if (setsid() < 0)
+				die("Failed to create a session");
+			int slave = open(pts_name, O_RDWR);
+			if (slave < 0 || ioctl(slave, TIOCSCTTY, 0) < 0)
+				die("Failed to open the pty");
+			if (dup2(slave, STDIN_FILENO) < 0 || dup2(slave, STDOUT_FILENO) < 0 || dup2(slave, STDERR_FILENO) < 0)
+				die("Failed to set up stdio");
+			if (slave > STDERR_FILENO)
+				close(slave);
+		}
+		start_forkers(cfg.forkers);
+		int ret = run_writer(&cfg);
+		while (cfg.forkers > 0)
+			pause();
+		_exit(ret);
+	}
+
+	close(ready[1]);
+	char c;
+	while (read(ready[0], &c, 1) < 0 && errno == EINTR)
+		;
+	close(ready[0]);
+
+	if (master >= 0) {
+		send_console(console_socket, master, pts_name);
+		close(master);
+	}
+
+	if (pid_file != NULL) {
+		FILE *f = fopen(pid_file, "we");
+		if (f == NULL || fprintf(f, "%d", pid) < 0 || fclose(f) != 0)
+			die("Failed to write the pid file");
+	}
+	return EXIT_SUCCESS;
+}
+
+static volatile sig_atomic_t sink_done = 0;
+
+static void sink_signal(int sig)
+{
+	(void)sig;
+	sink_done = 1;
+}
+
+/* Take datagrams at path as journald would, and drop them, closing any memfd passed along. */
+static int journald_sink(const char *path)
+{
+	struct sockaddr_un addr = {.sun_family = AF_UNIX};
+	struct sigaction sa = {.sa_handler = sink_signal};
+	uint64_t messages = 0, bytes = 0;
+	static char buf[256 * 1024];
+
+	int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		die("Failed to create the sink socket");
+	strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+	unlink(path);
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+		die("Failed to bind the sink socket");
+	int rcvbuf = 8 * 1024 * 1024;
+	setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+	sigaction(SIGTERM, &sa, NULL);
+	sigaction(SIGINT, &sa, NULL);
+
+	while (!sink_done) {
+		union {
+			char buf[CMSG_SPACE(sizeof(int) * 8)];
+			struct cmsghdr align;
+		} u;
+		struct iovec iov = {buf, sizeof(buf)};
+		struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1, .msg_control = u.buf, .msg_controllen = sizeof(u.buf)};
+
+		ssize_t n = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			die("Failed to receive");
+		}
+		for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+			if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+				continue;
+			size_t n_fds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+			for (size_t i = 0; i < n_fds; i++) {
+				int passed;
+				memcpy(&passed, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+				close(passed);
+			}
+		}
+		messages++;
+		bytes += n;
+	}
+
+	unlink(path);
+	printf("%" PRIu64 " messages %" PRIu64 " bytes\n", messages, bytes);
+	report_rusage(getenv("STUB_SINK_RUSAGE_FILE"));
+	return EXIT_SUCCESS;
+}
+
+int main(int argc, char *argv[])
+{
+	static const char *const commands[] = {"create", "exec", "restore", "start", "kill", "delete", "state", "journald-sink"};
+	const char *command = NULL;
+	const char *pid_file = NULL;
+	const char *console_socket = NULL;
+	int i;
+
+	/* Global options, from --runtime-arg, come before the command. */
+	for (i = 1; i < argc && command == NULL; i++)
+		for (size_t c = 0; c < sizeof(commands) / sizeof(commands[0]); c++)
+			if (strcmp(argv[i], commands[c]) == 0)
+				command = commands[c];
+	if (command == NULL) {
+		fprintf(stderr, "usage: stub-runtime [global options] create|exec [options] ID\n"
+				"       stub-runtime journald-sink PATH\n");
+		return EXIT_FAILURE;
+	}
+
+	if (strcmp(command, "journald-sink") == 0) {
+		if (i >= argc) {
+			fprintf(stderr, "stub-runtime: journald-sink needs a socket path\n");
+			return EXIT_FAILURE;
+		}
+		return journald_sink(argv[i]);
+	}
+
+	for (; i < argc - 1; i++) {
+		if (strcmp(argv[i], "--pid-file") == 0)
+			pid_file = argv[++i];
+		else if (strcmp(argv[i], "--console-socket") == 0)
+			console_socket = argv[++i];
+	}
+
+	if (strcmp(command, "create") == 0 || strcmp(command, "exec") == 0 || strcmp(command, "restore") == 0)
+		return create(pid_file, console_socket);
+	return EXIT_SUCCESS;
+}
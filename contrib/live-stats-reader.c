@@ -0,0 +1,149 @@
+/*
+ * conmon-live-stats: the reference reader for conmon's live stats page.
+ *
+ *   conmon-live-stats PATH
+ *       Print a consistent snapshot of the page at PATH as JSON.
+ *
+ *   conmon-live-stats --torn-test SECONDS
+ *       Check the seqlock: a writer process keeps updating a scratch page with
+ *       all counters equal while this one reads it, and any snapshot with
+ *       counters that differ is reported as torn. Exits non-zero if one was.
+ *
+ * It only needs src/live_stats.h, as a node agent reading the page would.
+ */
+#define _GNU_SOURCE
+
+#include "live_stats.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+static uint64_t monotonic_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int print_snapshot(const char *path)
+{
+	struct live_stats_page snap;
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		fprintf(stderr, "open %s: %s\n", path, strerror(errno));
+		return EXIT_FAILURE;
+	}
+	const struct live_stats_page *page = mmap(NULL, LIVE_STATS_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (page == MAP_FAILED) {
+		fprintf(stderr, "mmap %s: %s\n", path, strerror(errno));
+		return EXIT_FAILURE;
+	}
+	if (__atomic_load_n(&page->magic, __ATOMIC_ACQUIRE) != LIVE_STATS_MAGIC || page->version != LIVE_STATS_VERSION) {
+		fprintf(stderr, "%s: not a version %d live stats page\n", path, LIVE_STATS_VERSION);
+		return EXIT_FAILURE;
+	}
+	if (live_stats_read(page, &snap) < 0) {
+		fprintf(stderr, "%s: no consistent snapshot after %d retries\n", path, LIVE_STATS_READ_RETRIES);
+		return EXIT_FAILURE;
+	}
+
+	printf("{\"pid\": %" PRIu32 ", \"uptime_ns\": %" PRIu64 ", \"updated_ns\": %" PRIu64 ", \"seq\": %" PRIu32
+	       ", \"stdout_bytes\": %" PRIu64 ", \"stdout_lines\": %" PRIu64 ", \"stderr_bytes\": %" PRIu64 ", \"stderr_lines\": %" PRIu64
+	       ", \"dropped_bytes\": %" PRIu64 ", \"log_write_errors\": %" PRIu64 ", \"log_rotations\": %" PRIu64
+	       ", \"attach_clients\": %" PRIu64 ", \"last_write_latency_ns\": %" PRIu64 ", \"oom_events\": %" PRIu64 "}\n",
+	       snap.pid, monotonic_ns() - snap.started_ns, snap.updated_ns, snap.seq, snap.stdout_bytes, snap.stdout_lines,
+	       snap.stderr_bytes, snap.stderr_lines, snap.dropped_bytes, snap.log_write_errors, snap.log_rotations, snap.attach_clients,
+	       snap.last_write_latency_ns, snap.oom_events);
+	return EXIT_SUCCESS;
+}
+
+/* Every counter of a snapshot the writer below made holds the same value. */
+static int is_torn(const struct live_stats_page *s)
+{
+	const uint64_t v = s->stdout_bytes;
+
+	return s->stdout_lines != v || s->stderr_bytes != v || s->stderr_lines != v || s->dropped_bytes != v || s->log_write_errors != v
+	       || s->log_rotations != v || s->attach_clients != v || s->last_write_latency_ns != v || s->oom_events != v;
+}
+
+static void torn_writer(struct live_stats_page *page)
+{
+	for (uint64_t v = 1;; v++) {
+		live_stats_write_begin(page);
+		page->stdout_bytes = v;
+		page->stdout_lines = v;
+		page->stderr_bytes = v;
+		page->stderr_lines = v;
+		page->dropped_bytes = v;
+		page->log_write_errors = v;
+		page->log_rotations = v;
+		page->attach_clients = v;
+		page->last_write_latency_ns = v;
+		page->oom_events = v;
+		live_stats_write_end(page);
+	}
+}
+
+static int torn_test(int seconds)
+{
+	struct live_stats_page *page = mmap(NULL, LIVE_STATS_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (page == MAP_FAILED) {
+		perror("mmap");
+		return EXIT_FAILURE;
+	}
+
+	pid_t writer = fork();
+	if (writer < 0) {
+		perror("fork");
+		return EXIT_FAILURE;
+	}
+	if (writer == 0)
+		torn_writer(page);
+
+	uint64_t reads = 0, torn = 0, retries = 0, gave_up = 0, last = 0, changes = 0;
+	const uint64_t deadline = monotonic_ns() + (uint64_t)seconds * 1000000000;
+	while (monotonic_ns() < deadline) {
+		struct live_stats_page snap;
+		int r = live_stats_read(page, &snap);
+		if (r < 0) {
+			gave_up++;
+			continue;
+		}
+		reads++;
+		retries += r;
+		if (is_torn(&snap))
+			torn++;
+		if (snap.stdout_bytes != last)
+			changes++;
+		last = snap.stdout_bytes;
+	}
+
+	kill(writer, SIGKILL);
+	waitpid(writer, NULL, 0);
+
+	printf("reads %" PRIu64 " changes %" PRIu64 " retries %" PRIu64 " gave_up %" PRIu64 " torn %" PRIu64 "\n", reads, changes, retries,
+	       gave_up, torn);
+	return torn == 0 && changes > 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc == 3 && strcmp(argv[1], "--torn-test") == 0)
+		return torn_test(atoi(argv[2]));
+	if (argc == 2 && argv[1][0] != '-')
+		return print_snapshot(argv[1]);
+
+	fprintf(stderr, "usage: %s PATH | --torn-test SECONDS\n", argv[0]);
+	return EXIT_FAILURE;
+}
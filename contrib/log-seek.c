@@ -0,0 +1,124 @@
+/*
+ * conmon-log-seek: print the records of a k8s-file log written since a time,
+ * as podman logs --since does, using the time index of --log-index.
+ *
+ *   conmon-log-seek [--scan] [--stats] LOG SINCE
+ *
+ * SINCE is in seconds since the epoch, with an optional fraction. The log is
+ * read from the offset log_index_lookup() finds in LOG.idx, or from the start
+ * with --scan or without an index. --stats prints the bytes read and the time
+ * taken to stderr.
+ */
+#define _GNU_SOURCE
+
+#include "log_index.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static int64_t monotonic_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* The time of a record, from its "1997-03-25T13:20:42.999999999+01:00 " prefix, or -1. */
+static int64_t record_time_ns(const char *line)
+{
+	struct tm tm = {0};
+	long nsec;
+	char sign;
+	int off_hours, off_minutes;
+
+	if (sscanf(line, "%d-%d-%dT%d:%d:%d.%ld%c%d:%d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday, &tm.tm_hour, &tm.tm_min, &tm.tm_sec, &nsec,
+		   &sign, &off_hours, &off_minutes)
+	    != 10)
+		return -1;
+	tm.tm_year -= 1900;
+	tm.tm_mon -= 1;
+
+	int64_t secs = timegm(&tm) - (sign == '-' ? -1 : 1) * (off_hours * 3600 + off_minutes * 60);
+	return secs * 1000000000 + nsec;
+}
+
+static int64_t parse_since(const char *str)
+{
+	char *end;
+
+	errno = 0;
+	double since = strtod(str, &end);
+	if (errno != 0 || *end != '\0' || since < 0) {
+		fprintf(stderr, "invalid time %s, expected seconds since the epoch\n", str);
+		exit(EXIT_FAILURE);
+	}
+	return (int64_t)(since * 1e9);
+}
+
+int main(int argc, char *argv[])
+{
+	int scan = 0, stats = 0, arg = 1;
+
+	for (; arg < argc && argv[arg][0] == '-'; arg++) {
+		if (strcmp(argv[arg], "--scan") == 0) {
+			scan = 1;
+		} else if (strcmp(argv[arg], "--stats") == 0) {
+			stats = 1;
+		} else {
+			break;
+		}
+	}
+	if (argc - arg != 2) {
+		fprintf(stderr, "usage: %s [--scan] [--stats] LOG SINCE\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	const char *log_path = argv[arg];
+	const int64_t since_ns = parse_since(argv[arg + 1]);
+	const int64_t start_ns = monotonic_ns();
+
+	FILE *log = fopen(log_path, "re");
+	if (log == NULL) {
+		fprintf(stderr, "open %s: %s\n", log_path, strerror(errno));
+		return EXIT_FAILURE;
+	}
+
+	int64_t offset = 0;
+	if (!scan) {
+		char index_path[PATH_MAX];
+		snprintf(index_path, sizeof(index_path), "%s%s", log_path, LOG_INDEX_SUFFIX);
+		int index_fd = open(index_path, O_RDONLY | O_CLOEXEC);
+		if (index_fd >= 0) {
+			offset = log_index_lookup(index_fd, since_ns);
+			close(index_fd);
+		}
+		if (offset < 0 || fseeko(log, offset, SEEK_SET) < 0)
+			offset = 0;
+	}
+
+	char *line = NULL;
+	size_t size = 0;
+	ssize_t len;
+	uint64_t bytes_read = 0, records = 0;
+	while ((len = getline(&line, &size, log)) > 0) {
+		bytes_read += len;
+		if (record_time_ns(line) >= since_ns) {
+			fwrite(line, 1, len, stdout);
+			records++;
+		}
+	}
+	free(line);
+	fclose(log);
+
+	if (stats)
+		fprintf(stderr, "from offset %" PRId64 ": read %" PRIu64 " bytes, printed %" PRIu64 " records in %.3f ms\n", offset, bytes_read,
+			records, (monotonic_ns() - start_ns) / 1e6);
+	return EXIT_SUCCESS;
+}
@@ -34,6 +34,7 @@ BuildRequires: git-core
 BuildRequires: make
 BuildRequires: pkgconfig(libsystemd)
 BuildRequires: pkgconfig(glib-2.0)
+BuildRequires: systemtap-sdt-devel
 
 %description
 %{summary}.
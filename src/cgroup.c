@@ -1,19 +1,30 @@
 #define _GNU_SOURCE
 
 #include "cgroup.h"
+#include "cgroup_read.h"
 #include "globals.h"
 #include "utils.h"
 #include "cli.h"
 #include "config.h"
+#include "counters.h"
+#include "live_stats.h"
+#include "probes.h"
 
 #include <errno.h>
 #include <fcntl.h>
 #include <glib.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <signal.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
 #ifdef __linux__
 #include <linux/limits.h>
 #include <sys/eventfd.h>
-#include <sys/inotify.h>
 #include <sys/socket.h>
 #include <sys/statfs.h>
 #endif
@@ -23,12 +34,25 @@
 #endif
 
 #define CGROUP_ROOT "/sys/fs/cgroup"
+#define OOM_RECORD_MAX 256
+
+/* How long to wait for the cgroup to be empty after cgroup.kill */
+#define CGROUP_KILL_WAIT_MS 10000
 
 int oom_event_fd = -1;
 int oom_cgroup_fd = -1;
 
 #ifdef __linux__
 
+/* Kept open for the lifetime of the container, cgroup v2 only. */
+static int memory_events_fd = -1;
+static int memory_events_local_fd = -1;
+static int memory_current_fd = -1;
+static int memory_peak_fd = -1;
+
+static const char *const oom_event_keys[] = {"oom", "oom_kill", "oom_group_kill"};
+#define N_OOM_EVENT_KEYS G_N_ELEMENTS(oom_event_keys)
+
 static char *process_cgroup_subsystem_path(int pid, bool cgroup2, const char *subsystem);
 static void setup_oom_handling_cgroup_v2(int pid);
 static void setup_oom_handling_cgroup_v1(int pid);
@@ -36,11 +60,30 @@ static gboolean oom_cb_cgroup_v2(int fd, GIOCondition condition, G_GNUC_UNUSED g
 static gboolean oom_cb_cgroup_v1(int fd, GIOCondition condition, G_GNUC_UNUSED gpointer user_data);
 static int create_oom_files();
 static int create_oom_file(const char *base_path);
+static void close_memory_events();
+static uint64_t oom_timestamp();
+static void append_oom_record(const char *record, int len);
+
+/* The oom-events file in the persist directory, opened with O_APPEND once OOM handling is set up. Not closed. */
+static int oom_events_fd = -1;
+
+/* The container's pid, and whether it had any OOM, for record_oom_exit(). */
+static pid_t oom_container_pid = -1;
+static gboolean oom_seen = FALSE;
 
 void setup_oom_handling(int pid)
 {
 	struct statfs sfs;
 
+	oom_container_pid = pid;
+
+	if (opt_persist_path != NULL) {
+		_cleanup_free_ char *oom_events_path = g_build_filename(opt_persist_path, "oom-events", NULL);
+		oom_events_fd = open(oom_events_path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+		if (oom_events_fd < 0)
+			nwarnf("Failed to open %s", oom_events_path);
+	}
+
 	if (statfs("/sys/fs/cgroup", &sfs) == 0 && sfs.f_type == CGROUP2_SUPER_MAGIC) {
 		is_cgroup_v2 = TRUE;
 		setup_oom_handling_cgroup_v2(pid);
@@ -124,27 +167,31 @@ static void setup_oom_handling_cgroup_v2(int pid)
 	}
 
 	_cleanup_free_ char *memory_events_file_path = g_build_filename(cgroup2_path, "memory.events", NULL);
-
-	_cleanup_close_ int ifd = -1;
-	if ((ifd = inotify_init()) < 0) {
-		nwarnf("Failed to create inotify fd");
-		return;
-	}
-
-	if (inotify_add_watch(ifd, memory_events_file_path, IN_MODIFY) < 0) {
+	memory_events_fd = open(memory_events_file_path, O_RDONLY | O_CLOEXEC);
+	if (memory_events_fd < 0) {
 		if (errno == ENOENT) {
 			ndebugf("memory.events file does not exist at %s, skipping OOM monitoring", memory_events_file_path);
 		} else {
-			nwarnf("Failed to add inotify watch for %s", memory_events_file_path);
+			nwarnf("Failed to open %s", memory_events_file_path);
 		}
 		return;
 	}
 
-	/* Move ownership to inotify_fd.  */
-	inotify_fd = ifd;
-	ifd = -1;
+	/* Only used to tell OOMs in the container's own cgroup from those in nested ones; older kernels lack it. */
+	_cleanup_free_ char *memory_events_local_file_path = g_build_filename(cgroup2_path, "memory.events.local", NULL);
+	memory_events_local_fd = open(memory_events_local_file_path, O_RDONLY | O_CLOEXEC);
 
-	g_unix_fd_add(inotify_fd, G_IO_IN, oom_cb_cgroup_v2, NULL);
+	/* Recorded with each OOM event; memory.peak is missing on older kernels. */
+	_cleanup_free_ char *memory_current_file_path = g_build_filename(cgroup2_path, "memory.current", NULL);
+	memory_current_fd = open(memory_current_file_path, O_RDONLY | O_CLOEXEC);
+	_cleanup_free_ char *memory_peak_file_path = g_build_filename(cgroup2_path, "memory.peak", NULL);
+	memory_peak_fd = open(memory_peak_file_path, O_RDONLY | O_CLOEXEC);
+
+	/*
+	 * The kernel flags cgroup files with POLLPRI (and POLLERR) when their
+	 * contents change, and reading the file rearms the notification.
+	 */
+	g_unix_fd_add(memory_events_fd, G_IO_PRI, oom_cb_cgroup_v2, NULL);
 }
 
 static void setup_oom_handling_cgroup_v1(int pid)
@@ -188,35 +235,31 @@ static void setup_oom_handling_cgroup_v1(int pid)
 	g_unix_fd_add(oom_event_fd, G_IO_IN, oom_cb_cgroup_v1, memory_cgroup_file_path);
 }
 
-static gboolean oom_cb_cgroup_v2(int fd, GIOCondition condition, G_GNUC_UNUSED gpointer user_data)
+static gboolean oom_cb_cgroup_v2(G_GNUC_UNUSED int fd, GIOCondition condition, G_GNUC_UNUSED gpointer user_data)
 {
-	const size_t events_size = sizeof(struct inotify_event) + NAME_MAX + 1;
-	char events[events_size];
-
-	/* Drop the inotify events.  */
-	ssize_t num_read = read(fd, &events, events_size);
-	if (num_read < 0) {
-		nwarn("Failed to read oom event from eventfd in v2");
-		/* On non-recoverable errors, remove the source */
-		if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
-			return G_SOURCE_REMOVE;
-		return G_SOURCE_CONTINUE;
-	}
+	gboolean ret = check_cgroup2_oom();
 
-	gboolean ret = G_SOURCE_REMOVE;
-	if ((condition & G_IO_IN) != 0) {
-		ret = check_cgroup2_oom();
-	}
+	/* The cgroup is gone, nothing will change anymore. */
+	if ((condition & G_IO_HUP) != 0)
+		ret = G_SOURCE_REMOVE;
 
-	if (ret == G_SOURCE_REMOVE) {
-		/* End of input */
-		close(fd);
-		inotify_fd = -1;
-	}
+	if (ret == G_SOURCE_REMOVE)
+		close_memory_events();
 
 	return ret;
 }
 
+static void close_memory_events()
+{
+	int *fds[] = {&memory_events_fd, &memory_events_local_fd, &memory_current_fd, &memory_peak_fd};
+
+	for (size_t i = 0; i < G_N_ELEMENTS(fds); i++) {
+		if (*fds[i] >= 0)
+			close(*fds[i]);
+		*fds[i] = -1;
+	}
+}
+
 /* user_data is expected to be the container's cgroup.event_control file,
  * used to verify the cgroup hasn't been cleaned up */
 static gboolean oom_cb_cgroup_v1(int fd, GIOCondition condition, gpointer user_data)
@@ -281,80 +324,108 @@ static gboolean oom_cb_cgroup_v1(int fd, GIOCondition condition, gpointer user_d
 
 	/* we catch the two other cases here, both of which are OOM kill events */
 	ninfo("OOM event received");
+	CONMON_PROBE2(oom, oom_container_pid, (int64_t)-1);
 	create_oom_files();
 
+	/* cgroup v1 has no counters to go with the event */
+	char record[OOM_RECORD_MAX];
+	int len = snprintf(record, sizeof(record), "{\"timestamp\": %" PRIu64 "}\n", oom_timestamp());
+	append_oom_record(record, len);
+
 	return G_SOURCE_CONTINUE;
 }
 
 gboolean check_cgroup2_oom()
 {
-	static long int last_oom_counter = 0;
-	static long int last_oom_kill_counter = 0;
+	static int64_t last_counters[N_OOM_EVENT_KEYS];
+	int64_t counters[N_OOM_EVENT_KEYS] = {0};
 
-	if (!is_cgroup_v2)
+	if (!is_cgroup_v2 || memory_events_fd < 0)
 		return G_SOURCE_REMOVE;
 
-	if (!cgroup2_path) {
-		nwarn("cgroup2_path not initialized");
-		return G_SOURCE_REMOVE;
-	}
-
-	_cleanup_free_ char *memory_events_file_path = g_build_filename(cgroup2_path, "memory.events", NULL);
-
-	_cleanup_fclose_ FILE *fp = fopen(memory_events_file_path, "re");
-	if (fp == NULL) {
-		nwarnf("Failed to open cgroups file: %s", memory_events_file_path);
-		/* If the file doesn't exist, the cgroup was likely removed */
-		if (errno == ENOENT) {
+	if (cgroup_read_keyed(memory_events_fd, oom_event_keys, counters, N_OOM_EVENT_KEYS) < 0) {
+		/* Files of a removed cgroup fail with ENODEV */
+		if (errno == ENODEV || errno == ENOENT) {
 			ndebugf("Cgroup appears to have been removed, stopping OOM monitoring");
 			return G_SOURCE_REMOVE;
 		}
+		nwarnf("Failed to read %s/memory.events", cgroup2_path);
 		return G_SOURCE_CONTINUE;
 	}
 
-	_cleanup_free_ char *line = NULL;
-	size_t len = 0;
-	ssize_t read;
-	gboolean oom_detected = FALSE;
-	while ((read = getline(&line, &len, fp)) != -1) {
-		long int counter;
-		const size_t oom_len = 4, oom_kill_len = 9;
-		gboolean is_oom_kill = FALSE;
-		size_t prefix_len;
-
-		if ((size_t)read >= oom_kill_len + 2 && memcmp(line, "oom_kill ", oom_kill_len) == 0) {
-			prefix_len = oom_kill_len;
-			is_oom_kill = TRUE;
-		} else if ((size_t)read >= oom_len + 2 && memcmp(line, "oom ", oom_len) == 0) {
-			prefix_len = oom_len;
-			is_oom_kill = FALSE;
-		} else {
-			continue;
-		}
+	/* Most changes are to the low, high and max counters, which are not OOMs. */
+	gboolean changed = FALSE;
+	for (size_t i = 0; i < N_OOM_EVENT_KEYS; i++)
+		if (counters[i] != 0 && counters[i] != last_counters[i])
+			changed = TRUE;
+	if (!changed)
+		return G_SOURCE_CONTINUE;
+	CONMON_PROBE2(oom, oom_container_pid, counters[1] - last_counters[1]);
 
-		char *endptr;
-		errno = 0;
-		counter = strtol(&line[prefix_len], &endptr, 10);
+	int64_t local_counters[N_OOM_EVENT_KEYS] = {0};
+	if (memory_events_local_fd >= 0 && cgroup_read_keyed(memory_events_local_fd, oom_event_keys, local_counters, N_OOM_EVENT_KEYS) >= 0)
+		ndebugf("OOM counters: oom %" PRId64 " (%" PRId64 " local), oom_kill %" PRId64 " (%" PRId64 " local)", counters[0],
+			local_counters[0], counters[1], local_counters[1]);
 
-		if (errno != 0 || endptr == &line[prefix_len]) {
-			nwarnf("Failed to parse: %s", &line[prefix_len]);
-			continue;
-		}
+	if (create_oom_files() != 0)
+		return G_SOURCE_CONTINUE;
 
-		if (counter == 0)
-			continue;
+	/* -1 if not available */
+	int64_t memory_current = -1, memory_peak = -1;
+	if (memory_current_fd >= 0)
+		cgroup_read_value(memory_current_fd, &memory_current);
+	if (memory_peak_fd >= 0)
+		cgroup_read_value(memory_peak_fd, &memory_peak);
 
-		/* Check against the appropriate counter based on event type */
-		long int *last_counter = is_oom_kill ? &last_oom_kill_counter : &last_oom_counter;
-		if (counter != *last_counter) {
-			if (create_oom_files() == 0) {
-				*last_counter = counter;
-				oom_detected = TRUE;
-			}
-		}
-	}
+	char record[OOM_RECORD_MAX];
+	int len = snprintf(record, sizeof(record),
+			   "{\"timestamp\": %" PRIu64 ", \"oom\": %" PRId64 ", \"oom_kill\": %" PRId64 ", \"oom_group_kill\": %" PRId64
+			   ", \"memory_current\": %" PRId64 ", \"memory_peak\": %" PRId64 "}\n",
+			   oom_timestamp(), counters[0] - last_counters[0], counters[1] - last_counters[1], counters[2] - last_counters[2],
+			   memory_current, memory_peak);
+	append_oom_record(record, len);
+
+	memcpy(last_counters, counters, sizeof(counters));
+
+	return G_SOURCE_CONTINUE;
+}
+
+/* Nanoseconds since the epoch */
+static uint64_t oom_timestamp()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * Append a record to the oom-events file in the persist directory, one JSON
+ * object per line. The file is only ever appended to, so all the OOMs of the
+ * container are kept, and each record goes in with a single write.
+ */
+static void append_oom_record(const char *record, int len)
+{
+	if (oom_events_fd < 0 || len <= 0 || (size_t)len >= OOM_RECORD_MAX)
+		return;
+
+	if (write_all(oom_events_fd, record, len) < 0)
+		nwarn("Failed to append OOM record to oom-events");
+}
+
+/*
+ * If the container had an OOM and was then killed with SIGKILL, it was most
+ * likely killed by the OOM killer: record its pid.
+ */
+void record_oom_exit(int status)
+{
+	if (!oom_seen || !WIFSIGNALED(status) || WTERMSIG(status) != SIGKILL)
+		return;
 
-	return oom_detected ? G_SOURCE_CONTINUE : G_SOURCE_REMOVE;
+	char record[OOM_RECORD_MAX];
+	int len = snprintf(record, sizeof(record), "{\"timestamp\": %" PRIu64 ", \"killed_pid\": %d}\n", oom_timestamp(),
+			   (int)oom_container_pid);
+	append_oom_record(record, len);
 }
 
 /* create the appropriate files to tell the caller there was an oom event
@@ -364,6 +435,9 @@ gboolean check_cgroup2_oom()
 static int create_oom_files()
 {
 	ninfo("OOM received");
+	oom_seen = TRUE;
+	counters.oom_events++;
+	publish_live_stats();
 	int r = 0;
 	r |= create_oom_file(opt_persist_path);
 	r |= create_oom_file(opt_bundle_path);
@@ -384,4 +458,188 @@ static int create_oom_file(const char *base_path)
 	return 0;
 }
 
+/* Whether conmon itself is in the cgroup at path, or below it. */
+static gboolean self_in_cgroup(const char *path)
+{
+	_cleanup_free_ char *self_path = process_cgroup_subsystem_path(getpid(), true, "");
+	if (self_path == NULL)
+		return TRUE;
+
+	size_t len = strlen(path);
+	return strncmp(self_path, path, len) == 0 && (self_path[len] == '\0' || self_path[len] == '/');
+}
+
+/*
+ * Kill every process in the container's cgroup at once by writing to its
+ * cgroup.kill, which unlike killing the process group also gets the processes
+ * that left it and those being forked meanwhile. *events_fd is set to
+ * cgroup.events, opened before the kill so that the notification for the
+ * cgroup being emptied cannot be missed, or to -1 if it can't be opened.
+ * Returns -1 if cgroup.kill cannot be used (cgroup v1, kernels older than 5.14,
+ * or conmon sharing the cgroup), in which case the caller has to fall back to
+ * killing the processes itself.
+ */
+static int cgroup_kill(int *events_fd)
+{
+	*events_fd = -1;
+	if (!is_cgroup_v2 || cgroup2_path == NULL)
+		return -1;
+
+	if (self_in_cgroup(cgroup2_path)) {
+		nwarnf("conmon is in the container cgroup %s, not using cgroup.kill", cgroup2_path);
+		return -1;
+	}
+
+	_cleanup_free_ char *events_path = g_build_filename(cgroup2_path, "cgroup.events", NULL);
+	_cleanup_close_ int fd = open(events_path, O_RDONLY | O_CLOEXEC);
+
+	_cleanup_free_ char *kill_path = g_build_filename(cgroup2_path, "cgroup.kill", NULL);
+	_cleanup_close_ int kill_fd = open(kill_path, O_WRONLY | O_CLOEXEC);
+	if (kill_fd < 0) {
+		if (errno != ENOENT)
+			nwarnf("Failed to open %s", kill_path);
+		return -1;
+	}
+	if (write_all(kill_fd, "1", 1) < 0) {
+		nwarnf("Failed to write to %s", kill_path);
+		return -1;
+	}
+
+	*events_fd = fd;
+	fd = -1;
+	return 0;
+}
+
+static gboolean cgroup_populated(int events_fd)
+{
+	static const char *const populated_key[] = {"populated"};
+	int64_t populated = 1;
+
+	/* ENODEV: the cgroup has already been removed. */
+	return cgroup_read_keyed(events_fd, populated_key, &populated, 1) >= 0 && populated != 0;
+}
+
+/* Wait for cgroup.events to report the cgroup as no longer populated, until deadline. Returns FALSE if it still is. */
+static gboolean wait_cgroup_empty(int events_fd, gint64 deadline)
+{
+	while (cgroup_populated(events_fd)) {
+		int timeout = (deadline - g_get_monotonic_time()) / 1000;
+		if (timeout <= 0)
+			return FALSE;
+
+		struct pollfd pfd = {.fd = events_fd, .events = POLLPRI};
+		if (poll(&pfd, 1, timeout) < 0 && errno != EINTR)
+			return FALSE;
+	}
+	return TRUE;
+}
+
+/*
+ * Kill the container through cgroup.kill, see cgroup_kill(), and wait for the
+ * cgroup to be empty so that the container is really gone by the time its exit
+ * is reported. This blocks, and is for after the main loop is done.
+ */
+int cgroup_kill_and_wait()
+{
+	_cleanup_close_ int events_fd = -1;
+
+	if (cgroup_kill(&events_fd) < 0)
+		return -1;
+	if (events_fd >= 0 && !wait_cgroup_empty(events_fd, g_get_monotonic_time() + CGROUP_KILL_WAIT_MS * 1000))
+		nwarnf("Container cgroup %s still populated after cgroup.kill", cgroup2_path);
+	return 0;
+}
+
+/* A cgroup.kill done from the main loop, whose cgroup is not known to be empty yet. */
+static struct {
+	int events_fd;
+	guint events_source;
+	guint timeout_source;
+	gint64 deadline;
+} pending_kill = {.events_fd = -1};
+
+static void end_pending_kill()
+{
+	if (pending_kill.events_source != 0)
+		g_source_remove(pending_kill.events_source);
+	if (pending_kill.timeout_source != 0)
+		g_source_remove(pending_kill.timeout_source);
+	close(pending_kill.events_fd);
+	pending_kill.events_fd = -1;
+	pending_kill.events_source = pending_kill.timeout_source = 0;
+}
+
+static gboolean cgroup_events_cb(G_GNUC_UNUSED int fd, G_GNUC_UNUSED GIOCondition condition, G_GNUC_UNUSED gpointer user_data)
+{
+	if (cgroup_populated(pending_kill.events_fd))
+		return G_SOURCE_CONTINUE;
+
+	pending_kill.events_source = 0;
+	end_pending_kill();
+	return G_SOURCE_REMOVE;
+}
+
+/* SIGKILL whatever is left in the cgroup, as cgroup.kill did not empty it in time. */
+static void kill_cgroup_procs()
+{
+	nwarnf("Container cgroup %s still populated after cgroup.kill, killing its processes", cgroup2_path);
+
+	_cleanup_free_ char *procs_path = g_build_filename(cgroup2_path, "cgroup.procs", NULL);
+	_cleanup_free_ char *procs = NULL;
+	if (!g_file_get_contents(procs_path, &procs, NULL, NULL))
+		return;
+
+	for (char *line = procs; *line != '\0';) {
+		char *end;
+		long pid = strtol(line, &end, 10);
+		if (end == line)
+			break;
+		if (pid > 0)
+			kill(pid, SIGKILL);
+		line = end + strspn(end, "\n");
+	}
+}
+
+static gboolean cgroup_kill_timeout_cb(G_GNUC_UNUSED gpointer user_data)
+{
+	pending_kill.timeout_source = 0;
+	kill_cgroup_procs();
+	end_pending_kill();
+	return G_SOURCE_REMOVE;
+}
+
+/*
+ * Kill the container through cgroup.kill, see cgroup_kill(), without waiting:
+ * the cgroup is watched from the main loop until it is empty, and what is left
+ * in it is sent SIGKILL if it isn't within CGROUP_KILL_WAIT_MS.
+ * finish_cgroup_kill() waits out the rest of that once the main loop is done.
+ */
+int cgroup_kill_async()
+{
+	int events_fd;
+
+	if (pending_kill.events_fd >= 0)
+		return 0;
+	if (cgroup_kill(&events_fd) < 0)
+		return -1;
+	if (events_fd < 0)
+		return 0;
+
+	pending_kill.events_fd = events_fd;
+	pending_kill.deadline = g_get_monotonic_time() + CGROUP_KILL_WAIT_MS * 1000;
+	pending_kill.events_source = g_unix_fd_add(events_fd, G_IO_PRI, cgroup_events_cb, NULL);
+	pending_kill.timeout_source = g_timeout_add(CGROUP_KILL_WAIT_MS, cgroup_kill_timeout_cb, NULL);
+	return 0;
+}
+
+/* Wait for the cgroup of a cgroup_kill_async() still in progress to be empty. */
+void finish_cgroup_kill()
+{
+	if (pending_kill.events_fd < 0)
+		return;
+	if (!wait_cgroup_empty(pending_kill.events_fd, pending_kill.deadline))
+		kill_cgroup_procs();
+	end_pending_kill();
+}
+
 #endif
@@ -9,5 +9,9 @@ extern int oom_event_fd;
 void setup_oom_handling(int pid);
 gboolean conn_sock_cb(int fd, GIOCondition condition, gpointer user_data);
 gboolean check_cgroup2_oom();
+void record_oom_exit(int status);
+int cgroup_kill_and_wait();
+int cgroup_kill_async();
+void finish_cgroup_kill();
 
 #endif // CGROUP_H
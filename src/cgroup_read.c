@@ -0,0 +1,156 @@
+#define _GNU_SOURCE
+
+#include "cgroup_read.h"
+#include "config.h"
+#include "utils.h"
+
+#include <errno.h>
+#include <glib.h>
+#include <string.h>
+#include <unistd.h>
+
+static ssize_t cgroup_pread(int fd, char *buf, size_t size)
+{
+	ssize_t len;
+
+	do
+		len = pread(fd, buf, size, 0);
+	while (len < 0 && errno == EINTR);
+	return len;
+}
+
+/* Parse the decimal number in [p, end), which must be all digits. */
+static gboolean cgroup_parse_value(const char *p, const char *end, int64_t *value)
+{
+	int64_t v = 0;
+
+	if (p == end)
+		return FALSE;
+	for (; p < end; p++) {
+		if (*p < '0' || *p > '9')
+			return FALSE;
+		v = v * 10 + (*p - '0');
+	}
+	*value = v;
+	return TRUE;
+}
+
+static int cgroup_key_index(const char *key, size_t key_len, const char *const *keys, size_t n_keys)
+{
+	for (size_t i = 0; i < n_keys; i++)
+		if (strlen(keys[i]) == key_len && memcmp(key, keys[i], key_len) == 0)
+			return i;
+	return -1;
+}
+
+/*
+ * The cgroup_read_*() functions read a cgroup file from the start with a single
+ * pread(), without allocating, and return -1 with errno set if the file could
+ * not be read.
+ */
+
+/* Read a file holding a single value, like memory.current. "max" is read as
+   INT64_MAX. */
+int cgroup_read_value(int fd, int64_t *value)
+{
+	char buf[32];
+	ssize_t len = cgroup_pread(fd, buf, sizeof(buf));
+	if (len < 0)
+		return -1;
+
+	const char *end = buf + len;
+	while (end > buf && end[-1] == '\n')
+		end--;
+	if (end - buf == 3 && memcmp(buf, "max", 3) == 0) {
+		*value = INT64_MAX;
+		return 0;
+	}
+	if (!cgroup_parse_value(buf, end, value)) {
+		errno = EINVAL;
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Read a flat keyed file ("key value" lines), like memory.events. The value
+ * of keys[i] is stored in values[i]; keys that are not in the file, or whose
+ * value does not parse, leave values[i] untouched. Returns the number of keys
+ * found.
+ */
+int cgroup_read_keyed(int fd, const char *const *keys, int64_t *values, size_t n_keys)
+{
+	char buf[CGROUP_KEYED_BUF_SIZE];
+	ssize_t len = cgroup_pread(fd, buf, sizeof(buf));
+	if (len < 0)
+		return -1;
+
+	int found = 0;
+	const char *end = buf + len;
+	for (const char *line = buf; line < end;) {
+		const char *eol = memchr(line, '\n', end - line);
+		if (eol == NULL) {
+			/* Do not parse a line cut off by the end of the buffer. */
+			if ((size_t)len == sizeof(buf))
+				break;
+			eol = end;
+		}
+
+		const char *sep = memchr(line, ' ', eol - line);
+		int i = sep != NULL ? cgroup_key_index(line, sep - line, keys, n_keys) : -1;
+		if (i >= 0) {
+			if (cgroup_parse_value(sep + 1, eol, &values[i]))
+				found++;
+			else
+				nwarnf("Failed to parse: %.*s", (int)(eol - line), line);
+		}
+		line = eol + 1;
+	}
+
+	return found;
+}
+
+/*
+ * Read a nested keyed file ("id key=value key=value..." lines), like io.stat,
+ * adding up the values of each key over all the lines into values[i], which
+ * the caller must initialize. Returns the number of lines read.
+ */
+int cgroup_read_nested_keyed_sum(int fd, const char *const *keys, int64_t *values, size_t n_keys)
+{
+	char buf[CGROUP_KEYED_BUF_SIZE];
+	ssize_t len = cgroup_pread(fd, buf, sizeof(buf));
+	if (len < 0)
+		return -1;
+
+	int lines = 0;
+	const char *end = buf + len;
+	for (const char *line = buf; line < end;) {
+		const char *eol = memchr(line, '\n', end - line);
+		if (eol == NULL) {
+			if ((size_t)len == sizeof(buf))
+				break;
+			eol = end;
+		}
+
+		/* Skip the id, then go through the key=value fields. */
+		const char *field = memchr(line, ' ', eol - line);
+		while (field != NULL && field < eol) {
+			field++;
+			const char *field_end = memchr(field, ' ', eol - field);
+			if (field_end == NULL)
+				field_end = eol;
+
+			const char *eq = memchr(field, '=', field_end - field);
+			int64_t value;
+			int i = eq != NULL ? cgroup_key_index(field, eq - field, keys, n_keys) : -1;
+			if (i >= 0 && cgroup_parse_value(eq + 1, field_end, &value))
+				values[i] += value;
+
+			field = field_end;
+		}
+		lines++;
+		line = eol + 1;
+	}
+
+	return lines;
+}
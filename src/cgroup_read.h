@@ -0,0 +1,17 @@
+#if !defined(CGROUP_READ_H)
+#define CGROUP_READ_H
+
+/*
+ * Parsers for cgroup v2 interface files, kept apart from cgroup.c so they can
+ * be benchmarked on their own. They work on any fd, so they can be fed a
+ * copy of a cgroup file as well.
+ */
+
+#include <stdint.h> /* int64_t */
+#include <stddef.h> /* size_t */
+
+int cgroup_read_value(int fd, int64_t *value);
+int cgroup_read_keyed(int fd, const char *const *keys, int64_t *values, size_t n_keys);
+int cgroup_read_nested_keyed_sum(int fd, const char *const *keys, int64_t *values, size_t n_keys);
+
+#endif // CGROUP_READ_H
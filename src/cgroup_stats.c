@@ -0,0 +1,162 @@
+#define _GNU_SOURCE
+
+#include "cgroup_stats.h"
+#include "cgroup.h"
+#include "cgroup_read.h"
+#include "cli.h"
+#include "utils.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <glib.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+
+static const char *const cpu_stat_keys[] = {"usage_usec", "user_usec", "system_usec", "nr_throttled", "throttled_usec"};
+static const char *const memory_stat_keys[] = {"anon", "file", "shmem", "pgfault", "pgmajfault"};
+static const char *const io_stat_keys[] = {"rbytes", "wbytes", "rios", "wios"};
+
+/* Kept open between samples. The memory and io files are missing if the
+   controller is not enabled for the cgroup; those values stay 0. */
+static int cpu_stat_fd = -1;
+static int memory_current_fd = -1;
+static int memory_stat_fd = -1;
+static int io_stat_fd = -1;
+
+static char *stats_path = NULL;
+static char *stats_json_path = NULL;
+
+static int open_cgroup_file(const char *name)
+{
+	_cleanup_free_ char *path = g_build_filename(cgroup2_path, name, NULL);
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0 && errno != ENOENT)
+		nwarnf("Failed to open %s", path);
+	return fd;
+}
+
+static void close_cgroup_files()
+{
+	int *fds[] = {&cpu_stat_fd, &memory_current_fd, &memory_stat_fd, &io_stat_fd};
+
+	for (size_t i = 0; i < G_N_ELEMENTS(fds); i++) {
+		if (*fds[i] >= 0)
+			close(*fds[i]);
+		*fds[i] = -1;
+	}
+}
+
+/* Returns -1 with errno set if cpu.stat, which every cgroup has, could not be read. */
+static int sample_cgroup_stats(struct cgroup_stats_record *record)
+{
+	int64_t cpu[G_N_ELEMENTS(cpu_stat_keys)] = {0};
+	int64_t memory[G_N_ELEMENTS(memory_stat_keys)] = {0};
+	int64_t io[G_N_ELEMENTS(io_stat_keys)] = {0};
+	int64_t memory_current = 0;
+	struct timespec ts;
+
+	if (cgroup_read_keyed(cpu_stat_fd, cpu_stat_keys, cpu, G_N_ELEMENTS(cpu_stat_keys)) < 0)
+		return -1;
+	if (memory_current_fd >= 0)
+		cgroup_read_value(memory_current_fd, &memory_current);
+	if (memory_stat_fd >= 0)
+		cgroup_read_keyed(memory_stat_fd, memory_stat_keys, memory, G_N_ELEMENTS(memory_stat_keys));
+	if (io_stat_fd >= 0)
+		cgroup_read_nested_keyed_sum(io_stat_fd, io_stat_keys, io, G_N_ELEMENTS(io_stat_keys));
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+
+	*record = (struct cgroup_stats_record){
+		.magic = CGROUP_STATS_MAGIC,
+		.version = CGROUP_STATS_VERSION,
+		.timestamp_ns = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec,
+		.cpu_usage_usec = cpu[0],
+		.cpu_user_usec = cpu[1],
+		.cpu_system_usec = cpu[2],
+		.cpu_nr_throttled = cpu[3],
+		.cpu_throttled_usec = cpu[4],
+		.memory_current = memory_current,
+		.memory_anon = memory[0],
+		.memory_file = memory[1],
+		.memory_shmem = memory[2],
+		.memory_pgfault = memory[3],
+		.memory_pgmajfault = memory[4],
+		.io_rbytes = io[0],
+		.io_wbytes = io[1],
+		.io_rios = io[2],
+		.io_wios = io[3],
+	};
+	return 0;
+}
+
+static void publish_cgroup_stats(const struct cgroup_stats_record *r)
+{
+	char json[1024];
+
+	if (replace_file(stats_path, r, sizeof(*r)) < 0)
+		nwarnf("Failed to write %s: %m", stats_path);
+
+	int len = snprintf(json, sizeof(json),
+			   "{\"timestamp\": %" PRIu64 ", "
+			   "\"cpu\": {\"usage_usec\": %" PRIu64 ", \"user_usec\": %" PRIu64 ", \"system_usec\": %" PRIu64
+			   ", \"nr_throttled\": %" PRIu64 ", \"throttled_usec\": %" PRIu64 "}, "
+			   "\"memory\": {\"current\": %" PRIu64 ", \"anon\": %" PRIu64 ", \"file\": %" PRIu64 ", \"shmem\": %" PRIu64
+			   ", \"pgfault\": %" PRIu64 ", \"pgmajfault\": %" PRIu64 "}, "
+			   "\"io\": {\"rbytes\": %" PRIu64 ", \"wbytes\": %" PRIu64 ", \"rios\": %" PRIu64 ", \"wios\": %" PRIu64 "}}\n",
+			   r->timestamp_ns, r->cpu_usage_usec, r->cpu_user_usec, r->cpu_system_usec, r->cpu_nr_throttled,
+			   r->cpu_throttled_usec, r->memory_current, r->memory_anon, r->memory_file, r->memory_shmem, r->memory_pgfault,
+			   r->memory_pgmajfault, r->io_rbytes, r->io_wbytes, r->io_rios, r->io_wios);
+
+	if (replace_file(stats_json_path, json, len) < 0)
+		nwarnf("Failed to write %s: %m", stats_json_path);
+}
+
+static gboolean cgroup_stats_cb(G_GNUC_UNUSED gpointer user_data)
+{
+	struct cgroup_stats_record record;
+
+	if (sample_cgroup_stats(&record) < 0) {
+		/* Files of a removed cgroup fail with ENODEV */
+		if (errno == ENODEV) {
+			ndebugf("Cgroup appears to have been removed, stopping resource sampling");
+			close_cgroup_files();
+			return G_SOURCE_REMOVE;
+		}
+		nwarn("Failed to sample cgroup resource usage");
+		return G_SOURCE_CONTINUE;
+	}
+
+	publish_cgroup_stats(&record);
+	return G_SOURCE_CONTINUE;
+}
+
+void setup_cgroup_stats()
+{
+	if (opt_stats_interval <= 0)
+		return;
+
+	if (!is_cgroup_v2 || cgroup2_path == NULL) {
+		nwarn("Resource sampling needs the container's cgroup v2, ignoring --stats-interval");
+		return;
+	}
+
+	cpu_stat_fd = open_cgroup_file("cpu.stat");
+	if (cpu_stat_fd < 0)
+		return;
+	memory_current_fd = open_cgroup_file("memory.current");
+	memory_stat_fd = open_cgroup_file("memory.stat");
+	io_stat_fd = open_cgroup_file("io.stat");
+
+	stats_path = g_build_filename(opt_persist_path, "stats", NULL);
+	stats_json_path = g_build_filename(opt_persist_path, "stats.json", NULL);
+
+	/* Have a first sample right away rather than after a whole interval. */
+	if (cgroup_stats_cb(NULL) == G_SOURCE_CONTINUE)
+		g_timeout_add_seconds(opt_stats_interval, cgroup_stats_cb, NULL);
+}
+
+#endif
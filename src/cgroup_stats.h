@@ -0,0 +1,49 @@
+#if !defined(CGROUP_STATS_H)
+#define CGROUP_STATS_H
+
+/*
+ * Periodic sampling of the container's cgroup v2 resource usage.
+ *
+ * With --stats-interval, the cgroup files are kept open and sampled on a
+ * timer. Each sample replaces two files in the persist directory: "stats",
+ * holding a struct cgroup_stats_record in host byte order, and "stats.json",
+ * the same values as a single JSON object. Both are replaced atomically, so a
+ * reader always sees a complete sample.
+ */
+
+#include <stdint.h> /* uint32_t and uint64_t */
+
+#define CGROUP_STATS_MAGIC 0x53545343 /* "CSTS" */
+#define CGROUP_STATS_VERSION 1
+
+struct cgroup_stats_record {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t timestamp_ns; /* CLOCK_REALTIME */
+
+	/* cpu.stat */
+	uint64_t cpu_usage_usec;
+	uint64_t cpu_user_usec;
+	uint64_t cpu_system_usec;
+	uint64_t cpu_nr_throttled;
+	uint64_t cpu_throttled_usec;
+
+	/* memory.current and memory.stat */
+	uint64_t memory_current;
+	uint64_t memory_anon;
+	uint64_t memory_file;
+	uint64_t memory_shmem;
+	uint64_t memory_pgfault;
+	uint64_t memory_pgmajfault;
+
+	/* io.stat, summed over all devices */
+	uint64_t io_rbytes;
+	uint64_t io_wbytes;
+	uint64_t io_rios;
+	uint64_t io_wios;
+};
+
+/* Start sampling, once the container cgroup (cgroup2_path) is known. */
+void setup_cgroup_stats();
+
+#endif // CGROUP_STATS_H
@@ -3,6 +3,8 @@
 #include "ctr_logging.h"
 #include "config.h"
 #include "utils.h"
+#include "psi.h"
+#include "rate_limit.h"
 
 #include <glib.h>
 #include <glib-unix.h>
@@ -39,9 +41,17 @@ gchar **opt_runtime_opts = NULL;
 gchar **opt_runtime_args = NULL;
 gchar **opt_log_path = NULL;
 char *opt_exit_dir = NULL;
+char *opt_exit_durability = NULL;
+char *opt_exit_notify_socket = NULL;
 int opt_timeout = 0;
 int64_t opt_log_size_max = -1;
 int64_t opt_log_global_size_max = -1;
+int64_t opt_log_max_line_size = 0;
+char *opt_log_rate_limit = NULL;
+char *opt_log_rate_limit_mode = NULL;
+gboolean opt_log_dedup = FALSE;
+char *opt_log_index = NULL;
+int opt_log_dedup_timeout = 5;
 char *opt_socket_path = DEFAULT_SOCKET_PATH;
 gboolean opt_no_new_keyring = FALSE;
 char *opt_exit_command = NULL;
@@ -59,11 +69,22 @@ gboolean opt_full_attach_path = FALSE;
 gboolean opt_log_rotate = FALSE;
 int opt_log_max_files = 1;
 gchar **opt_log_allowlist_dirs = NULL;
+gchar **opt_pressure_triggers = NULL;
+int opt_stats_interval = 0;
+gboolean opt_cgroup_kill = FALSE;
+gboolean opt_control_socket = FALSE;
+gboolean opt_follow_socket = FALSE;
+gboolean opt_lazy_endpoints = FALSE;
+gboolean opt_live_stats = FALSE;
 GOptionEntry opt_entries[] = {
 	{"api-version", 0, 0, G_OPTION_ARG_NONE, &opt_api_version, "Conmon API version to use", NULL},
 	{"bundle", 'b', 0, G_OPTION_ARG_STRING, &opt_bundle_path, "Location of the OCI Bundle path", NULL},
+	{"cgroup-kill", 0, 0, G_OPTION_ARG_NONE, &opt_cgroup_kill,
+	 "On timeout, kill the whole container cgroup through cgroup.kill (cgroup v2 only)", NULL},
 	{"cid", 'c', 0, G_OPTION_ARG_STRING, &opt_cid, "Identification of Container", NULL},
 	{"conmon-pidfile", 'P', 0, G_OPTION_ARG_STRING, &opt_conmon_pid_file, "PID file for the conmon process", NULL},
+	{"control-socket", 0, 0, G_OPTION_ARG_NONE, &opt_control_socket,
+	 "Create a \"control\" socket next to the attach socket, taking line-delimited JSON requests", NULL},
 	{"container-pidfile", 'p', 0, G_OPTION_ARG_STRING, &opt_container_pid_file, "PID file for the initial pid inside of container",
 	 NULL},
 	{"cuuid", 'u', 0, G_OPTION_ARG_STRING, &opt_cuuid, "Container UUID", NULL},
@@ -76,11 +97,32 @@ GOptionEntry opt_entries[] = {
 	 "Additional arg to pass to the exit command.  Can be specified multiple times", NULL},
 	{"exit-delay", 0, 0, G_OPTION_ARG_INT, &opt_exit_delay, "Delay before invoking the exit command (in seconds)", NULL},
 	{"exit-dir", 0, 0, G_OPTION_ARG_STRING, &opt_exit_dir, "Path to the directory where exit files are written", NULL},
+	{"exit-durability", 0, 0, G_OPTION_ARG_STRING, &opt_exit_durability,
+	 "How exit files are written: fsync (default), nosync or tmpfile", NULL},
+	{"exit-notify-socket", 0, 0, G_OPTION_ARG_STRING, &opt_exit_notify_socket,
+	 "Path to a datagram socket to send an exit record to when the container exits", NULL},
+	{"follow-socket", 0, 0, G_OPTION_ARG_NONE, &opt_follow_socket,
+	 "Create a \"follow\" socket next to the attach socket, streaming the k8s-file log as it is written", NULL},
+	{"lazy-endpoints", 0, 0, G_OPTION_ARG_NONE, &opt_lazy_endpoints,
+	 "Create the attach socket on request through the control socket, and no ctl and winsz fifos. Implies --control-socket", NULL},
 	{"leave-stdin-open", 0, 0, G_OPTION_ARG_NONE, &opt_leave_stdin_open, "Leave stdin open when attached client disconnects", NULL},
+	{"live-stats", 0, 0, G_OPTION_ARG_NONE, &opt_live_stats, "Publish live counters in a shared memory page in the persist directory",
+	 NULL},
 	{"log-level", 0, 0, G_OPTION_ARG_STRING, &opt_log_level, "Print debug logs based on log level", NULL},
 	{"log-path", 'l', 0, G_OPTION_ARG_STRING_ARRAY, &opt_log_path, "Log file path", NULL},
 	{"log-size-max", 0, 0, G_OPTION_ARG_INT64, &opt_log_size_max, "Maximum size of log file", NULL},
 	{"log-global-size-max", 0, 0, G_OPTION_ARG_INT64, &opt_log_global_size_max, "Maximum size of all log files", NULL},
+	{"log-max-line-size", 0, 0, G_OPTION_ARG_INT64, &opt_log_max_line_size,
+	 "Split lines into records of at most this many bytes (k8s-file driver only)", NULL},
+	{"log-dedup", 0, 0, G_OPTION_ARG_NONE, &opt_log_dedup, "Log repeated lines once, with a count of the repeats", NULL},
+	{"log-dedup-timeout", 0, 0, G_OPTION_ARG_INT, &opt_log_dedup_timeout,
+	 "Log the count of repeats at least this often while they go on (in seconds, default 5)", NULL},
+	{"log-index", 0, 0, G_OPTION_ARG_STRING, &opt_log_index,
+	 "Keep a time index of the k8s-file log, with an entry every BYTES or SECONDS (BYTES:SECONDS)", NULL},
+	{"log-rate-limit", 0, 0, G_OPTION_ARG_STRING, &opt_log_rate_limit,
+	 "Limit logging to BYTES and LINES a second, with bursts of BURST_MS worth (BYTES:LINES:BURST_MS)", NULL},
+	{"log-rate-limit-mode", 0, 0, G_OPTION_ARG_STRING, &opt_log_rate_limit_mode,
+	 "Drop output over the log rate limit (drop, the default) or stop reading it for a while (block)", NULL},
 	{"log-tag", 0, 0, G_OPTION_ARG_STRING, &opt_log_tag, "Additional tag to use for logging", NULL},
 	{"log-label", 0, 0, G_OPTION_ARG_STRING_ARRAY, &opt_log_labels,
 	 "Additional label to include in logs. Can be specified multiple times", NULL},
@@ -92,6 +134,9 @@ GOptionEntry opt_entries[] = {
 	{"no-sync-log", 0, 0, G_OPTION_ARG_NONE, &opt_no_sync_log, "Do not manually call sync on logs after container shutdown", NULL},
 	{"persist-dir", '0', 0, G_OPTION_ARG_STRING, &opt_persist_path,
 	 "Persistent directory for a container that can be used for storing container data", NULL},
+	{"pressure-trigger", 0, 0, G_OPTION_ARG_STRING_ARRAY, &opt_pressure_triggers,
+	 "Record when the container is stalled on a resource, as RESOURCE:TYPE:STALL_US:WINDOW_US. Can be specified multiple times",
+	 NULL},
 	{"pidfile", 0, G_OPTION_FLAG_HIDDEN, G_OPTION_ARG_STRING, &opt_container_pid_file, "PID file (DEPRECATED)", NULL},
 	{"replace-listen-pid", 0, 0, G_OPTION_ARG_NONE, &opt_replace_listen_pid, "Replace listen pid if set for oci-runtime pid", NULL},
 	{"restore", 0, 0, G_OPTION_ARG_STRING, &opt_restore_path, "Restore a container from a checkpoint", NULL},
@@ -105,6 +150,8 @@ GOptionEntry opt_entries[] = {
 	{"sdnotify-socket", 0, 0, G_OPTION_ARG_STRING, &opt_sdnotify_socket, "Path to the host's sd-notify socket to relay messages to",
 	 NULL},
 	{"socket-dir-path", 0, 0, G_OPTION_ARG_STRING, &opt_socket_path, "Location of container attach sockets", NULL},
+	{"stats-interval", 0, 0, G_OPTION_ARG_INT, &opt_stats_interval,
+	 "Sample the container's resource usage into the persist directory every given number of seconds", NULL},
 	{"stdin", 'i', 0, G_OPTION_ARG_NONE, &opt_stdin, "Open up a pipe to pass stdin to the container", NULL},
 	{"sync", 0, 0, G_OPTION_ARG_NONE, &opt_sync, "Keep the main conmon process as its child by only forking once", NULL},
 	{"syslog", 0, 0, G_OPTION_ARG_NONE, &opt_syslog, "Log to syslog (use with cgroupfs cgroup manager)", NULL},
@@ -209,6 +256,30 @@ void process_cli()
 		nexit("Delay before invoking exit command must be greater than or equal to 0");
 	}
 
+	if (opt_exit_durability != NULL && strcmp(opt_exit_durability, "fsync") && strcmp(opt_exit_durability, "nosync")
+	    && strcmp(opt_exit_durability, "tmpfile"))
+		nexitf("Invalid --exit-durability %s, must be one of fsync, nosync or tmpfile", opt_exit_durability);
+
+	if (opt_pressure_triggers != NULL && opt_persist_path == NULL)
+		nexit("Pressure triggers require a persist directory. Use --persist-dir");
+	configure_pressure_triggers(opt_pressure_triggers);
+
+	if (opt_stats_interval < 0)
+		nexit("Stats interval must be greater than or equal to 0");
+	if (opt_stats_interval > 0 && opt_persist_path == NULL)
+		nexit("Resource sampling requires a persist directory. Use --persist-dir");
+	if (opt_live_stats && opt_persist_path == NULL)
+		nexit("Live stats require a persist directory. Use --persist-dir");
+
+	if (opt_log_max_line_size < 0 || opt_log_max_line_size > LOG_MAX_LINE_SIZE_LIMIT)
+		nexitf("Max line size must be between 0 and %d", LOG_MAX_LINE_SIZE_LIMIT);
+	configure_log_rate_limit(opt_log_rate_limit, opt_log_rate_limit_mode);
+	if (opt_log_dedup_timeout <= 0)
+		nexit("Log dedup timeout must be greater than 0");
+
+	if (opt_lazy_endpoints)
+		opt_control_socket = TRUE;
+
 	// we should always override the container pid file if it's empty
 	if (opt_container_pid_file == NULL)
 		opt_container_pid_file = g_strdup_printf("%s/pidfile-%s", cwd, opt_cid);
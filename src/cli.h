@@ -30,8 +30,16 @@ extern gchar **opt_runtime_opts;
 extern gchar **opt_runtime_args;
 extern gchar **opt_log_path;
 extern char *opt_exit_dir;
+extern char *opt_exit_durability;
+extern char *opt_exit_notify_socket;
 extern int opt_timeout;
 extern int64_t opt_log_size_max;
+extern int64_t opt_log_max_line_size;
+extern char *opt_log_rate_limit;
+extern char *opt_log_rate_limit_mode;
+extern gboolean opt_log_dedup;
+extern char *opt_log_index;
+extern int opt_log_dedup_timeout;
 extern char *opt_socket_path;
 extern gboolean opt_no_new_keyring;
 extern char *opt_exit_command;
@@ -48,6 +56,13 @@ extern char *opt_sdnotify_socket;
 extern gboolean opt_log_rotate;
 extern int opt_log_max_files;
 extern gchar **opt_log_allowlist_dirs;
+extern gchar **opt_pressure_triggers;
+extern int opt_stats_interval;
+extern gboolean opt_cgroup_kill;
+extern gboolean opt_control_socket;
+extern gboolean opt_follow_socket;
+extern gboolean opt_lazy_endpoints;
+extern gboolean opt_live_stats;
 extern GOptionEntry opt_entries[];
 extern gboolean opt_full_attach_path;
 
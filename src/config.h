@@ -5,9 +5,20 @@
 #define BUF_SIZE 8192
 #define STDIO_BUF_SIZE 8192
 #define CONN_SOCK_BUF_SIZE 32768
+#define CGROUP_KEYED_BUF_SIZE 4096
+#define CONTROL_LINE_MAX 1024
+#define FOLLOW_QUEUE_SIZE (256 * 1024)
+#define FOLLOW_FILES_MAX 8
+#define FOLLOW_DRAIN_TIMEOUT_MS 250
+#define FOLLOW_DRAIN_STALL_MS 50
+/* Of --log-max-line-size; each stream holds up to this much of a line. */
+#define LOG_MAX_LINE_SIZE_LIMIT (16 * 1024 * 1024)
+/* How long the start of a line is held by --log-max-line-size before it is written anyway. */
+#define LOG_PARTIAL_FLUSH_TIMEOUT_MS 1000
 #define DEFAULT_SOCKET_PATH "/var/run/crio"
 #define WIN_RESIZE_EVENT 1
 #define REOPEN_LOGS_EVENT 2
+#define STOP_EVENT 3
 #define TIMED_OUT_MESSAGE "command timed out"
 
 #endif // CONFIG_H
@@ -8,10 +8,13 @@
 #include "utils.h"
 #include "ctr_logging.h"
 #include "cgroup.h"
+#include "cgroup_stats.h"
 #include "cli.h"
 #include "globals.h"
 #include "oom.h"
 #include "conn_sock.h"
+#include "control_sock.h"
+#include "follow_sock.h"
 #include "ctrl.h"
 #include "ctr_stdio.h"
 #include "config.h"
@@ -20,6 +23,10 @@
 #include "close_fds.h"
 #include "runtime_args.h"
 #include "self_pipe.h"
+#include "spawn.h"
+#include "psi.h"
+#include "live_stats.h"
+#include "probes.h"
 
 #include <sys/stat.h>
 #include <locale.h>
@@ -36,6 +43,125 @@ static void disconnect_std_streams(int dev_null_r, int dev_null_w)
 
 #define DEFAULT_UMASK 0022
 
+/* Everything the runtime child needs, prepared up front by the parent. */
+struct runtime_child_args {
+	int workerfd_stdin;
+	int workerfd_stdout;
+	int workerfd_stderr;
+	int start_pipe_fd;
+	const sigset_t *oldmask;
+	char **argv;
+	char **envp;
+	/* Index of the LISTEN_PID entry in envp to replace with the child's pid, or -1 */
+	int listen_pid_index;
+	/* If set, the child reports this and fails */
+	char *error;
+};
+
+/*
+ * If LISTEN_PID env is set, we need to set the LISTEN_PID it to the new child
+ * process. The child cannot use setenv(), so give it a copy of the environment
+ * to patch instead. Returns the copy, if one was made.
+ */
+static char **prepare_listen_pid_env(struct runtime_child_args *args)
+{
+	char *listenpid = getenv("LISTEN_PID");
+	if (listenpid == NULL)
+		return NULL;
+
+	errno = 0;
+	int lpid = strtol(listenpid, NULL, 10);
+	if (errno != 0 || lpid <= 0) {
+		args->error = g_strdup_printf("Invalid LISTEN_PID %.10s", listenpid);
+		return NULL;
+	}
+	/* The child's parent is us. */
+	if (!opt_replace_listen_pid && lpid != getpid())
+		return NULL;
+
+	size_t n_env = 0;
+	while (environ[n_env])
+		n_env++;
+
+	char **envp = g_malloc(sizeof(char *) * (n_env + 1));
+	for (size_t i = 0; i <= n_env; i++) {
+		envp[i] = environ[i];
+		if (envp[i] && g_str_has_prefix(envp[i], "LISTEN_PID="))
+			args->listen_pid_index = i;
+	}
+	args->envp = envp;
+	return envp;
+}
+
+/*
+ * runtime_child sets up the stdio of the runtime and execs it. It may be
+ * sharing our memory (see spawn.h), so it sticks to async-signal-safe calls and
+ * only writes to its own stack and to args->envp.
+ */
+static int runtime_child(void *data)
+{
+	struct runtime_child_args *args = data;
+	char listen_pid_env[32];
+
+	if (args->error)
+		spawn_child_fail(args->error);
+
+	if (set_pdeathsig(SIGKILL) < 0)
+		spawn_child_fail("Failed to set PDEATHSIG");
+	if (sigprocmask(SIG_SETMASK, args->oldmask, NULL) < 0)
+		spawn_child_fail("Failed to unblock signals");
+
+	if (!logging_is_passthrough()) {
+		int workerfd_stdin = args->workerfd_stdin;
+		int workerfd_stdout = args->workerfd_stdout;
+
+		/*
+		 * EINVAL indicates the type of file descriptor used is not supporting fchmod(2) on the given platform.
+		 * Only more unusual cases are logged.
+		 */
+		if (workerfd_stdin < 0)
+			workerfd_stdin = dev_null_r;
+		if (dup2(workerfd_stdin, STDIN_FILENO) < 0)
+			spawn_child_fail("Failed to dup over stdin");
+		if (workerfd_stdin != dev_null_r && fchmod(STDIN_FILENO, 0777) < 0 && errno != EINVAL)
+			spawn_child_warn("Failed to chmod stdin");
+
+		if (workerfd_stdout < 0)
+			workerfd_stdout = dev_null_w;
+		if (dup2(workerfd_stdout, STDOUT_FILENO) < 0)
+			spawn_child_fail("Failed to dup over stdout");
+		if (workerfd_stdout != dev_null_w && fchmod(STDOUT_FILENO, 0777) < 0 && errno != EINVAL)
+			spawn_child_warn("Failed to chmod stdout");
+
+		if (dup2(args->workerfd_stderr, STDERR_FILENO) < 0)
+			spawn_child_fail("Failed to dup over stderr");
+		if (args->workerfd_stderr != dev_null_w && fchmod(STDERR_FILENO, 0777) < 0 && errno != EINVAL)
+			spawn_child_warn("Failed to chmod stderr");
+	}
+
+	if (args->listen_pid_index >= 0) {
+		size_t prefix_len = strlen("LISTEN_PID=");
+		memcpy(listen_pid_env, "LISTEN_PID=", prefix_len);
+		spawn_format_int(listen_pid_env + prefix_len, sizeof(listen_pid_env) - prefix_len, getpid());
+		args->envp[args->listen_pid_index] = listen_pid_env;
+	}
+
+	// If we are execing, and the user is trying to attach to this exec session,
+	// we need to wait until they attach to the console before actually execing,
+	// or else we may lose output
+	if (args->start_pipe_fd > 0) {
+		char buf[BUF_SIZE];
+		if (read(args->start_pipe_fd, buf, BUF_SIZE) < 0)
+			spawn_child_fail("start-pipe read failed");
+		close(args->start_pipe_fd);
+	}
+
+	// We don't want runc to be unkillable so we reset the oom_score_adj back to 0
+	reset_oom_adjust_async_safe();
+	execve(args->argv[0], args->argv, args->envp);
+	return 127;
+}
+
 int main(int argc, char *argv[])
 {
 	setlocale(LC_ALL, "");
@@ -185,14 +311,27 @@ int main(int argc, char *argv[])
 	mainfd_stderr = fds[0];
 	workerfd_stderr = fds[1];
 
+	setup_live_stats();
+
 	GPtrArray *runtime_argv = configure_runtime_args(csname);
 
 	/* Setup endpoint for attach */
-	_cleanup_free_ char *attach_symlink_dir_path = NULL;
+	_cleanup_free_ char *control_sock_path = NULL;
+	_cleanup_free_ char *follow_sock_path = NULL;
 	if (opt_bundle_path != NULL && !logging_is_passthrough()) {
-		attach_symlink_dir_path = setup_attach_socket();
-		dummyfd = setup_terminal_control_fifo();
-		setup_console_fifo();
+		if (opt_control_socket)
+			control_sock_path = setup_control_socket();
+		if (opt_follow_socket)
+			follow_sock_path = setup_follow_socket();
+		/* With --lazy-endpoints the attach socket is created once asked for on the
+		   control socket, which also takes the place of the fifos. An exec
+		   session being attached to needs it right away. */
+		if (!opt_lazy_endpoints || opt_attach)
+			setup_attach_socket();
+		if (!opt_lazy_endpoints) {
+			dummyfd = setup_terminal_control_fifo();
+			setup_console_fifo();
+		}
 
 		if (opt_attach) {
 			ndebug("sending attach message to parent");
@@ -214,77 +353,29 @@ int main(int argc, char *argv[])
 	 */
 
 	/* Create our container. */
-	create_pid = fork();
-	if (create_pid < 0) {
-		pexit("Failed to fork the create command");
-	} else if (!create_pid) {
-		if (set_pdeathsig(SIGKILL) < 0)
-			_pexit("Failed to set PDEATHSIG");
-		if (sigprocmask(SIG_SETMASK, &oldmask, NULL) < 0)
-			_pexit("Failed to unblock signals");
-
-		if (!logging_is_passthrough()) {
-			/*
-			 * EINVAL indicates the type of file descriptor used is not supporting fchmod(2) on the given platform.
-			 * Only more unusual cases are logged.
-			 */
-			if (workerfd_stdin < 0)
-				workerfd_stdin = dev_null_r;
-			if (dup2(workerfd_stdin, STDIN_FILENO) < 0)
-				_pexit("Failed to dup over stdin");
-			if (workerfd_stdin != dev_null_r && fchmod(STDIN_FILENO, 0777) < 0 && errno != EINVAL)
-				nwarn("Failed to chmod stdin");
-
-			if (workerfd_stdout < 0)
-				workerfd_stdout = dev_null_w;
-			if (dup2(workerfd_stdout, STDOUT_FILENO) < 0)
-				_pexit("Failed to dup over stdout");
-			if (workerfd_stdout != dev_null_w && fchmod(STDOUT_FILENO, 0777) < 0 && errno != EINVAL)
-				nwarn("Failed to chmod stdout");
-
-			if (dup2(workerfd_stderr, STDERR_FILENO) < 0)
-				_pexit("Failed to dup over stderr");
-			if (workerfd_stderr != dev_null_w && fchmod(STDERR_FILENO, 0777) < 0 && errno != EINVAL)
-				nwarn("Failed to chmod stderr");
-		}
-		/* If LISTEN_PID env is set, we need to set the LISTEN_PID
-		   it to the new child process */
-		char *listenpid = getenv("LISTEN_PID");
-		if (listenpid != NULL) {
-			errno = 0;
-			int lpid = strtol(listenpid, NULL, 10);
-			if (errno != 0 || lpid <= 0)
-				_pexitf("Invalid LISTEN_PID %.10s", listenpid);
-			if (opt_replace_listen_pid || lpid == getppid()) {
-				gchar *pidstr = g_strdup_printf("%d", getpid());
-				if (!pidstr)
-					_pexit("Failed to g_strdup_sprintf pid");
-				if (setenv("LISTEN_PID", pidstr, true) < 0)
-					_pexit("Failed to setenv LISTEN_PID");
-				free(pidstr);
-			}
-		}
-
-		// If we are execing, and the user is trying to attach to this exec session,
-		// we need to wait until they attach to the console before actually execing,
-		// or else we may lose output
-		if (opt_attach) {
-			if (start_pipe_fd > 0) {
-				ndebug("exec with attach is waiting for start message from parent");
-				num_read = read(start_pipe_fd, buf, BUF_SIZE);
-				if (num_read < 0) {
-					_pexit("start-pipe read failed");
-				}
-				ndebug("exec with attach got start message from parent");
-				close(start_pipe_fd);
-			}
-		}
+	struct runtime_child_args child_args = {
+		.workerfd_stdin = workerfd_stdin,
+		.workerfd_stdout = workerfd_stdout,
+		.workerfd_stderr = workerfd_stderr,
+		.start_pipe_fd = opt_attach ? start_pipe_fd : -1,
+		.oldmask = &oldmask,
+		.argv = (char **)runtime_argv->pdata,
+		.envp = environ,
+		.listen_pid_index = -1,
+		.error = NULL,
+	};
+	_cleanup_free_ char **child_envp = prepare_listen_pid_env(&child_args);
+	_cleanup_free_ char *child_error = child_args.error;
 
-		// We don't want runc to be unkillable so we reset the oom_score_adj back to 0
-		reset_oom_adjust();
-		execv(g_ptr_array_index(runtime_argv, 0), (char **)runtime_argv->pdata);
-		exit(127);
-	}
+	/*
+	 * If we are execing, and the user is trying to attach to this exec session, the child
+	 * blocks until they attach, so it must not suspend us while it waits.
+	 */
+	int pidfd = -1;
+	create_pid = spawn_child(runtime_child, &child_args, child_args.start_pipe_fd < 0, &pidfd);
+	if (create_pid < 0)
+		pexit("Failed to fork the create command");
+	create_pidfd = pidfd;
 
 	if (logging_is_passthrough())
 		disconnect_std_streams(dev_null_r, dev_null_w);
@@ -353,6 +444,7 @@ int main(int argc, char *argv[])
 			}
 			pexitf("Failed to wait for `runtime %s`", opt_exec ? "exec" : "create");
 		}
+		CONMON_PROBE2(child_reaped, create_pid, runtime_status);
 		create_pid = -1;
 	}
 
@@ -428,6 +520,8 @@ int main(int argc, char *argv[])
 
 #ifdef __linux__
 	setup_oom_handling(container_pid);
+	setup_pressure_triggers();
+	setup_cgroup_stats();
 #endif
 
 	if (mainfd_stdout >= 0) {
@@ -486,6 +580,9 @@ int main(int argc, char *argv[])
 	if (!timed_out)
 		drain_stdio();
 
+	/* The main loop is done, switch to a rotated log file right away */
+	finish_log_rotation();
+
 	if (!opt_no_sync_log)
 		sync_logs();
 
@@ -497,16 +594,15 @@ int main(int argc, char *argv[])
 	 * the timer elapsed. Ignore the timeout and treat it like a normal container exit.
 	 */
 	if (timed_out && container_pid > 0) {
-		pid_t process_group = getpgid(container_pid);
-		/* if process_group is 1, we will end up calling
-		 *  kill(-1), which kills everything conmon is allowed to. */
-		if (process_group > 1)
-			kill(-process_group, SIGKILL);
-		else
-			kill(container_pid, SIGKILL);
+		kill_container(TRUE);
 		exit_message = TIMED_OUT_MESSAGE;
 	} else {
 		exit_status = get_exit_status(container_status);
+#ifdef __linux__
+		/* A stop escalated to cgroup.kill, the container is only gone once its cgroup is empty */
+		finish_cgroup_kill();
+		record_oom_exit(container_status);
+#endif
 	}
 
 	/* Close down the signalfd */
@@ -529,7 +625,7 @@ int main(int argc, char *argv[])
 	/* Write the exit file to container persistent directory if it is specified */
 	if (opt_persist_path) {
 		_cleanup_free_ char *ctr_exit_file_path = g_build_filename(opt_persist_path, "exit", NULL);
-		if (!g_file_set_contents(ctr_exit_file_path, status_str, -1, &err))
+		if (!write_exit_file(ctr_exit_file_path, status_str, &err))
 			nexitf("Failed to write %s to container exit file: %s", status_str, err->message);
 	}
 
@@ -539,15 +635,28 @@ int main(int argc, char *argv[])
 	 */
 	if (opt_exit_dir) {
 		_cleanup_free_ char *exit_file_path = g_build_filename(opt_exit_dir, opt_cid, NULL);
-		if (!g_file_set_contents(exit_file_path, status_str, -1, &err))
+		if (!write_exit_file(exit_file_path, status_str, &err))
 			nexitf("Failed to write %s to exit file: %s", status_str, err->message);
 	}
+
+	_cleanup_free_ char *stop_outcome = report_stop_outcome();
+	reply_to_stop_requests(stop_outcome);
+	notify_exit_socket(exit_status);
+
 	/* Send the command exec exit code back to the parent */
 	if (opt_exec && sync_pipe_fd >= 0)
 		write_or_close_sync_fd(&sync_pipe_fd, exit_status, exit_message);
 
-	if (attach_symlink_dir_path != NULL && unlink(attach_symlink_dir_path) == -1 && errno != ENOENT)
-		pexit("Failed to remove symlink for attach socket directory");
+	/* Only now, after the exit has been reported. This still holds up the --exit-command, run
+	   at exit, which is why the drain is short and gives up on clients that stop reading. */
+	drain_follow_clients(FOLLOW_DRAIN_TIMEOUT_MS);
+
+	remove_attach_socket();
+
+	if (control_sock_path != NULL && unlink(control_sock_path) == -1 && errno != ENOENT)
+		nwarnf("Failed to remove control socket %s", control_sock_path);
+	if (follow_sock_path != NULL && unlink(follow_sock_path) == -1 && errno != ENOENT)
+		nwarnf("Failed to remove follow socket %s", follow_sock_path);
 
 	return exit_status;
 }
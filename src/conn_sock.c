@@ -1,11 +1,16 @@
 #define _GNU_SOURCE
 
 #include "conn_sock.h"
+#include "control_sock.h"
+#include "follow_sock.h"
+#include "counters.h"
 #include "ctr_exit.h"
 #include "globals.h"
+#include "live_stats.h"
 #include "utils.h"
 #include "config.h"
 #include "cli.h" // opt_stdin
+#include "probes.h"
 
 #include <stdbool.h>
 #include <sys/socket.h>
@@ -23,9 +28,22 @@ static void remote_sock_shutdown(struct remote_sock_s *sock, int how);
 static void schedule_local_sock_write(struct local_sock_s *local_sock);
 static void sock_try_write_to_local_sock(struct remote_sock_s *sock);
 static gboolean local_sock_write_cb(G_GNUC_UNUSED int fd, G_GNUC_UNUSED GIOCondition condition, G_GNUC_UNUSED gpointer user_data);
-static char *bind_unix_socket(char *socket_relative_name, int sock_type, mode_t perms, struct remote_sock_s *remote_sock,
-			      gboolean use_full_attach_path);
-static char *socket_parent_dir(gboolean use_full_attach_path, size_t desired_len);
+static char *bind_unix_socket(char *socket_relative_name, int sock_type, mode_t perms, int *sock_fd, gboolean use_full_attach_path,
+			      gboolean fatal);
+static char *socket_parent_dir(gboolean use_full_attach_path, size_t desired_len, gboolean fatal);
+
+/*
+ * A socket could not be set up: exit if conmon can't do without it (fatal),
+ * otherwise warn, leaving errno as it was, and have the caller return an error.
+ */
+#define socket_setup_failed(fatal, fmt, ...) \
+	do { \
+		if (fatal) \
+			pexitf(fmt, ##__VA_ARGS__); \
+		int saved_errno = errno; \
+		nwarnf(fmt ": %m", ##__VA_ARGS__); \
+		errno = saved_errno; \
+	} while (0)
 /*
   Since our socket handling is abstract now, handling is based on sock_type, so we can pass around a structure
   that contains everything we need to handle I/O.  Callbacks used to handle IO, for example, and whether this
@@ -49,6 +67,8 @@ struct remote_sock_s remote_attach_sock = {
 	0,		     /* off */
 	{0}		     /* buf */
 };
+/* Set once the attach socket exists, removed on exit. */
+static char *attach_sock_path = NULL;
 /*
   This defines the Container SDNotify socket, attaches it to the correct FD and sets the flags for handling I/O.
   setup_notify_socket() is responsible for initializing the unix sockets and pushing it onto the queue.
@@ -75,7 +95,7 @@ struct remote_sock_s remote_notify_sock = {
 /* External */
 
 #ifdef __linux__
-static void bind_relative_to_dir(int dir_fd, int sock_fd, const char *path)
+static int bind_relative_to_dir(int dir_fd, int sock_fd, const char *path, gboolean fatal)
 {
 	struct sockaddr_un addr;
 
@@ -94,10 +114,15 @@ static void bind_relative_to_dir(int dir_fd, int sock_fd, const char *path)
 	}
 	ndebugf("addr{sun_family=AF_UNIX, sun_path=%s}", addr.sun_path);
 
-	if (fchmod(sock_fd, 0700))
-		pexit("Failed to change console-socket permissions");
-	if (bind(sock_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
-		pexit("Failed to bind to console-socket");
+	if (fchmod(sock_fd, 0700)) {
+		socket_setup_failed(fatal, "Failed to change console-socket permissions");
+		return -1;
+	}
+	if (bind(sock_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		socket_setup_failed(fatal, "Failed to bind to console-socket");
+		return -1;
+	}
+	return 0;
 }
 
 static void set_socket_buffers(G_GNUC_UNUSED int fd)
@@ -116,7 +141,7 @@ static void set_socket_buffers(G_GNUC_UNUSED int fd)
 #define O_PATH 0
 #endif
 
-static void bind_relative_to_dir(int dir_fd, int sock_fd, const char *path)
+static int bind_relative_to_dir(int dir_fd, int sock_fd, const char *path, gboolean fatal)
 {
 	struct sockaddr_un addr;
 
@@ -128,10 +153,15 @@ static void bind_relative_to_dir(int dir_fd, int sock_fd, const char *path)
 	strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
 	addr.sun_path[sizeof(addr.sun_path) - 1] = '\0';
 	ndebugf("addr{sun_family=AF_UNIX, sun_path=%s}", addr.sun_path);
-	if (bindat(dir_fd, sock_fd, (struct sockaddr *)&addr, sizeof(addr)) == -1)
-		pexit("Failed to bind to console-socket");
-	if (fchmodat(dir_fd, addr.sun_path, 0700, AT_SYMLINK_NOFOLLOW))
-		pexit("Failed to change console-socket permissions");
+	if (bindat(dir_fd, sock_fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+		socket_setup_failed(fatal, "Failed to bind to console-socket");
+		return -1;
+	}
+	if (fchmodat(dir_fd, addr.sun_path, 0700, AT_SYMLINK_NOFOLLOW)) {
+		socket_setup_failed(fatal, "Failed to change console-socket permissions");
+		return -1;
+	}
+	return 0;
 }
 
 static void set_socket_buffers(int fd)
@@ -168,24 +198,84 @@ char *setup_console_socket(void)
 	console_socket_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
 	if (console_socket_fd < 0)
 		pexit("Failed to create socket");
-	bind_relative_to_dir(-1, console_socket_fd, csname);
+	bind_relative_to_dir(-1, console_socket_fd, csname, TRUE);
 	if (listen(console_socket_fd, 128) < 0)
 		pexit("Failed to listen on console-socket");
 
 	return csname;
 }
 
-char *setup_attach_socket(void)
+static int create_attach_socket(gboolean fatal)
 {
-	char *symlink_dir_path =
-		bind_unix_socket("attach", SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0700, &remote_attach_sock, opt_full_attach_path);
-
-	if (listen(remote_attach_sock.fd, 10) == -1)
-		pexitf("Failed to listen on attach socket: %s/%s", symlink_dir_path, "attach");
+	if (attach_sock_path != NULL)
+		return 0;
+
+	int fd = -1;
+	_cleanup_free_ char *path =
+		bind_unix_socket("attach", SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0700, &fd, opt_full_attach_path, fatal);
+	if (path == NULL)
+		return -1;
+
+	if (listen(fd, 10) == -1) {
+		socket_setup_failed(fatal, "Failed to listen on attach socket: %s", path);
+		int saved_errno = errno;
+		close(fd);
+		unlink(path);
+		errno = saved_errno;
+		return -1;
+	}
 
+	remote_attach_sock.fd = fd;
+	attach_sock_path = path;
+	path = NULL;
 	g_unix_fd_add(remote_attach_sock.fd, G_IO_IN, attach_cb, &remote_attach_sock);
+	return 0;
+}
 
-	return symlink_dir_path;
+/* Create the attach socket, unless it is there already. Exits on failure. */
+void setup_attach_socket(void)
+{
+	create_attach_socket(TRUE);
+}
+
+/* As setup_attach_socket(), for a client asking for it: returns -1 with errno set on failure. */
+int try_setup_attach_socket(void)
+{
+	return create_attach_socket(FALSE);
+}
+
+void remove_attach_socket(void)
+{
+	if (attach_sock_path != NULL && unlink(attach_sock_path) == -1 && errno != ENOENT)
+		pexit("Failed to remove symlink for attach socket directory");
+	g_free(attach_sock_path);
+	attach_sock_path = NULL;
+}
+
+char *setup_control_socket(void)
+{
+	int control_fd = -1;
+	char *sock_path = bind_unix_socket("control", SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0700, &control_fd, opt_full_attach_path, TRUE);
+
+	if (listen(control_fd, 10) == -1)
+		pexitf("Failed to listen on control socket: %s", sock_path);
+
+	g_unix_fd_add(control_fd, G_IO_IN, control_accept_cb, NULL);
+
+	return sock_path;
+}
+
+char *setup_follow_socket(void)
+{
+	int follow_fd = -1;
+	char *sock_path = bind_unix_socket("follow", SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0700, &follow_fd, opt_full_attach_path, TRUE);
+
+	if (listen(follow_fd, 10) == -1)
+		pexitf("Failed to listen on follow socket: %s", sock_path);
+
+	g_unix_fd_add(follow_fd, G_IO_IN, follow_accept_cb, NULL);
+
+	return sock_path;
 }
 
 void setup_notify_socket(char *socket_path)
@@ -204,7 +294,7 @@ void setup_notify_socket(char *socket_path)
 	/* No _cleanup_free_ here so we don't get a warning about unused variables
 	 * when compiling with clang */
 	char *symlink_dir_path =
-		bind_unix_socket("notify/notify.sock", SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0777, &remote_notify_sock, TRUE);
+		bind_unix_socket("notify/notify.sock", SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0777, &remote_notify_sock.fd, TRUE, TRUE);
 	g_unix_fd_add(remote_notify_sock.fd, G_IO_IN | G_IO_HUP | G_IO_ERR, remote_sock_cb, &remote_notify_sock);
 
 	g_free(symlink_dir_path);
@@ -216,14 +306,14 @@ static size_t max_socket_path_len()
 	return sizeof(addr.sun_path);
 }
 
-/* REMEMBER to g_free() the return value! */
-static char *bind_unix_socket(char *socket_relative_name, int sock_type, mode_t perms, struct remote_sock_s *remote_sock,
-			      gboolean use_full_attach_path)
+/* REMEMBER to g_free() the return value! NULL if it failed and fatal is not set. */
+static char *bind_unix_socket(char *socket_relative_name, int sock_type, mode_t perms, int *sock_fd, gboolean use_full_attach_path,
+			      gboolean fatal)
 {
-	int socket_fd = -1;
-
 	/* get the parent_dir of the socket. We'll use this to get the location of the socket. */
-	_cleanup_free_ char *parent_dir = socket_parent_dir(use_full_attach_path, max_socket_path_len());
+	_cleanup_free_ char *parent_dir = socket_parent_dir(use_full_attach_path, max_socket_path_len(), fatal);
+	if (parent_dir == NULL)
+		return NULL;
 
 	/*
 	 * To be able to access the location of the attach socket, without first creating the attach socket
@@ -232,35 +322,50 @@ static char *bind_unix_socket(char *socket_relative_name, int sock_type, mode_t
 	 * to actually refer to the file where the socket will be created below.
 	 */
 	_cleanup_close_ int parent_dir_fd = open(parent_dir, O_PATH | O_CLOEXEC);
-	if (parent_dir_fd < 0)
-		pexitf("failed to open socket path parent dir %s", parent_dir);
+	if (parent_dir_fd < 0) {
+		socket_setup_failed(fatal, "failed to open socket path parent dir %s", parent_dir);
+		return NULL;
+	}
 
 	/*
 	 * We use the fullpath for operations that aren't as limited in length as socket_addr.sun_path
 	 * Cleanup of this variable is up to the caller
 	 */
-	char *sock_fullpath = g_build_filename(parent_dir, socket_relative_name, NULL);
+	_cleanup_free_ char *sock_fullpath = g_build_filename(parent_dir, socket_relative_name, NULL);
 
 	/*
 	 * We make the socket non-blocking to avoid a race where client aborts connection
 	 * before the server gets a chance to call accept. In that scenario, the server
 	 * accept blocks till a new client connection comes in.
 	 */
-	socket_fd = socket(AF_UNIX, sock_type, 0);
-	if (socket_fd == -1)
-		pexitf("Failed to create socket %s", sock_fullpath);
+	_cleanup_close_ int socket_fd = socket(AF_UNIX, sock_type, 0);
+	if (socket_fd == -1) {
+		socket_setup_failed(fatal, "Failed to create socket %s", sock_fullpath);
+		return NULL;
+	}
 
-	if (unlink(sock_fullpath) == -1 && errno != ENOENT)
-		pexitf("Failed to remove existing socket: %s", sock_fullpath);
+	if (unlink(sock_fullpath) == -1 && errno != ENOENT) {
+		socket_setup_failed(fatal, "Failed to remove existing socket: %s", sock_fullpath);
+		return NULL;
+	}
 
-	bind_relative_to_dir(parent_dir_fd, socket_fd, socket_relative_name);
+	if (bind_relative_to_dir(parent_dir_fd, socket_fd, socket_relative_name, fatal) < 0)
+		return NULL;
 
-	if (chmod(sock_fullpath, perms))
-		pexitf("Failed to change socket permissions %s", sock_fullpath);
+	if (chmod(sock_fullpath, perms)) {
+		socket_setup_failed(fatal, "Failed to change socket permissions %s", sock_fullpath);
+		int saved_errno = errno;
+		unlink(sock_fullpath);
+		errno = saved_errno;
+		return NULL;
+	}
 
-	remote_sock->fd = socket_fd;
+	*sock_fd = socket_fd;
+	socket_fd = -1;
 
-	return sock_fullpath;
+	char *path = sock_fullpath;
+	sock_fullpath = NULL;
+	return path;
 }
 
 /*
@@ -270,7 +375,7 @@ static char *bind_unix_socket(char *socket_relative_name, int sock_type, mode_t
  * base_path is the path of the socket
  * desired_len is the length of socket_addr.sun_path (should be strlen(char[108]) on linux).
  */
-char *socket_parent_dir(gboolean use_full_attach_path, size_t desired_len)
+char *socket_parent_dir(gboolean use_full_attach_path, size_t desired_len, gboolean fatal)
 {
 	/* if we're to use the full path, ignore the socket path and only use the bundle_path */
 	if (use_full_attach_path)
@@ -294,11 +399,17 @@ char *socket_parent_dir(gboolean use_full_attach_path, size_t desired_len)
 	 * Create a symlink so we don't exceed unix domain socket
 	 * path length limit.  We use the base path passed in from our parent.
 	 */
-	if (unlink(base_path) == -1 && errno != ENOENT)
-		pexitf("Failed to remove existing symlink for socket directory %s", base_path);
+	if (unlink(base_path) == -1 && errno != ENOENT) {
+		socket_setup_failed(fatal, "Failed to remove existing symlink for socket directory %s", base_path);
+		g_free(base_path);
+		return NULL;
+	}
 
-	if (symlink(opt_bundle_path, base_path) == -1)
-		pexit("Failed to create symlink for notify socket");
+	if (symlink(opt_bundle_path, base_path) == -1) {
+		socket_setup_failed(fatal, "Failed to create symlink for notify socket");
+		g_free(base_path);
+		return NULL;
+	}
 
 	// Ensure the link is deleted when we exit
 	atexit(cleanup_socket_dir_symlink);
@@ -320,11 +431,15 @@ void write_back_to_remote_consoles(char *buf, int len)
 	for (int i = local_mainfd_stdin.readers->len; i > 0; i--) {
 		struct remote_sock_s *remote_sock = g_ptr_array_index(local_mainfd_stdin.readers, i - 1);
 
+		if (!remote_sock->writable)
+			continue;
 #ifdef __FreeBSD__
-		if (remote_sock->writable && send(remote_sock->fd, buf, len, MSG_EOR) < 0) {
+		ssize_t ret = send(remote_sock->fd, buf, len, MSG_EOR);
 #else
-		if (remote_sock->writable && write_all(remote_sock->fd, buf, len) < 0) {
+		ssize_t ret = write_all(remote_sock->fd, buf, len);
 #endif
+		CONMON_PROBE3(console_write, remote_sock->fd, len, ret);
+		if (ret < 0) {
 			nwarn("Failed to write to remote console socket");
 			remote_sock_shutdown(remote_sock, SHUT_WR);
 		}
@@ -353,6 +468,9 @@ static gboolean attach_cb(int fd, G_GNUC_UNUSED GIOCondition condition, gpointer
 		remote_sock->fd = new_fd;
 		g_unix_fd_add(remote_sock->fd, G_IO_IN | G_IO_HUP | G_IO_ERR, remote_sock_cb, remote_sock);
 		g_ptr_array_add(remote_sock->dest->readers, remote_sock);
+		CONMON_PROBE2(attach_accept, remote_sock->fd, srcsock->sock_type);
+		counters.attach_clients++;
+		publish_live_stats();
 		ndebugf("Accepted%s connection %d", SOCK_IS_CONSOLE(srcsock->sock_type) ? " console" : "", remote_sock->fd);
 	}
 
@@ -489,8 +607,11 @@ static void remote_sock_shutdown(struct remote_sock_s *sock, int how)
 	}
 	if (!sock->writable && !sock->readable) {
 		ndebugf("Closing %d", sock->fd);
+		CONMON_PROBE1(attach_close, sock->fd);
 		close(sock->fd);
 		sock->fd = -1;
+		counters.attach_clients--;
+		publish_live_stats();
 		if (sock->dest->readers != NULL) {
 			g_ptr_array_remove(sock->dest->readers, sock);
 		}
@@ -48,7 +48,11 @@ struct local_sock_s {
 };
 
 char *setup_console_socket(void);
-char *setup_attach_socket(void);
+void setup_attach_socket(void);
+int try_setup_attach_socket(void);
+void remove_attach_socket(void);
+char *setup_control_socket(void);
+char *setup_follow_socket(void);
 void setup_notify_socket(char *);
 void schedule_main_stdin_write();
 void write_back_to_remote_consoles(char *buf, int len);
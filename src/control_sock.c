@@ -0,0 +1,443 @@
+#define _GNU_SOURCE
+
+#include "control_sock.h"
+#include "config.h"
+#include "conn_sock.h"
+#include "counters.h"
+#include "ctr_exit.h"
+#include "ctr_logging.h"
+#include "ctrl.h"
+#include "log_format.h"
+#include "utils.h"
+
+#include <errno.h>
+#include <glib-unix.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+/* Requests are flat objects, there is no command with more fields than this. */
+#define CONTROL_MAX_FIELDS 8
+
+struct control_client {
+	int fd;
+	size_t len;
+	char buf[CONTROL_LINE_MAX + 1];
+};
+
+struct control_field {
+	const char *key;
+	const char *value;
+	gboolean is_string;
+	char scalar[24]; /* numbers, true, false and null are copied here */
+};
+
+struct control_request {
+	struct control_field fields[CONTROL_MAX_FIELDS];
+	size_t n_fields;
+};
+
+struct control_command {
+	const char *name;
+	/* Returns NULL on success or the error to reply with. May append ", \"key\": value" pairs to extra. */
+	const char *(*handle)(const struct control_request *req, GString *extra);
+	/* On success, the reply waits until the container has exited, see reply_to_stop_requests(). */
+	gboolean reply_at_exit;
+};
+
+/* Clients that sent a stop request, no longer read from until they get their reply. */
+static GPtrArray *stop_clients = NULL;
+
+static char *skip_space(char *p)
+{
+	while (*p == ' ' || *p == '\t' || *p == '\r')
+		p++;
+	return p;
+}
+
+/* Parse the string starting at the opening quote p, unescaping it in place.
+   Returns the position after the closing quote, or NULL. */
+static char *parse_string(char *p, const char **out)
+{
+	char *dst = ++p;
+
+	*out = dst;
+	while (*p != '"') {
+		if (*p == '\0' || (unsigned char)*p < 0x20)
+			return NULL;
+		if (*p == '\\') {
+			switch (*++p) {
+			case '"':
+			case '\\':
+			case '/':
+				break;
+			case 'n':
+				*p = '\n';
+				break;
+			case 't':
+				*p = '\t';
+				break;
+			default:
+				/* \uXXXX and the rest are of no use for any of our commands */
+				return NULL;
+			}
+		}
+		*dst++ = *p++;
+	}
+	*dst = '\0';
+	return p + 1;
+}
+
+static char *parse_scalar(char *p, struct control_field *field)
+{
+	size_t len = strspn(p, "abcdefghijklmnopqrstuvwxyz0123456789+-.E");
+
+	if (len == 0 || len >= sizeof(field->scalar))
+		return NULL;
+	memcpy(field->scalar, p, len);
+	field->scalar[len] = '\0';
+	field->value = field->scalar;
+	field->is_string = FALSE;
+	return p + len;
+}
+
+/* Parse a line such as {"command": "resize", "height": 24, "width": 80}. Nested objects and arrays are not supported. */
+static const char *parse_request(char *line, struct control_request *req)
+{
+	char *p = skip_space(line);
+
+	req->n_fields = 0;
+	if (*p++ != '{')
+		return "request must be a JSON object";
+
+	p = skip_space(p);
+	if (*p == '}')
+		return *skip_space(p + 1) == '\0' ? NULL : "trailing data after request";
+
+	for (;;) {
+		struct control_field *field;
+
+		if (req->n_fields == CONTROL_MAX_FIELDS)
+			return "too many fields";
+		field = &req->fields[req->n_fields++];
+
+		if (*p != '"' || (p = parse_string(p, &field->key)) == NULL)
+			return "malformed key";
+		p = skip_space(p);
+		if (*p++ != ':')
+			return "expected ':'";
+		p = skip_space(p);
+		if (*p == '"') {
+			field->is_string = TRUE;
+			p = parse_string(p, &field->value);
+		} else {
+			p = parse_scalar(p, field);
+		}
+		if (p == NULL)
+			return "malformed value";
+		p = skip_space(p);
+		if (*p == '}')
+			break;
+		if (*p++ != ',')
+			return "expected ',' or '}'";
+		p = skip_space(p);
+	}
+
+	if (*skip_space(p + 1) != '\0')
+		return "trailing data after request";
+	return NULL;
+}
+
+static const struct control_field *request_field(const struct control_request *req, const char *key)
+{
+	for (size_t i = 0; i < req->n_fields; i++)
+		if (strcmp(req->fields[i].key, key) == 0)
+			return &req->fields[i];
+	return NULL;
+}
+
+static const char *request_string(const struct control_request *req, const char *key)
+{
+	const struct control_field *field = request_field(req, key);
+	return field != NULL && field->is_string ? field->value : NULL;
+}
+
+/* Get an integer field, falling back to def if it is missing. Returns FALSE if it is not an integer. */
+static gboolean request_int(const struct control_request *req, const char *key, int def, int *value)
+{
+	const struct control_field *field = request_field(req, key);
+	char *endptr;
+	long v;
+
+	if (field == NULL) {
+		*value = def;
+		return TRUE;
+	}
+	if (field->is_string)
+		return FALSE;
+
+	errno = 0;
+	v = strtol(field->value, &endptr, 10);
+	if (errno != 0 || *endptr != '\0' || v < INT_MIN || v > INT_MAX)
+		return FALSE;
+	*value = v;
+	return TRUE;
+}
+
+static const char *handle_resize(const struct control_request *req, G_GNUC_UNUSED GString *extra)
+{
+	int height, width;
+
+	if (!request_int(req, "height", -1, &height) || !request_int(req, "width", -1, &width))
+		return "height and width must be integers";
+	if (height < 0 || width < 0 || height > 1000 || width > 1000)
+		return "height and width must be between 0 and 1000";
+	if (!request_resize(height, width))
+		return "failed to queue the resize";
+	return NULL;
+}
+
+static const char *handle_attach(G_GNUC_UNUSED const struct control_request *req, G_GNUC_UNUSED GString *extra)
+{
+	static char error[128];
+
+	/* Only missing with --lazy-endpoints. A client asking for it must not take conmon down if it can't be created. */
+	if (try_setup_attach_socket() < 0) {
+		snprintf(error, sizeof(error), "failed to create the attach socket: %s", strerror(errno));
+		return error;
+	}
+	return NULL;
+}
+
+static const char *handle_reopen_logs(G_GNUC_UNUSED const struct control_request *req, G_GNUC_UNUSED GString *extra)
+{
+	reopen_log_files();
+	return NULL;
+}
+
+static const char *handle_rotate_logs(G_GNUC_UNUSED const struct control_request *req, G_GNUC_UNUSED GString *extra)
+{
+	if (!rotate_log_files())
+		return "there is no k8s-file or json-file log to rotate";
+	return NULL;
+}
+
+static const char *handle_flush_logs(G_GNUC_UNUSED const struct control_request *req, G_GNUC_UNUSED GString *extra)
+{
+	sync_logs();
+	return NULL;
+}
+
+static const char *handle_log_level(const struct control_request *req, G_GNUC_UNUSED GString *extra)
+{
+	const char *level = request_string(req, "level");
+
+	if (level == NULL)
+		return "level must be a string";
+	if (set_log_level(level) < 0)
+		return "no such log level";
+	return NULL;
+}
+
+static const char *handle_pause_logs(G_GNUC_UNUSED const struct control_request *req, G_GNUC_UNUSED GString *extra)
+{
+	pause_log_capture(TRUE);
+	return NULL;
+}
+
+static const char *handle_resume_logs(G_GNUC_UNUSED const struct control_request *req, G_GNUC_UNUSED GString *extra)
+{
+	pause_log_capture(FALSE);
+	return NULL;
+}
+
+static const char *handle_stats(G_GNUC_UNUSED const struct control_request *req, GString *extra)
+{
+	char buf[2048];
+
+	format_counters_json(buf, sizeof(buf));
+	g_string_append_printf(extra, ", \"stats\": %s, \"log_capture_paused\": %s", buf, log_capture_is_paused() ? "true" : "false");
+	return NULL;
+}
+
+static const char *handle_stop(const struct control_request *req, G_GNUC_UNUSED GString *extra)
+{
+	int signal, grace;
+
+	if (!request_int(req, "signal", SIGTERM, &signal) || !request_int(req, "grace", 10, &grace))
+		return "signal and grace must be integers";
+	if (signal <= 0 || signal >= NSIG || grace < 0)
+		return "invalid signal or grace period";
+	stop_container(signal, grace);
+	return NULL;
+}
+
+static const struct control_command commands[] = {
+	{"attach", handle_attach, FALSE},
+	{"resize", handle_resize, FALSE},
+	{"reopen-logs", handle_reopen_logs, FALSE},
+	{"rotate-logs", handle_rotate_logs, FALSE},
+	{"flush-logs", handle_flush_logs, FALSE},
+	{"log-level", handle_log_level, FALSE},
+	{"pause-logs", handle_pause_logs, FALSE},
+	{"resume-logs", handle_resume_logs, FALSE},
+	{"stats", handle_stats, FALSE},
+	{"stop", handle_stop, TRUE},
+};
+
+static const char *process_request(char *line, GString *extra, gboolean *reply_at_exit)
+{
+	struct control_request req;
+	const char *error = parse_request(line, &req);
+	const char *name;
+
+	*reply_at_exit = FALSE;
+	if (error != NULL)
+		return error;
+
+	name = request_string(&req, "command");
+	if (name == NULL)
+		return "missing command";
+
+	for (size_t i = 0; i < G_N_ELEMENTS(commands); i++) {
+		if (strcmp(commands[i].name, name) == 0) {
+			ndebugf("Control request %s", name);
+			error = commands[i].handle(&req, extra);
+			*reply_at_exit = error == NULL && commands[i].reply_at_exit;
+			return error;
+		}
+	}
+	return "unknown command";
+}
+
+/* Returns FALSE if the client could not take the reply. */
+static gboolean send_reply(struct control_client *client, const char *error, GString *extra)
+{
+	_cleanup_free_ char *reply = NULL;
+
+	counters.control_requests++;
+	if (error != NULL) {
+		counters.control_rejected++;
+		/* errors can carry strerror() text, so escape them like anything else */
+		_cleanup_free_ char *escaped = escape_json_string(error);
+		reply = g_strdup_printf("{\"ok\": false, \"error\": \"%s\"}\n", escaped);
+	} else {
+		reply = g_strdup_printf("{\"ok\": true%s}\n", extra->str);
+	}
+
+	/* Replies are small; a client that does not read them is dropped rather than buffered for. */
+	ssize_t len = strlen(reply);
+	ssize_t sent;
+	do
+		sent = send(client->fd, reply, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+	while (sent < 0 && errno == EINTR);
+	if (sent != len) {
+		ndebugf("Dropping control client %d, failed to send reply", client->fd);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+static void close_control_client(struct control_client *client)
+{
+	close(client->fd);
+	g_free(client);
+}
+
+static gboolean control_client_cb(int fd, GIOCondition condition, gpointer user_data)
+{
+	struct control_client *client = user_data;
+	ssize_t num_read;
+
+	if ((condition & G_IO_IN) == 0) {
+		close_control_client(client);
+		return G_SOURCE_REMOVE;
+	}
+
+	do
+		num_read = read(fd, client->buf + client->len, CONTROL_LINE_MAX - client->len);
+	while (num_read < 0 && errno == EINTR);
+	if (num_read < 0 && errno == EAGAIN)
+		return G_SOURCE_CONTINUE;
+	if (num_read <= 0) {
+		close_control_client(client);
+		return G_SOURCE_REMOVE;
+	}
+	client->len += num_read;
+	client->buf[client->len] = '\0';
+
+	char *beg = client->buf;
+	char *newline;
+	while ((newline = memchr(beg, '\n', client->buf + client->len - beg)) != NULL) {
+		GString *extra = g_string_new(NULL);
+		gboolean reply_at_exit;
+		*newline = '\0';
+		const char *error = process_request(beg, extra, &reply_at_exit);
+		if (reply_at_exit) {
+			/* Anything the client sent after the request is dropped with the connection. */
+			g_string_free(extra, TRUE);
+			if (stop_clients == NULL)
+				stop_clients = g_ptr_array_new();
+			g_ptr_array_add(stop_clients, client);
+			return G_SOURCE_REMOVE;
+		}
+		gboolean sent = send_reply(client, error, extra);
+		g_string_free(extra, TRUE);
+		if (!sent) {
+			close_control_client(client);
+			return G_SOURCE_REMOVE;
+		}
+		beg = newline + 1;
+	}
+
+	client->len -= beg - client->buf;
+	memmove(client->buf, beg, client->len);
+	if (client->len == CONTROL_LINE_MAX) {
+		GString *extra = g_string_new(NULL);
+		send_reply(client, "request too long", extra);
+		g_string_free(extra, TRUE);
+		close_control_client(client);
+		return G_SOURCE_REMOVE;
+	}
+	return G_SOURCE_CONTINUE;
+}
+
+gboolean control_accept_cb(int fd, G_GNUC_UNUSED GIOCondition condition, G_GNUC_UNUSED gpointer user_data)
+{
+	int client_fd = accept4(fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if (client_fd < 0) {
+		if (errno != EAGAIN && errno != EINTR && errno != ECONNABORTED)
+			nwarn("Failed to accept control socket connection");
+		return G_SOURCE_CONTINUE;
+	}
+
+	struct control_client *client = g_new0(struct control_client, 1);
+	client->fd = client_fd;
+	g_unix_fd_add(client_fd, G_IO_IN | G_IO_HUP | G_IO_ERR, control_client_cb, client);
+	ndebugf("Accepted control connection %d", client_fd);
+	return G_SOURCE_CONTINUE;
+}
+
+void reply_to_stop_requests(const char *outcome)
+{
+	if (stop_clients == NULL)
+		return;
+
+	for (guint i = 0; i < stop_clients->len; i++) {
+		struct control_client *client = g_ptr_array_index(stop_clients, i);
+		GString *extra = g_string_new(NULL);
+
+		/* The container may have exited by itself before the stop got to it. */
+		if (outcome != NULL)
+			g_string_append_printf(extra, ", \"stop\": %s", outcome);
+		send_reply(client, outcome == NULL ? "the container exited before it was stopped" : NULL, extra);
+		g_string_free(extra, TRUE);
+		close_control_client(client);
+	}
+	g_ptr_array_free(stop_clients, TRUE);
+	stop_clients = NULL;
+}
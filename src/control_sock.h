@@ -0,0 +1,27 @@
+#if !defined(CONTROL_SOCK_H)
+#define CONTROL_SOCK_H
+
+/*
+ * The control socket, a SOCK_STREAM unix socket named "control" next to the
+ * attach socket. Each request is a single line holding a flat JSON object,
+ * and is answered with a single line:
+ *
+ *   {"command": "resize", "height": 24, "width": 80}
+ *   {"ok": true}
+ *
+ *   {"command": "rotate-logs"}
+ *   {"ok": false, "error": "log rotation failed"}
+ *
+ * See conmon(8) for the commands. The ctl and winsz fifos keep working as
+ * before.
+ */
+
+#include <glib.h> /* gboolean */
+
+gboolean control_accept_cb(int fd, GIOCondition condition, gpointer user_data);
+
+/* Answer the stop requests waiting for the container to exit, with outcome
+   from report_stop_outcome(), and close their connections. */
+void reply_to_stop_requests(const char *outcome);
+
+#endif // CONTROL_SOCK_H
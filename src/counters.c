@@ -0,0 +1,27 @@
+#include "counters.h"
+#include "log_driver.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+
+struct conmon_counters counters;
+
+int format_counters_json(char *buf, size_t len)
+{
+	char driver_errors[256];
+
+	format_log_driver_errors(driver_errors, sizeof(driver_errors));
+	return snprintf(buf, len,
+			"{\"stdout_bytes\": %" PRIu64 ", \"stdout_lines\": %" PRIu64 ", \"stderr_bytes\": %" PRIu64
+			", \"stderr_lines\": %" PRIu64 ", \"log_paused_bytes\": %" PRIu64 ", \"log_write_errors\": %" PRIu64
+			", \"log_suppressed_bytes\": %" PRIu64 ", \"log_suppressed_lines\": %" PRIu64 ", \"log_rate_blocked\": %" PRIu64
+			", \"log_collapsed_lines\": %" PRIu64 ", \"log_rotations\": %" PRIu64 ", \"last_write_latency_ns\": %" PRIu64
+			", \"attach_clients\": %" PRIu64 ", \"oom_events\": %" PRIu64 ", \"control_requests\": %" PRIu64
+			", \"control_rejected\": %" PRIu64 ", \"resize_requests\": %" PRIu64 ", \"resize_applied\": %" PRIu64
+			", \"follow_clients\": %" PRIu64 ", \"follow_lagged\": %" PRIu64 ", \"log_driver_errors\": %s}",
+			counters.stdout_bytes, counters.stdout_lines, counters.stderr_bytes, counters.stderr_lines, counters.log_paused_bytes,
+			counters.log_write_errors, counters.log_suppressed_bytes, counters.log_suppressed_lines, counters.log_rate_blocked,
+			counters.log_collapsed_lines, counters.log_rotations, counters.last_write_latency_ns, counters.attach_clients,
+			counters.oom_events, counters.control_requests, counters.control_rejected, counters.resize_requests,
+			counters.resize_applied, counters.follow_clients, counters.follow_lagged, driver_errors);
+}
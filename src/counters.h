@@ -0,0 +1,37 @@
+#if !defined(COUNTERS_H)
+#define COUNTERS_H
+
+#include <stddef.h> /* size_t */
+#include <stdint.h> /* uint64_t */
+
+/* Running totals of what conmon did for the container, reported through the
+   control socket and the live stats page. */
+struct conmon_counters {
+	uint64_t stdout_bytes;		/* read from the container's stdout */
+	uint64_t stdout_lines;		/* newlines in those */
+	uint64_t stderr_bytes;		/* read from the container's stderr */
+	uint64_t stderr_lines;		/* newlines in those */
+	uint64_t log_paused_bytes;	/* not logged because log capture was paused */
+	uint64_t log_write_errors;	/* failed writes to a log driver */
+	uint64_t log_suppressed_bytes;	/* dropped over the log rate limit */
+	uint64_t log_suppressed_lines;	/* newlines in those */
+	uint64_t log_rate_blocked;	/* times reading was held off by the log rate limit */
+	uint64_t log_collapsed_lines;	/* repeated lines left out by --log-dedup */
+	uint64_t log_rotations;		/* k8s-file rotations done */
+	uint64_t last_write_latency_ns; /* time taken to log the last buffer read */
+	uint64_t attach_clients;	/* attach connections open right now */
+	uint64_t oom_events;		/* OOM events seen in the container's cgroup */
+	uint64_t control_requests;	/* requests handled on the control socket */
+	uint64_t control_rejected;	/* of those, the ones answered with an error */
+	uint64_t resize_requests;	/* valid window resizes requested */
+	uint64_t resize_applied;	/* TIOCSWINSZ ioctls, after coalescing */
+	uint64_t follow_clients;	/* follow socket connections open right now */
+	uint64_t follow_lagged;		/* times a follow client fell behind its queue */
+};
+
+extern struct conmon_counters counters;
+
+/* Format the counters as a JSON object into buf, returns the length snprintf would have written. */
+int format_counters_json(char *buf, size_t len);
+
+#endif // COUNTERS_H
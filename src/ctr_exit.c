@@ -9,16 +9,45 @@
 #include "close_fds.h"
 #include "oom.h"
 #include "self_pipe.h"
+#include "spawn.h"
+#include "cgroup.h"
+#include "probes.h"
 
 #include <errno.h>
+#include <fcntl.h>
 #include <glib.h>
 #include <glib-unix.h>
 #include <signal.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
 
 volatile sig_atomic_t container_pid = -1;
 volatile sig_atomic_t create_pid = -1;
+/* pidfd of the runtime process, if the kernel gave us one. Never closed, as the
+   signal handler below may be using it at any time. */
+volatile sig_atomic_t create_pidfd = -1;
+
+/* Send signal to the runtime process, through its pidfd when we have one so we
+   cannot hit a recycled pid. Async-signal-safe. */
+static int kill_create_process(int signal)
+{
+#if defined(__linux__) && defined(SYS_pidfd_send_signal)
+	if (create_pidfd >= 0) {
+		if (syscall(SYS_pidfd_send_signal, create_pidfd, signal, NULL, 0) == 0)
+			return 0;
+		if (errno != ENOSYS)
+			return -1;
+	}
+#endif
+	return kill(create_pid, signal);
+}
 
 void on_sig_exit(int signal)
 {
@@ -26,7 +55,7 @@ void on_sig_exit(int signal)
 		if (kill(container_pid, signal) == 0)
 			return;
 	} else if (create_pid > 0) {
-		if (kill(create_pid, signal) == 0)
+		if (kill_create_process(signal) == 0)
 			return;
 		if (errno == ESRCH) {
 			/* The create_pid process might have exited, so try container_pid again.  */
@@ -79,6 +108,7 @@ static void check_child_processes(GHashTable *pid_to_handler, GHashTable *cache)
 			return;
 
 		/* If we got here, pid > 0, so we have a valid pid to check.  */
+		CONMON_PROBE2(child_reaped, pid, status);
 		void (*cb)(GPid, int, gpointer) = g_hash_table_lookup(pid_to_handler, &pid);
 		if (cb) {
 			cb(pid, status, 0);
@@ -175,6 +205,121 @@ void container_exit_cb(G_GNUC_UNUSED GPid pid, int status, G_GNUC_UNUSED gpointe
 	g_main_loop_quit(main_loop);
 }
 
+/* Kill the container with SIGKILL: through cgroup.kill if enabled and usable,
+   otherwise by killing its process group. From the main loop, wait is FALSE
+   and the cgroup is left to empty in the background, see cgroup_kill_async(). */
+void kill_container(gboolean wait)
+{
+#ifdef __linux__
+	if (opt_cgroup_kill && (wait ? cgroup_kill_and_wait() : cgroup_kill_async()) == 0)
+		return;
+#endif
+
+	pid_t process_group = getpgid(container_pid);
+	/* if process_group is 1, we will end up calling
+	 *  kill(-1), which kills everything conmon is allowed to. */
+	if (process_group > 1)
+		kill(-process_group, SIGKILL);
+	else
+		kill(container_pid, SIGKILL);
+}
+
+/* A stop requested through the control fifo, see stop_container(). */
+static struct {
+	gboolean requested;
+	int signal;
+	int grace;
+	gboolean escalated;
+	gint64 start;
+} stop_request;
+
+static gboolean stop_grace_expired_cb(G_GNUC_UNUSED gpointer user_data)
+{
+	if (container_pid > 0) {
+		ninfof("Container did not stop within %d seconds of signal %d, killing it", stop_request.grace, stop_request.signal);
+		stop_request.escalated = TRUE;
+		kill_container(FALSE);
+	}
+	return G_SOURCE_REMOVE;
+}
+
+/*
+ * Stop the container: send it signal, and kill it (see kill_container()) if it
+ * is still running grace seconds later. The outcome is written out by
+ * report_stop_outcome() once the container has exited. Only the first request
+ * counts; later ones are ignored.
+ */
+void stop_container(int signal, int grace)
+{
+	if (container_pid <= 0) {
+		nwarn("Stop requested, but there is no container process");
+		return;
+	}
+	if (stop_request.requested) {
+		ndebugf("Stop requested, but the container is already being stopped");
+		return;
+	}
+
+	stop_request.requested = TRUE;
+	stop_request.signal = signal;
+	stop_request.grace = grace;
+	stop_request.start = g_get_monotonic_time();
+	ninfof("Stopping container with signal %d and a grace period of %d seconds", signal, grace);
+
+	if (signal == SIGKILL) {
+		kill_container(FALSE);
+		return;
+	}
+	if (kill(container_pid, signal) < 0)
+		nwarnf("Failed to send signal %d to the container: %m", signal);
+	if (grace == 0) {
+		stop_grace_expired_cb(NULL);
+		return;
+	}
+	g_timeout_add_seconds(grace, stop_grace_expired_cb, NULL);
+}
+
+/*
+ * Write how a stop request went to the "stop" file in the persist directory.
+ * Returns it as a JSON object for the control socket to reply with, or NULL if
+ * no stop was requested.
+ */
+char *report_stop_outcome()
+{
+	if (!stop_request.requested)
+		return NULL;
+
+	gint64 duration_ms = (g_get_monotonic_time() - stop_request.start) / 1000;
+	ninfof("Container stopped %s after %" G_GINT64_FORMAT "ms", stop_request.escalated ? "by SIGKILL" : "by itself", duration_ms);
+
+	char *outcome = g_strdup_printf("{\"signal\": %d, \"grace\": %d, \"escalated\": %s, \"duration_ms\": %" G_GINT64_FORMAT "}",
+					stop_request.signal, stop_request.grace, stop_request.escalated ? "true" : "false", duration_ms);
+	if (opt_persist_path == NULL)
+		return outcome;
+
+	_cleanup_free_ char *path = g_build_filename(opt_persist_path, "stop", NULL);
+	_cleanup_free_ char *line = g_strdup_printf("%s\n", outcome);
+	if (replace_file(path, line, strlen(line)) < 0)
+		nwarnf("Failed to write %s: %m", path);
+	return outcome;
+}
+
+/* Runs in a child that may share our memory, see spawn.h. */
+static int exit_command_child(void *data)
+{
+	gchar **args = data;
+
+	if (opt_exit_delay)
+		sleep(opt_exit_delay);
+
+	reset_oom_adjust_async_safe();
+
+	execv(opt_exit_command, args);
+
+	/* Should not happen, but better be safe. */
+	return EXIT_FAILURE;
+}
+
 void do_exit_command()
 {
 	if (signal(SIGCHLD, SIG_DFL) == SIG_ERR) {
@@ -196,33 +341,6 @@ void do_exit_command()
 		nwarn("Failed to disable self subreaper attribute - might wait for indirect children a long time");
 	}
 
-	pid_t exit_pid = fork();
-	if (exit_pid < 0) {
-		_pexit("Failed to fork");
-	}
-
-	if (exit_pid) {
-		int ret, exit_status = 0;
-
-		/*
-		 * Make sure to cleanup any zombie process that the container runtime
-		 * could have left around.
-		 */
-		do {
-			int tmp;
-
-			exit_status = 0;
-			ret = waitpid(-1, &tmp, 0);
-			if (ret == exit_pid)
-				exit_status = get_exit_status(tmp);
-		} while ((ret < 0 && errno == EINTR) || ret > 0);
-
-		if (exit_status)
-			_exit(exit_status);
-
-		return;
-	}
-
 	/* Count the additional args, if any.  */
 	size_t n_args = 0;
 	if (opt_exit_args)
@@ -237,17 +355,131 @@ void do_exit_command()
 			args[n_args + 1] = opt_exit_args[n_args];
 	args[n_args + 1] = NULL;
 
-	if (opt_exit_delay) {
+	if (opt_exit_delay)
 		ndebugf("Sleeping for %d seconds before executing exit command", opt_exit_delay);
-		sleep(opt_exit_delay);
+
+	/* We only wait for the exit command below, so it is fine to be suspended until it runs. */
+	pid_t exit_pid = spawn_child(exit_command_child, args, TRUE, NULL);
+	if (exit_pid < 0) {
+		_pexit("Failed to fork");
 	}
+	g_free(args);
 
-	reset_oom_adjust();
+	int ret, exit_status = 0;
 
-	execv(opt_exit_command, args);
+	/*
+	 * Make sure to cleanup any zombie process that the container runtime
+	 * could have left around.
+	 */
+	do {
+		int tmp;
 
-	/* Should not happen, but better be safe. */
-	_exit(EXIT_FAILURE);
+		exit_status = 0;
+		ret = waitpid(-1, &tmp, 0);
+		if (ret == exit_pid)
+			exit_status = get_exit_status(tmp);
+	} while ((ret < 0 && errno == EINTR) || ret > 0);
+
+	if (exit_status)
+		_exit(exit_status);
+}
+
+static gboolean set_exit_file_error(GError **err, const char *what, const char *path)
+{
+	int saved_errno = errno;
+	g_set_error(err, G_FILE_ERROR, g_file_error_from_errno(saved_errno), "Failed to %s %s: %s", what, path, g_strerror(saved_errno));
+	errno = saved_errno;
+	return FALSE;
+}
+
+/* Like g_file_set_contents(), minus the fsync(). */
+static gboolean write_exit_file_nosync(const char *path, const char *contents, GError **err)
+{
+	if (replace_file(path, contents, strlen(contents)) < 0)
+		return set_exit_file_error(err, "write", path);
+	return TRUE;
+}
+
+/* Write the contents to an unnamed file and only link it into place once it is
+   complete, so readers never see a partial file and no temporary name shows up
+   in the directory. */
+static gboolean write_exit_file_tmpfile(const char *path, const char *contents, GError **err)
+{
+#ifdef O_TMPFILE
+	_cleanup_free_ char *dir = g_path_get_dirname(path);
+	_cleanup_close_ int fd = open(dir, O_TMPFILE | O_WRONLY | O_CLOEXEC, 0666);
+	if (fd < 0) {
+		/* Not supported by the kernel or the file system. */
+		if (errno == EOPNOTSUPP || errno == EISDIR || errno == EINVAL)
+			return write_exit_file_nosync(path, contents, err);
+		return set_exit_file_error(err, "create a file in", dir);
+	}
+
+	if (write_all(fd, contents, strlen(contents)) < 0)
+		return set_exit_file_error(err, "write", path);
+
+	char proc_path[64];
+	snprintf(proc_path, sizeof(proc_path), "/proc/self/fd/%d", fd);
+	if (linkat(AT_FDCWD, proc_path, AT_FDCWD, path, AT_SYMLINK_FOLLOW) == 0)
+		return TRUE;
+	if (errno != EEXIST)
+		return set_exit_file_error(err, "link", path);
+
+	/* linkat() does not replace an existing file, which can only be left over
+	   from an earlier run of the container. */
+	if (unlink(path) < 0 && errno != ENOENT)
+		return set_exit_file_error(err, "remove", path);
+	if (linkat(AT_FDCWD, proc_path, AT_FDCWD, path, AT_SYMLINK_FOLLOW) < 0)
+		return set_exit_file_error(err, "link", path);
+	return TRUE;
+#else
+	return write_exit_file_nosync(path, contents, err);
+#endif
+}
+
+/*
+ * Write an exit file according to --exit-durability. The default goes through
+ * g_file_set_contents(), which fsyncs the file before renaming it into place.
+ * When many containers stop at once those fsyncs serialize on the file system
+ * journal, so callers that can live with losing the file on a host crash may
+ * skip them.
+ */
+gboolean write_exit_file(const char *path, const char *contents, GError **err)
+{
+	if (opt_exit_durability == NULL || g_str_equal(opt_exit_durability, "fsync"))
+		return g_file_set_contents(path, contents, -1, err);
+	if (g_str_equal(opt_exit_durability, "tmpfile"))
+		return write_exit_file_tmpfile(path, contents, err);
+	return write_exit_file_nosync(path, contents, err);
+}
+
+/*
+ * Send a "<cid> <exit status>\n" datagram to --exit-notify-socket, if set. A
+ * single node-level listener can collect the exits of all containers this way,
+ * receiving them in batches, instead of watching the exit directory. This is
+ * best effort: the exit files remain the authoritative record.
+ */
+void notify_exit_socket(int exit_status)
+{
+	if (opt_exit_notify_socket == NULL)
+		return;
+
+	struct sockaddr_un addr = {.sun_family = AF_UNIX};
+	if (strlen(opt_exit_notify_socket) >= sizeof(addr.sun_path)) {
+		nwarnf("Exit notify socket path %s is too long", opt_exit_notify_socket);
+		return;
+	}
+	strcpy(addr.sun_path, opt_exit_notify_socket);
+
+	_cleanup_close_ int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		nwarn("Failed to create exit notify socket");
+		return;
+	}
+
+	_cleanup_free_ char *record = g_strdup_printf("%s %d\n", opt_cid, exit_status);
+	if (sendto(fd, record, strlen(record), MSG_DONTWAIT | MSG_NOSIGNAL, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+		nwarnf("Failed to send exit record to %s: %s", opt_exit_notify_socket, strerror(errno));
 }
 
 void reap_children()
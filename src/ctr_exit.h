@@ -8,6 +8,7 @@
 
 extern volatile sig_atomic_t container_pid;
 extern volatile sig_atomic_t create_pid;
+extern volatile sig_atomic_t create_pidfd;
 
 struct pid_check_data {
 	GHashTable *pid_to_handler;
@@ -23,7 +24,12 @@ gboolean timeout_cb(G_GNUC_UNUSED gpointer user_data);
 int get_exit_status(int status);
 void runtime_exit_cb(G_GNUC_UNUSED GPid pid, int status, G_GNUC_UNUSED gpointer user_data);
 void container_exit_cb(G_GNUC_UNUSED GPid pid, int status, G_GNUC_UNUSED gpointer user_data);
+void kill_container(gboolean wait);
+void stop_container(int signal, int grace);
+char *report_stop_outcome();
 void do_exit_command();
+gboolean write_exit_file(const char *path, const char *contents, GError **err);
+void notify_exit_socket(int exit_status);
 void reap_children();
 void cleanup_socket_dir_symlink();
 void handle_signal(G_GNUC_UNUSED const int signum);
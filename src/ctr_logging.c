@@ -2,7 +2,17 @@
 #include "ctr_logging.h"
 #include "cli.h"
 #include "config.h"
+#include "counters.h"
+#include "live_stats.h"
+#include "log_dedup.h"
+#include "log_driver.h"
+#include "log_format.h"
+#include "log_index.h"
+#include "follow_sock.h"
+#include "probes.h"
+#include "rate_limit.h"
 #include <ctype.h>
+#include <inttypes.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <limits.h>
@@ -22,29 +32,83 @@ static inline int sd_journal_sendv(G_GNUC_UNUSED const struct iovec *iov, G_GNUC
 
 #endif
 
-/* strlen("1997-03-25T13:20:42.999999999+01:00 stdout ") + 1 */
-#define TSBUFLEN 44
-
 /* Different types of container logging */
 static gboolean use_journald_logging = FALSE;
 static gboolean use_k8s_logging = FALSE;
+static gboolean use_json_logging = FALSE;
 static gboolean use_logging_passthrough = FALSE;
 
+/* Set through the control socket; container output is discarded rather than logged while set. */
+static gboolean log_capture_paused = FALSE;
+
+/* Output dropped over the log rate limit since the last summary line, by pipe. */
+static struct {
+	uint64_t bytes;
+	uint64_t lines;
+} suppressed[STDERR_PIPE + 1];
+
+/* Whether the last output logged, by pipe, ended before its line did. */
+static bool line_open[STDERR_PIPE + 1];
+
+/* With --log-dedup, the line compared with and the pending timeout for the summary of repeats, by pipe. */
+static log_dedup_t dedup[STDERR_PIPE + 1];
+static guint dedup_timeout[STDERR_PIPE + 1];
+
+/* With --log-max-line-size, the pending timeout for writing out the start of a line held by the k8s-file log, by pipe. */
+static guint partial_timeout[STDERR_PIPE + 1];
+
 /* Value the user must input for each log driver */
 static const char *const K8S_FILE_STRING = "k8s-file";
 static const char *const JOURNALD_FILE_STRING = "journald";
+static const char *const JSON_FILE_STRING = "json-file";
 
-/* Max log size for any log file types */
-static int64_t log_size_max = -1;
-
-/* Max total log size for any log file types */
-static int64_t log_global_size_max = -1;
+static void reopen_k8s_file(void);
+static void reopen_json_file(void);
+static int write_k8s_driver(log_driver_t *driver, stdpipe_t pipe, const log_line_t *lines, size_t n_lines, const struct timespec *ts);
+static int flush_k8s_driver(log_driver_t *driver, stdpipe_t pipe, const struct timespec *ts);
+static int write_json_driver(log_driver_t *driver, stdpipe_t pipe, const log_line_t *lines, size_t n_lines, const struct timespec *ts);
+static void sync_log_file(log_driver_t *driver);
+static void close_log_file(log_driver_t *driver);
+static int write_journald_driver(log_driver_t *driver, stdpipe_t pipe, const log_line_t *lines, size_t n_lines,
+				 const struct timespec *ts);
+static int flush_journald_driver(log_driver_t *driver, stdpipe_t pipe, const struct timespec *ts);
 
-/* k8s log file parameters */
-static int k8s_log_fd = -1;
-static char *k8s_log_path = NULL;
-static int64_t k8s_bytes_written;
-static int64_t k8s_total_bytes_written;
+/*
+ * A log file, of the k8s-file or the json-file driver, along with the max log
+ * sizes and its rotation.
+ *
+ * Rotation renames files and checks paths, which can take a while, so it
+ * is done in a helper thread while the main loop goes on. Output keeps
+ * going to the old fd, which ends up in the rotated-out file, until the
+ * main loop switches to the new fd once the thread is done. Only
+ * rotation.done is shared with the thread while it runs.
+ */
+typedef struct {
+	log_driver_t driver; /* first, so that the driver callbacks get back to the file */
+	k8s_log_t log;
+	char *path;
+	struct {
+		GThread *thread;
+		int old_fd;
+		int new_fd;
+		gint done;
+	} rotation;
+} log_file_t;
+
+static log_file_t k8s_file = {
+	.driver = {.name = "k8s-file", .write = write_k8s_driver, .flush = flush_k8s_driver, .sync = sync_log_file, .close = close_log_file},
+	.log = {.fd = -1, .size_max = -1, .global_size_max = -1, .reopen = reopen_k8s_file},
+	.rotation = {NULL, -1, -1, FALSE},
+};
+
+/* With --log-index */
+static log_index_t k8s_index = {.fd = -1};
+
+static log_file_t json_file = {
+	.driver = {.name = "json-file", .write = write_json_driver, .sync = sync_log_file, .close = close_log_file},
+	.log = {.fd = -1, .size_max = -1, .global_size_max = -1, .reopen = reopen_json_file},
+	.rotation = {NULL, -1, -1, FALSE},
+};
 
 /* journald log file parameters */
 // short ID length
@@ -77,24 +141,21 @@ static size_t container_tag_len;
 static char *syslog_identifier = NULL;
 static size_t syslog_identifier_len;
 
-#define WRITEV_BUFFER_N_IOV 128
-
-typedef struct {
-	int iovcnt;
-	struct iovec iov[WRITEV_BUFFER_N_IOV];
-} writev_buffer_t;
+/* Partial lines are held here until they end, or no longer fit. */
+static struct {
+	log_driver_t driver;
+	char partial_buf[STDERR_PIPE + 1][STDIO_BUF_SIZE];
+	size_t partial_buf_len[STDERR_PIPE + 1];
+} journald = {
+	.driver = {.name = "journald", .write = write_journald_driver, .flush = flush_journald_driver},
+};
 
 static void parse_log_path(char *log_config);
-static const char *stdpipe_name(stdpipe_t pipe);
-static int write_journald(int pipe, char *buf, ssize_t num_read);
-static int write_k8s_log(stdpipe_t pipe, const char *buf, ssize_t buflen);
-static bool get_line_len(ptrdiff_t *line_len, const char *buf, ssize_t buflen);
-static ssize_t writev_buffer_append_segment(int fd, writev_buffer_t *buf, const void *data, ssize_t len);
-static ssize_t writev_buffer_append_segment_no_flush(writev_buffer_t *buf, const void *data, ssize_t len);
-static ssize_t writev_buffer_flush(int fd, writev_buffer_t *buf);
-static void set_k8s_timestamp(char *buf, ssize_t buflen, const char *pipename);
-static void reopen_k8s_file(void);
-static int parse_priority_prefix(const char *buf, ssize_t buflen, int *priority, const char **message_start);
+static bool write_to_log_drivers(stdpipe_t pipe, char *buf, ssize_t num_read);
+static void write_suppressed_summary(stdpipe_t pipe);
+static bool write_deduplicated(stdpipe_t pipe, char *buf, ssize_t num_read);
+static gboolean rotate_log_file(log_file_t *file);
+static gboolean rotation_done_cb(gpointer user_data);
 
 
 gboolean logging_is_passthrough(void)
@@ -136,44 +197,66 @@ static int is_valid_label_name(const char *str)
 	return 1;
 }
 
+/* Open the log file of a file driver, appending to what it already holds, and register the driver. */
+static void open_log_file(log_file_t *file)
+{
+	file->log.fd = open(file->path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0640);
+	if (file->log.fd < 0)
+		pexit("Failed to open log file");
+
+	struct stat statbuf;
+	if (fstat(file->log.fd, &statbuf) == 0) {
+		file->log.bytes_written = statbuf.st_size;
+	} else {
+		nwarnf("Could not stat log file %s, assuming 0 size", file->path);
+		file->log.bytes_written = 0;
+	}
+	file->log.total_bytes_written = file->log.bytes_written;
+	if (file->log.index != NULL && open_log_index(file->log.index, file->path, FALSE) < 0)
+		nexit("Failed to open log index");
+	register_log_driver(&file->driver);
+}
+
 /*
  * configures container log specific information, such as the drivers the user
  * called with and the max log size for log file types. For the log file types
- * (currently just k8s log file), it will also open the log_fd for that specific
+ * (k8s-file and json-file), it will also open the log_fd for that specific
  * log file.
  */
 void configure_log_drivers(gchar **log_drivers, int64_t log_size_max_, int64_t log_global_size_max_, char *cuuid_, char *name_, char *tag,
 			   gchar **log_labels)
 {
-	log_size_max = log_size_max_;
-	log_global_size_max = log_global_size_max_;
+	k8s_file.log.size_max = json_file.log.size_max = log_size_max_;
+	k8s_file.log.global_size_max = json_file.log.global_size_max = log_global_size_max_;
+	k8s_file.log.max_line_size = opt_log_max_line_size;
 	if (log_drivers == NULL)
 		nexit("Log driver not provided. Use --log-path");
 	for (int driver = 0; log_drivers[driver]; ++driver) {
 		parse_log_path(log_drivers[driver]);
 	}
-	if (use_k8s_logging) {
-		/* Open the log path file. */
-		k8s_log_fd = open(k8s_log_path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0640);
-		if (k8s_log_fd < 0)
-			pexit("Failed to open log file");
-
-		struct stat statbuf;
-		if (fstat(k8s_log_fd, &statbuf) == 0) {
-			k8s_bytes_written = statbuf.st_size;
-		} else {
-			nwarnf("Could not stat log file %s, assuming 0 size", k8s_log_path);
-			k8s_bytes_written = 0;
+	if (opt_log_index != NULL) {
+		if (!use_k8s_logging)
+			nexit("--log-index requires a k8s-file log");
+		configure_log_index(&k8s_index, opt_log_index);
+		k8s_file.log.index = &k8s_index;
+	}
+	if (opt_follow_socket && !use_k8s_logging)
+		nexit("--follow-socket requires a k8s-file log");
+	if (use_k8s_logging)
+		open_log_file(&k8s_file);
+	if (use_json_logging)
+		open_log_file(&json_file);
+	if (opt_follow_socket) {
+		configure_follow_log(k8s_file.log.fd, k8s_file.log.bytes_written);
+		k8s_file.log.written = follow_log_written;
+	}
+	if ((use_k8s_logging || use_json_logging) && !use_journald_logging) {
+		const char *file_driver = use_k8s_logging ? K8S_FILE_STRING : JSON_FILE_STRING;
+		if (tag) {
+			nexitf("%s doesn't support --log-tag", file_driver);
 		}
-		k8s_total_bytes_written = k8s_bytes_written;
-
-		if (!use_journald_logging) {
-			if (tag) {
-				nexit("k8s-file doesn't support --log-tag");
-			}
-			if (log_labels) {
-				nexit("k8s-file doesn't support --log-label");
-			}
+		if (log_labels) {
+			nexitf("%s doesn't support --log-label", file_driver);
 		}
 	}
 
@@ -234,6 +317,7 @@ void configure_log_drivers(gchar **log_drivers, int64_t log_size_max_, int64_t l
 				}
 			}
 		}
+		register_log_driver(&journald.driver);
 	}
 }
 
@@ -277,484 +361,346 @@ static void parse_log_path(char *log_config)
 		return;
 	}
 
+	if (!strcmp(driver, JSON_FILE_STRING)) {
+		if (path == NULL) {
+			nexitf("json-file requires a filename");
+		}
+		use_json_logging = TRUE;
+		json_file.path = path;
+		return;
+	}
+
 	// Driver is k8s-file or empty
 	if (!strcmp(driver, K8S_FILE_STRING)) {
 		if (path == NULL) {
 			nexitf("k8s-file requires a filename");
 		}
 		use_k8s_logging = TRUE;
-		k8s_log_path = path;
+		k8s_file.path = path;
 		return;
 	}
 
 	// If no : was found, use the entire log-path as a filename to k8s-file.
 	if (path == NULL && delim == NULL) {
 		use_k8s_logging = TRUE;
-		k8s_log_path = driver;
+		k8s_file.path = driver;
 		return;
 	}
 
 	nexitf("No such log driver %s", driver);
 }
 
-/* write container output to all logs the user defined */
-bool write_to_logs(stdpipe_t pipe, char *buf, ssize_t num_read)
+static uint64_t count_lines(const char *buf, ssize_t len)
 {
-	if (use_k8s_logging && write_k8s_log(pipe, buf, num_read) < 0) {
-		nwarn("write_k8s_log failed");
-		return G_SOURCE_CONTINUE;
-	}
-	if (use_journald_logging && write_journald(pipe, buf, num_read) < 0) {
-		nwarn("write_journald failed");
-		return G_SOURCE_CONTINUE;
+	const char *end = buf + len;
+	uint64_t lines = 0;
+
+	while ((buf = memchr(buf, '\n', end - buf)) != NULL) {
+		lines++;
+		buf++;
 	}
-	return true;
+	return lines;
 }
 
-
-/*
- * parse_priority_prefix checks if the buffer starts with a systemd priority prefix
- * in the format <N> where N is a digit 0-7. If found, it extracts the priority
- * and returns a pointer to the message content after the prefix.
- *
- * Returns:
- *  1 if priority prefix was found and parsed
- *  0 if no valid priority prefix was found
- * -1 on error (invalid parameters)
- */
-static int parse_priority_prefix(const char *buf, ssize_t buflen, int *priority, const char **message_start)
+/* write container output to all logs the user defined */
+bool write_to_logs(stdpipe_t pipe, char *buf, ssize_t num_read)
 {
-	if (!buf || !priority || !message_start) {
-		return -1;
-	}
-
-	/* Need at least 3 characters for <N> pattern */
-	if (buflen < 3) {
-		return 0;
-	}
-
-	/* Check for minimum pattern: <N> where N is 0-7 */
-	if (buf[0] != '<') {
-		return 0;
+	struct timespec start, end;
+	uint64_t lines = count_lines(buf, num_read);
+	bool ret = true;
+
+	if (pipe == STDOUT_PIPE) {
+		counters.stdout_bytes += num_read;
+		counters.stdout_lines += lines;
+	} else if (pipe == STDERR_PIPE) {
+		counters.stderr_bytes += num_read;
+		counters.stderr_lines += lines;
 	}
 
-	/* Check if second character is a valid priority digit (0-7) */
-	if (buf[1] < '0' || buf[1] > '7') {
-		return 0;
-	}
-
-	/* Check for closing bracket */
-	if (buf[2] != '>') {
-		return 0;
+	if (log_capture_paused && num_read > 0) {
+		counters.log_paused_bytes += num_read;
+	} else if (num_read > 0 && !log_rate_limit_admit(num_read, lines)) {
+		suppressed[pipe].bytes += num_read;
+		suppressed[pipe].lines += lines;
+		counters.log_suppressed_bytes += num_read;
+		counters.log_suppressed_lines += lines;
+	} else {
+		if (suppressed[pipe].bytes > 0)
+			write_suppressed_summary(pipe);
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		ret = opt_log_dedup ? write_deduplicated(pipe, buf, num_read) : write_to_log_drivers(pipe, buf, num_read);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		if (num_read > 0)
+			line_open[pipe] = buf[num_read - 1] != '\n';
+		counters.last_write_latency_ns = (end.tv_sec - start.tv_sec) * 1000000000LL + end.tv_nsec - start.tv_nsec;
 	}
 
-	/* Extract the priority */
-	*priority = buf[1] - '0';
-	*message_start = buf + 3;
-
-	return 1;
+	publish_live_stats();
+	return ret;
 }
 
-/* write to systemd journal. If the pipe is stdout, write with notice priority,
- * otherwise, write with error priority. Partial lines (that don't end in a newline) are buffered
- * between invocations. A 0 buflen argument forces a buffered partial line to be flushed.
- */
-static int write_journald(int pipe, char *buf, ssize_t buflen)
+/* A driver that fails is warned about and counted, and the output is still read. */
+static bool write_to_log_drivers(stdpipe_t pipe, char *buf, ssize_t num_read)
 {
-	static char stdout_partial_buf[STDIO_BUF_SIZE];
-	static size_t stdout_partial_buf_len = 0;
-	static char stderr_partial_buf[STDIO_BUF_SIZE];
-	static size_t stderr_partial_buf_len = 0;
-
-	char *partial_buf;
-	size_t *partial_buf_len;
-
-	/* Default priority values: 6 (info) for stdout, 3 (err) for stderr
-	 * These may be overridden by systemd priority prefixes in the message.
-	 */
-	int default_priority = (pipe == STDERR_PIPE) ? 3 : 6;
-	char priority_str[PRIORITY_EQ_LEN + 2]; /* "PRIORITY=" + digit + null terminator */
-
-	if (pipe == STDERR_PIPE) {
-		partial_buf = stderr_partial_buf;
-		partial_buf_len = &stderr_partial_buf_len;
-	} else {
-		partial_buf = stdout_partial_buf;
-		partial_buf_len = &stdout_partial_buf_len;
-	}
-
-	ptrdiff_t line_len = 0;
-
-	while (buflen > 0 || *partial_buf_len > 0) {
-		writev_buffer_t bufv = {0};
-
-		bool partial = buflen == 0 || get_line_len(&line_len, buf, buflen);
-
-		/* If this is a partial line, and we have capacity to buffer it, buffer it and return.
-		 * The capacity of the partial_buf is one less than its size so that we can always add
-		 * a null terminating char later */
-		if (buflen && partial && ((unsigned long)line_len < (STDIO_BUF_SIZE - *partial_buf_len))) {
-			memcpy(partial_buf + *partial_buf_len, buf, line_len);
-			*partial_buf_len += line_len;
-			return 0;
-		}
-
-		/* Check for systemd priority prefix in the message */
-		int parsed_priority = default_priority;
-		const char *actual_message_start = NULL;
-		ssize_t actual_message_len = line_len;
-
-		/* Try to parse priority prefix from the complete message */
-		if (*partial_buf_len == 0 && line_len > 0) {
-			/* Only check for priority prefix at the start of a new line */
-			int parse_result = parse_priority_prefix(buf, line_len, &parsed_priority, &actual_message_start);
-			if (parse_result == 1) {
-				/* Priority prefix found, adjust message content */
-				actual_message_len = line_len - (actual_message_start - buf);
-			} else {
-				/* No priority prefix, use full message */
-				actual_message_start = buf;
-			}
-		} else {
-			/* Use full message when dealing with partial buffers */
-			actual_message_start = buf;
-		}
-
-		ssize_t msg_len = actual_message_len + MESSAGE_EQ_LEN + *partial_buf_len;
-
-		_cleanup_free_ char *message = g_malloc(msg_len);
-
-		memcpy(message, "MESSAGE=", MESSAGE_EQ_LEN);
-		memcpy(message + MESSAGE_EQ_LEN, partial_buf, *partial_buf_len);
-		memcpy(message + MESSAGE_EQ_LEN + *partial_buf_len, actual_message_start, actual_message_len);
-
-		/* Format the priority string */
-		snprintf(priority_str, sizeof(priority_str), "PRIORITY=%d", parsed_priority);
-
-		if (writev_buffer_append_segment_no_flush(&bufv, message, msg_len) < 0)
-			return -1;
-
-		if (writev_buffer_append_segment_no_flush(&bufv, container_id_full, cuuid_len + CID_FULL_EQ_LEN) < 0)
-			return -1;
-
-		if (writev_buffer_append_segment_no_flush(&bufv, priority_str, strlen(priority_str)) < 0)
-			return -1;
-
-		if (writev_buffer_append_segment_no_flush(&bufv, container_id, TRUNC_ID_LEN + CID_EQ_LEN) < 0)
-			return -1;
-
-		if (container_tag && writev_buffer_append_segment_no_flush(&bufv, container_tag, container_tag_len) < 0)
-			return -1;
-
-		/* only print the name if we have a name to print */
-		if (name && writev_buffer_append_segment_no_flush(&bufv, container_name, name_len + NAME_EQ_LEN) < 0)
-			return -1;
-
-		if (writev_buffer_append_segment_no_flush(&bufv, syslog_identifier, syslog_identifier_len) < 0)
-			return -1;
+	counters.log_write_errors += write_log_drivers(pipe, buf, num_read);
+	return true;
+}
 
-		/* per docker journald logging format, CONTAINER_PARTIAL_MESSAGE is set to true if it's partial, but otherwise not set. */
-		if (partial && !opt_no_container_partial_message
-		    && writev_buffer_append_segment_no_flush(&bufv, "CONTAINER_PARTIAL_MESSAGE=true", PARTIAL_MESSAGE_EQ_LEN) < 0)
-			return -1;
-		if (container_labels) {
-			for (gchar **label = container_labels; *label; ++label) {
-				if (writev_buffer_append_segment_no_flush(&bufv, *label, strlen(*label)) < 0)
-					return -1;
-			}
-		}
+static gboolean partial_timeout_cb(gpointer user_data)
+{
+	stdpipe_t pipe = GPOINTER_TO_INT(user_data);
+	struct timespec ts = {0};
 
-		int err = sd_journal_sendv(bufv.iov, bufv.iovcnt);
-		if (err < 0) {
-			nwarnf("sd_journal_sendv: %s", strerror(-err));
-			return err;
-		}
+	partial_timeout[pipe] = 0;
+	if (clock_gettime(CLOCK_REALTIME, &ts) < 0)
+		nwarnf("Failed to get the time for the log: %m");
+	if (flush_k8s_log(&k8s_file.log, pipe, &ts) < 0)
+		counters.log_write_errors++;
+	return G_SOURCE_REMOVE;
+}
 
-		buf += line_len;
-		buflen -= line_len;
-		*partial_buf_len = 0;
+static int write_k8s_driver(log_driver_t *driver, stdpipe_t pipe, const log_line_t *lines, size_t n_lines, const struct timespec *ts)
+{
+	k8s_log_t *log = &((log_file_t *)driver)->log;
+	int ret = write_k8s_lines(log, pipe, lines, n_lines, ts);
+
+	/* The start of a line held back is written after a while at the latest, not to hold up a prompt or a progress line */
+	if (log->partial[pipe].len > 0 && partial_timeout[pipe] == 0) {
+		partial_timeout[pipe] = g_timeout_add(LOG_PARTIAL_FLUSH_TIMEOUT_MS, partial_timeout_cb, GINT_TO_POINTER(pipe));
+	} else if (log->partial[pipe].len == 0 && partial_timeout[pipe] != 0) {
+		g_source_remove(partial_timeout[pipe]);
+		partial_timeout[pipe] = 0;
 	}
-	return 0;
+	return ret;
 }
 
-/*
- * The CRI requires us to write logs with a (timestamp, stream, line) format
- * for every newline-separated line. write_k8s_log writes said format for every
- * line in buf, and will partially write the final line of the log if buf is
- * not terminated by a newline.
- */
-static int write_k8s_log(stdpipe_t pipe, const char *buf, ssize_t buflen)
+static int flush_k8s_driver(log_driver_t *driver, stdpipe_t pipe, const struct timespec *ts)
 {
-	writev_buffer_t bufv = {0};
-	int64_t bytes_to_be_written = 0;
+	return flush_k8s_log(&((log_file_t *)driver)->log, pipe, ts);
+}
 
-	/*
-	 * Use the same timestamp for every line of the log in this buffer.
-	 * There is no practical difference in the output since write(2) is
-	 * fast.
-	 */
-	char tsbuf[TSBUFLEN];
-	set_k8s_timestamp(tsbuf, sizeof tsbuf, stdpipe_name(pipe));
+static int write_json_driver(log_driver_t *driver, stdpipe_t pipe, const log_line_t *lines, size_t n_lines, const struct timespec *ts)
+{
+	char timebuf[JSON_TIMEBUFLEN];
 
-	ptrdiff_t line_len = 0;
-	while (buflen > 0) {
-		bool partial = get_line_len(&line_len, buf, buflen);
+	format_json_timestamp(timebuf, sizeof timebuf, ts);
+	return write_json_lines(&((log_file_t *)driver)->log, pipe, lines, n_lines, timebuf);
+}
 
-		/* This is line_len bytes + TSBUFLEN - 1 + 2 (- 1 is for ignoring \0). */
-		bytes_to_be_written = line_len + TSBUFLEN + 1;
+static void sync_log_file(log_driver_t *driver)
+{
+	log_file_t *file = (log_file_t *)driver;
 
-		/* If partial, then we add a \n */
-		if (partial) {
-			bytes_to_be_written += 1;
-		}
+	if (file->log.fd > 0)
+		if (fsync(file->log.fd) < 0)
+			nwarnf("Failed to sync log file before exit: %m");
+}
 
-		/* If the caller specified a global max, enforce it before writing */
-		if (log_global_size_max > 0 && k8s_total_bytes_written >= log_global_size_max)
-			break;
+static void close_log_file(log_driver_t *driver)
+{
+	log_file_t *file = (log_file_t *)driver;
 
-		/*
-		 * We re-open the log file if writing out the bytes will exceed the max
-		 * log size. We also reset the state so that the new file is started with
-		 * a timestamp.
-		 */
-		if ((log_size_max > 0) && (k8s_bytes_written + bytes_to_be_written) > log_size_max) {
-			if (writev_buffer_flush(k8s_log_fd, &bufv) < 0) {
-				nwarn("failed to flush buffer to log");
-			}
-			reopen_k8s_file();
-		}
+	if (file->log.fd >= 0)
+		close(file->log.fd);
+	file->log.fd = -1;
+	if (file->log.index != NULL)
+		close_log_index(file->log.index);
+}
 
-		/* Output the timestamp */
-		if (writev_buffer_append_segment(k8s_log_fd, &bufv, tsbuf, TSBUFLEN - 1) < 0) {
-			nwarn("failed to write (timestamp, stream) to log");
-			goto next;
-		}
+static gboolean dedup_timeout_cb(gpointer user_data)
+{
+	stdpipe_t pipe = GPOINTER_TO_INT(user_data);
 
-		/* Output log tag for partial or newline */
-		if (partial) {
-			if (writev_buffer_append_segment(k8s_log_fd, &bufv, "P ", 2) < 0) {
-				nwarn("failed to write partial log tag");
-				goto next;
-			}
-		} else {
-			if (writev_buffer_append_segment(k8s_log_fd, &bufv, "F ", 2) < 0) {
-				nwarn("failed to write end log tag");
-				goto next;
-			}
-		}
+	dedup_timeout[pipe] = 0;
+	log_dedup_flush(&dedup[pipe], pipe, write_to_log_drivers);
+	return G_SOURCE_REMOVE;
+}
 
-		/* Output the actual contents. */
-		if (writev_buffer_append_segment(k8s_log_fd, &bufv, buf, line_len) < 0) {
-			nwarn("failed to write buffer to log");
-			goto next;
-		}
+/* Leave out repeated lines, with a summary once the run is over or at the latest after --log-dedup-timeout. */
+static bool write_deduplicated(stdpipe_t pipe, char *buf, ssize_t num_read)
+{
+	/* Flushing the drivers' buffers at exit */
+	if (num_read == 0) {
+		log_dedup_flush(&dedup[pipe], pipe, write_to_log_drivers);
+		return write_to_log_drivers(pipe, buf, 0);
+	}
 
-		/* Output a newline for partial */
-		if (partial) {
-			if (writev_buffer_append_segment(k8s_log_fd, &bufv, "\n", 1) < 0) {
-				nwarn("failed to write newline to log");
-				goto next;
-			}
-		}
+	uint64_t collapsed = dedup[pipe].collapsed;
+	bool ret = log_dedup_filter(&dedup[pipe], pipe, buf, num_read, write_to_log_drivers);
+	counters.log_collapsed_lines += dedup[pipe].collapsed - collapsed;
 
-		k8s_bytes_written += bytes_to_be_written;
-		k8s_total_bytes_written += bytes_to_be_written;
-	next:
-		/* Update the head of the buffer remaining to output. */
-		buf += line_len;
-		buflen -= line_len;
-	}
+	if (dedup[pipe].repeats > 0 && dedup_timeout[pipe] == 0)
+		dedup_timeout[pipe] = g_timeout_add_seconds(opt_log_dedup_timeout, dedup_timeout_cb, GINT_TO_POINTER(pipe));
+	return ret;
+}
 
-	if (writev_buffer_flush(k8s_log_fd, &bufv) < 0) {
-		nwarn("failed to flush buffer to log");
+/* Log one line in place of the output dropped over the rate limit. */
+static void write_suppressed_summary(stdpipe_t pipe)
+{
+	char buf[128];
+	int len = snprintf(buf, sizeof(buf), "conmon: suppressed %" PRIu64 " lines (%" PRIu64 " bytes) over the log rate limit\n",
+			   suppressed[pipe].lines, suppressed[pipe].bytes);
+
+	suppressed[pipe].bytes = 0;
+	suppressed[pipe].lines = 0;
+	/* The dropped output may have cut a line short; end it, so the summary is not joined onto it. */
+	if (line_open[pipe]) {
+		write_to_log_drivers(pipe, "\n", 1);
+		line_open[pipe] = false;
 	}
+	write_to_log_drivers(pipe, buf, len);
+}
 
-	return 0;
+void pause_log_capture(gboolean paused)
+{
+	if (paused != log_capture_paused)
+		ninfof("%s log capture", paused ? "Pausing" : "Resuming");
+	log_capture_paused = paused;
 }
 
-/* Find the end of the line, or alternatively the end of the buffer.
- * Returns false in the former case (it's a whole line) or true in the latter (it's a partial)
- */
-static bool get_line_len(ptrdiff_t *line_len, const char *buf, ssize_t buflen)
+gboolean log_capture_is_paused(void)
 {
-	bool partial = FALSE;
-	const char *line_end = memchr(buf, '\n', buflen);
-	if (line_end == NULL) {
-		line_end = &buf[buflen - 1];
-		partial = TRUE;
-	}
-	*line_len = line_end - buf + 1;
-	return partial;
+	return log_capture_paused;
 }
 
 
-static ssize_t writev_buffer_flush(int fd, writev_buffer_t *buf)
+/* Send one message to the systemd journal: the held start of the line, then buf. If the pipe is stdout, write with
+ * info priority, otherwise, write with error priority, unless the line starts with a priority prefix.
+ */
+static int send_journald(stdpipe_t pipe, const char *held, size_t held_len, const char *buf, ssize_t line_len, bool partial)
 {
-	ssize_t count = 0;
-	int iovcnt = buf->iovcnt;
-	struct iovec *iov = buf->iov;
-
-	/*
-	 * By definition, flushing the buffers will either be entirely successful, or will fail at some point
-	 * along the way.  There is no facility to attempt to retry a writev() system call outside of an EINTR
-	 * errno.  Therefore, no matter the outcome, always reset the writev_buffer_t data structure.
+	writev_buffer_t bufv = {0};
+
+	/* Default priority values: 6 (info) for stdout, 3 (err) for stderr
+	 * These may be overridden by systemd priority prefixes in the message.
 	 */
-	buf->iovcnt = 0;
-
-	while (iovcnt > 0) {
-		ssize_t res;
-		do {
-			res = writev(fd, iov, iovcnt);
-		} while (res == -1 && errno == EINTR);
-
-		if (res <= 0) {
-			/*
-			 * Any unflushed data is lost (this would be a good place to add a counter for how many times
-			 * this occurs and another count for how much data is lost).
-			 *
-			 * Note that if writev() returns a 0, this logic considers it an error.
-			 */
-			return -1;
-		}
+	int parsed_priority = (pipe == STDERR_PIPE) ? 3 : 6;
+	char priority_str[PRIORITY_EQ_LEN + 2]; /* "PRIORITY=" + digit + null terminator */
+	const char *actual_message_start = buf;
+	ssize_t actual_message_len = line_len;
 
-		count += res;
-
-		while (res > 0) {
-			size_t iov_len = iov->iov_len;
-			size_t from_this = MIN((size_t)res, iov_len);
-			res -= from_this;
-			iov_len -= from_this;
-
-			if (iov_len == 0) {
-				iov++;
-				iovcnt--;
-				/* continue, res still > 0 */
-			} else {
-				iov->iov_len = iov_len;
-				iov->iov_base += from_this;
-				/* break, res is 0 */
-			}
-		}
+	/* Only check for priority prefix at the start of a new line */
+	if (held_len == 0 && line_len > 0 && parse_priority_prefix(buf, line_len, &parsed_priority, &actual_message_start) == 1) {
+		/* Priority prefix found, adjust message content */
+		actual_message_len = line_len - (actual_message_start - buf);
+	} else {
+		actual_message_start = buf;
 	}
 
-	return count;
-}
+	ssize_t msg_len = actual_message_len + MESSAGE_EQ_LEN + held_len;
 
+	_cleanup_free_ char *message = g_malloc(msg_len);
 
-ssize_t writev_buffer_append_segment(int fd, writev_buffer_t *buf, const void *data, ssize_t len)
-{
-	if (data == NULL)
-		return 1;
+	memcpy(message, "MESSAGE=", MESSAGE_EQ_LEN);
+	memcpy(message + MESSAGE_EQ_LEN, held, held_len);
+	memcpy(message + MESSAGE_EQ_LEN + held_len, actual_message_start, actual_message_len);
 
-	if (buf->iovcnt == WRITEV_BUFFER_N_IOV && writev_buffer_flush(fd, buf) < 0)
+	/* Format the priority string */
+	snprintf(priority_str, sizeof(priority_str), "PRIORITY=%d", parsed_priority);
+
+	if (writev_buffer_append_segment_no_flush(&bufv, message, msg_len) < 0)
 		return -1;
 
-	if (len > 0) {
-		buf->iov[buf->iovcnt].iov_base = (void *)data;
-		buf->iov[buf->iovcnt].iov_len = (size_t)len;
-		buf->iovcnt++;
-	}
+	if (writev_buffer_append_segment_no_flush(&bufv, container_id_full, cuuid_len + CID_FULL_EQ_LEN) < 0)
+		return -1;
 
-	return 1;
-}
+	if (writev_buffer_append_segment_no_flush(&bufv, priority_str, strlen(priority_str)) < 0)
+		return -1;
 
-ssize_t writev_buffer_append_segment_no_flush(writev_buffer_t *buf, const void *data, ssize_t len)
-{
-	if (data == NULL)
-		return 1;
+	if (writev_buffer_append_segment_no_flush(&bufv, container_id, TRUNC_ID_LEN + CID_EQ_LEN) < 0)
+		return -1;
 
-	if (buf->iovcnt == WRITEV_BUFFER_N_IOV)
+	if (container_tag && writev_buffer_append_segment_no_flush(&bufv, container_tag, container_tag_len) < 0)
 		return -1;
 
-	if (len > 0) {
-		buf->iov[buf->iovcnt].iov_base = (void *)data;
-		buf->iov[buf->iovcnt].iov_len = (size_t)len;
-		buf->iovcnt++;
-	}
+	/* only print the name if we have a name to print */
+	if (name && writev_buffer_append_segment_no_flush(&bufv, container_name, name_len + NAME_EQ_LEN) < 0)
+		return -1;
 
-	return 1;
-}
+	if (writev_buffer_append_segment_no_flush(&bufv, syslog_identifier, syslog_identifier_len) < 0)
+		return -1;
 
+	/* per docker journald logging format, CONTAINER_PARTIAL_MESSAGE is set to true if it's partial, but otherwise not set. */
+	if (partial && !opt_no_container_partial_message
+	    && writev_buffer_append_segment_no_flush(&bufv, "CONTAINER_PARTIAL_MESSAGE=true", PARTIAL_MESSAGE_EQ_LEN) < 0)
+		return -1;
+	if (container_labels) {
+		for (gchar **label = container_labels; *label; ++label) {
+			if (writev_buffer_append_segment_no_flush(&bufv, *label, strlen(*label)) < 0)
+				return -1;
+		}
+	}
 
-static const char *stdpipe_name(stdpipe_t pipe)
-{
-	switch (pipe) {
-	case STDIN_PIPE:
-		return "stdin";
-	case STDOUT_PIPE:
-		return "stdout";
-	case STDERR_PIPE:
-		return "stderr";
-	default:
-		return "NONE";
+	int err = sd_journal_sendv(bufv.iov, bufv.iovcnt);
+	CONMON_PROBE3(journald_send, pipe, msg_len, err);
+	if (err < 0) {
+		nwarnf("sd_journal_sendv: %s", strerror(-err));
+		return err;
 	}
+	return 0;
 }
 
-/* Generate timestamp string to buf. */
-static void set_k8s_timestamp(char *buf, ssize_t buflen, const char *pipename)
+/* Partial lines (that don't end in a newline) are buffered between invocations, as long as they fit. */
+static int write_journald_driver(G_GNUC_UNUSED log_driver_t *driver, stdpipe_t pipe, const log_line_t *lines, size_t n_lines,
+				 G_GNUC_UNUSED const struct timespec *ts)
 {
-	static int tzset_called = 0;
+	char *partial_buf = journald.partial_buf[pipe];
+	size_t *partial_buf_len = &journald.partial_buf_len[pipe];
 
-	/* Initialize timestamp variables with sensible defaults. */
-	struct timespec ts = {0};
-	struct tm current_tm = {0};
-	char off_sign = '+';
-	int off = 0;
-
-	/* Attempt to get the current time. */
-	if (clock_gettime(CLOCK_REALTIME, &ts) < 0) {
-		if (errno != EINVAL) {
-			ts.tv_nsec = 0; /* If other errors, fallback to nanoseconds = 0. */
-		}
-	}
+	for (size_t i = 0; i < n_lines; i++) {
+		const log_line_t *line = &lines[i];
 
-	/* Ensure tzset is called only once. */
-	if (!tzset_called) {
-		tzset();
-		tzset_called = 1;
-	}
+		/* If this is a partial line, and we have capacity to buffer it, buffer it */
+		if (line->partial && ((size_t)line->len < (STDIO_BUF_SIZE - *partial_buf_len))) {
+			memcpy(partial_buf + *partial_buf_len, line->buf, line->len);
+			*partial_buf_len += line->len;
+			continue;
+		}
 
-	/* Get the local time or fallback to defaults. */
-	if (localtime_r(&ts.tv_sec, &current_tm) == NULL) {
-		current_tm.tm_year = 70; /* 1970 (default epoch year) */
-		current_tm.tm_mon = 0;	 /* January */
-		current_tm.tm_mday = 1;	 /* 1st day of the month */
-		current_tm.tm_hour = 0;	 /* midnight */
-		current_tm.tm_min = 0;
-		current_tm.tm_sec = 0;
-		current_tm.tm_gmtoff = 0; /* UTC offset */
+		int err = send_journald(pipe, partial_buf, *partial_buf_len, line->buf, line->len, line->partial);
+		if (err < 0)
+			return err;
+		*partial_buf_len = 0;
 	}
+	return 0;
+}
 
-	/* Calculate timezone offset. */
-	off = (int)current_tm.tm_gmtoff;
-	if (off < 0) {
-		off_sign = '-';
-		off = -off;
-	}
+/* Send a buffered partial line as it is. */
+static int flush_journald_driver(G_GNUC_UNUSED log_driver_t *driver, stdpipe_t pipe, G_GNUC_UNUSED const struct timespec *ts)
+{
+	size_t *partial_buf_len = &journald.partial_buf_len[pipe];
 
-	/* Format the timestamp into the buffer. */
-	int len = snprintf(buf, buflen, "%d-%02d-%02dT%02d:%02d:%02d.%09ld%c%02d:%02d %s ", current_tm.tm_year + 1900,
-			   current_tm.tm_mon + 1, current_tm.tm_mday, current_tm.tm_hour, current_tm.tm_min, current_tm.tm_sec, ts.tv_nsec,
-			   off_sign, off / 3600, (off % 3600) / 60, pipename);
+	if (*partial_buf_len == 0)
+		return 0;
 
-	/* Ensure null termination if snprintf output exceeds buffer length. */
-	if (len >= buflen && buflen > 0) {
-		buf[buflen - 1] = '\0';
-	}
+	int err = send_journald(pipe, journald.partial_buf[pipe], *partial_buf_len, "", 0, true);
+	*partial_buf_len = 0;
+	return err;
 }
 
 /* Force closing any open FD. */
 void close_logging_fds(void)
 {
-	if (k8s_log_fd >= 0)
-		close(k8s_log_fd);
-	k8s_log_fd = -1;
+	close_log_drivers();
 }
 
 /* reopen all log files */
 void reopen_log_files(void)
 {
 	reopen_k8s_file();
+	reopen_json_file();
+}
+
+/* start rotating the log files now, regardless of their size and of --log-rotate */
+gboolean rotate_log_files(void)
+{
+	gboolean rotated = FALSE;
+
+	if (use_k8s_logging)
+		rotated = rotate_log_file(&k8s_file);
+	if (use_json_logging)
+		rotated = rotate_log_file(&json_file) || rotated;
+	return rotated;
 }
 
 /* Atomic symlink validation using file descriptors to prevent race conditions */
@@ -1018,8 +964,21 @@ cleanup:
 }
 
 
-/* shift backup log files for rotation */
-static gboolean shift_backup_files(void)
+/* Move the time index of the log at from along with it, if the log has one. */
+static gboolean rename_log_index(const char *from, const char *to)
+{
+	_cleanup_free_ char *from_index = g_strdup_printf("%s%s", from, LOG_INDEX_SUFFIX);
+	_cleanup_free_ char *to_index = g_strdup_printf("%s%s", to, LOG_INDEX_SUFFIX);
+
+	if (rename(from_index, to_index) != 0 && errno != ENOENT) {
+		nwarnf("Failed to move log index %s to %s: %m", from_index, to_index);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/* shift backup log files for rotation, with their time indexes if with_index */
+static gboolean shift_backup_files(const char *log_path, gboolean with_index)
 {
 	gboolean had_errors = FALSE;
 
@@ -1030,7 +989,7 @@ static gboolean shift_backup_files(void)
 	}
 
 	/* Validate log path using secure validation */
-	int validation_fd = secure_validate_log_path(k8s_log_path);
+	int validation_fd = secure_validate_log_path(log_path);
 	if (validation_fd < 0) {
 		nwarnf("Invalid log path for rotation");
 		return FALSE;
@@ -1041,8 +1000,8 @@ static gboolean shift_backup_files(void)
 	int loop_start = (opt_log_max_files > 1) ? opt_log_max_files : 2;
 
 	for (int i = loop_start; i >= 2; i--) {
-		_cleanup_free_ char *from = g_strdup_printf("%s.%d", k8s_log_path, i - 1);
-		_cleanup_free_ char *to = g_strdup_printf("%s.%d", k8s_log_path, i);
+		_cleanup_free_ char *from = g_strdup_printf("%s.%d", log_path, i - 1);
+		_cleanup_free_ char *to = g_strdup_printf("%s.%d", log_path, i);
 
 		/* Verify string allocation succeeded */
 		if (!from || !to) {
@@ -1055,6 +1014,8 @@ static gboolean shift_backup_files(void)
 			nwarnf("Failed to shift backup file %s to %s: %m", from, to);
 			had_errors = TRUE;
 		}
+		if (with_index && !rename_log_index(from, to))
+			had_errors = TRUE;
 	}
 
 	/* Report success but warn if there were non-critical errors */
@@ -1067,25 +1028,29 @@ static gboolean shift_backup_files(void)
 
 
 /* Helper function to perform the actual file rotation */
-static gboolean perform_file_rotation(const char *temp_path, const char *backup_path)
+static gboolean perform_file_rotation(const char *log_path, const char *temp_path, const char *backup_path, gboolean with_index)
 {
 	/* Rename current log to .1 */
-	if (rename(k8s_log_path, backup_path) < 0) {
+	if (rename(log_path, backup_path) < 0) {
 		nwarnf("Failed to rotate log file: %m");
 		return FALSE;
 	}
 
 	/* Move new file into place atomically */
-	if (rename(temp_path, k8s_log_path) < 0) {
+	if (rename(temp_path, log_path) < 0) {
 		nwarnf("Failed to move new log file into place: %m");
 		/* Try to restore the original file */
-		if (rename(backup_path, k8s_log_path) < 0) {
+		if (rename(backup_path, log_path) < 0) {
 			nwarnf("CRITICAL: Failed to restore original log file: %m");
 			nwarnf("Original log data may be in backup file");
 		}
 		return FALSE;
 	}
 
+	/* The index is still written to through its old fd, as the log is, until the main loop switches to new ones. */
+	if (with_index)
+		rename_log_index(log_path, backup_path);
+
 	return TRUE;
 }
 
@@ -1105,12 +1070,11 @@ static void cleanup_temp_file(int fd, const char *temp_path)
 }
 
 /* Validate rotation preconditions and acquire file lock */
-static int validate_and_lock_rotation(int *parent_fd)
+static int validate_and_lock_rotation(const char *log_path, int old_fd, int *parent_fd)
 {
-	int old_fd = k8s_log_fd;
 	struct flock lock_info = {.l_type = F_WRLCK, .l_whence = SEEK_SET, .l_start = 0, .l_len = 0};
 
-	*parent_fd = secure_validate_log_path(k8s_log_path);
+	*parent_fd = secure_validate_log_path(log_path);
 	if (*parent_fd < 0) {
 		nwarnf("Cannot rotate: invalid log path");
 		return -1;
@@ -1130,7 +1094,7 @@ static int validate_and_lock_rotation(int *parent_fd)
 		return -1;
 	}
 
-	if (!validate_fd_path_security(old_fd, k8s_log_path)) {
+	if (!validate_fd_path_security(old_fd, log_path)) {
 		nwarnf("File descriptor security validation failed");
 		return -1;
 	}
@@ -1139,12 +1103,12 @@ static int validate_and_lock_rotation(int *parent_fd)
 }
 
 /* Setup rotation file paths and create new log file */
-static int setup_rotation_files(int parent_fd, char **temp_path, char **backup_path)
+static int setup_rotation_files(const char *log_path, int parent_fd, char **temp_path, char **backup_path)
 {
-	_cleanup_free_ char *basename = g_path_get_basename(k8s_log_path);
+	_cleanup_free_ char *basename = g_path_get_basename(log_path);
 	_cleanup_free_ char *temp_basename = NULL;
 
-	if (!basename || !(*temp_path = g_strdup_printf("%s.new", k8s_log_path)) || !(*backup_path = g_strdup_printf("%s.1", k8s_log_path))
+	if (!basename || !(*temp_path = g_strdup_printf("%s.new", log_path)) || !(*backup_path = g_strdup_printf("%s.1", log_path))
 	    || !(temp_basename = g_strdup_printf("%s.new", basename))) {
 		nwarnf("Memory allocation failed for rotation paths");
 		return -1;
@@ -1157,79 +1121,182 @@ static int setup_rotation_files(int parent_fd, char **temp_path, char **backup_p
 	return new_fd;
 }
 
-/* Simplified thread-safe rotation with file locking */
-static void rotate_k8s_file(void)
+/*
+ * Rotate the file at log_path, behind old_fd, out of the way and create a new
+ * one in its place, with file locking. Returns the new fd, or -1 if the
+ * rotation failed. This runs in the rotation thread; it must not touch the
+ * log's fd.
+ */
+static int rotate_file_from(const char *log_path, int old_fd, gboolean with_index)
 {
 	int parent_fd = -1;
 	_cleanup_free_ char *temp_path = NULL;
 	_cleanup_free_ char *backup_path = NULL;
 	struct flock unlock = {.l_type = F_UNLCK, .l_whence = SEEK_SET, .l_start = 0, .l_len = 0};
+	int new_fd = -1;
 
-	int old_fd = validate_and_lock_rotation(&parent_fd);
-	if (old_fd < 0)
-		return;
-
-	int new_fd = setup_rotation_files(parent_fd, &temp_path, &backup_path);
-	if (new_fd < 0)
-		goto cleanup;
+	if (validate_and_lock_rotation(log_path, old_fd, &parent_fd) < 0)
+		goto out;
 
-	if (!shift_backup_files() || !perform_file_rotation(temp_path, backup_path)) {
+	new_fd = setup_rotation_files(log_path, parent_fd, &temp_path, &backup_path);
+	if (new_fd >= 0
+	    && (!shift_backup_files(log_path, with_index) || !perform_file_rotation(log_path, temp_path, backup_path, with_index))) {
 		cleanup_temp_file(new_fd, temp_path);
-		goto cleanup;
+		new_fd = -1;
 	}
 
-	/* Atomic state update */
+out:
+	if (parent_fd >= 0)
+		close(parent_fd);
 	fcntl(old_fd, F_SETLK, &unlock);
+	return new_fd;
+}
+
+static gpointer rotation_thread(gpointer data)
+{
+	log_file_t *file = data;
+
+	file->rotation.new_fd = rotate_file_from(file->path, file->rotation.old_fd, file->log.index != NULL);
+	g_atomic_int_set(&file->rotation.done, TRUE);
+	/* Not at idle priority: a busy container must not keep us on the old file. */
+	g_idle_add_full(G_PRIORITY_DEFAULT, rotation_done_cb, file, NULL);
+	return NULL;
+}
+
+/* Switch to new_fd after a rotation; the old fd, the rotated-out file by now, got everything written up to here. */
+static void switch_rotated_file(log_file_t *file, int old_fd, int new_fd)
+{
+	/* Before the old fd is closed, a follow client may still have to open the old file through it */
+	if (file->log.written != NULL)
+		follow_log_reopened(new_fd);
 	close(old_fd);
+	file->log.fd = new_fd;
+	file->log.bytes_written = 0;
+	if (file->log.index != NULL)
+		open_log_index(file->log.index, file->path, TRUE);
+	counters.log_rotations++;
+	publish_live_stats();
+}
 
-	k8s_log_fd = new_fd;
-	k8s_bytes_written = 0;
-	close(parent_fd);
-	return;
+/* Wait for the rotation thread, and switch to the new file if it made one. */
+static void finish_file_rotation(log_file_t *file)
+{
+	if (file->rotation.thread == NULL)
+		return;
 
-cleanup:
-	if (parent_fd >= 0)
-		close(parent_fd);
-	unlock.l_type = F_UNLCK;
-	fcntl(old_fd, F_SETLK, &unlock);
+	g_thread_join(file->rotation.thread);
+	file->rotation.thread = NULL;
+	file->log.rotation_pending = false;
+	CONMON_PROBE2(log_rotate_done, file->rotation.old_fd, file->rotation.new_fd);
+	if (file->rotation.new_fd < 0)
+		return;
+	switch_rotated_file(file, file->rotation.old_fd, file->rotation.new_fd);
 }
 
-/* reopen the k8s log file fd.  */
-static void reopen_k8s_file(void)
+static gboolean rotation_done_cb(gpointer user_data)
 {
-	if (!use_k8s_logging)
+	log_file_t *file = user_data;
+
+	/* The rotation may have been finished already, by finish_log_rotation() */
+	if (file->rotation.thread != NULL && g_atomic_int_get(&file->rotation.done))
+		finish_file_rotation(file);
+	return G_SOURCE_REMOVE;
+}
+
+/*
+ * Start rotating a log file in the rotation thread. A rotation that is
+ * still running when another is asked for stands in for it.
+ */
+static gboolean rotate_log_file(log_file_t *file)
+{
+	GError *err = NULL;
+
+	if (file->rotation.thread != NULL)
+		return TRUE;
+	if (file->log.fd < 0) {
+		nwarnf("Cannot rotate: invalid file descriptor");
+		return FALSE;
+	}
+
+	file->rotation.old_fd = file->log.fd;
+	file->rotation.new_fd = -1;
+	CONMON_PROBE1(log_rotate_start, file->rotation.old_fd);
+	g_atomic_int_set(&file->rotation.done, FALSE);
+	file->rotation.thread = g_thread_try_new("log-rotation", rotation_thread, file, &err);
+	if (file->rotation.thread == NULL) {
+		nwarnf("Failed to start the log rotation thread, rotating in place: %s", err->message);
+		g_error_free(err);
+		int new_fd = rotate_file_from(file->path, file->rotation.old_fd, file->log.index != NULL);
+		CONMON_PROBE2(log_rotate_done, file->rotation.old_fd, new_fd);
+		if (new_fd < 0)
+			return FALSE;
+		switch_rotated_file(file, file->rotation.old_fd, new_fd);
+		return TRUE;
+	}
+	/* Until the switch, writes stay batched rather than asking for the rotation again for each record */
+	file->log.rotation_pending = true;
+	return TRUE;
+}
+
+void finish_log_rotation(void)
+{
+	finish_file_rotation(&k8s_file);
+	finish_file_rotation(&json_file);
+}
+
+/* reopen the fd of a log file, truncating it, or rotating it with --log-rotate. */
+static void reopen_log_file(log_file_t *file)
+{
+	if (file->path == NULL)
 		return;
 
 	if (opt_log_rotate) {
 		/* Use log rotation instead of truncation */
-		rotate_k8s_file();
+		rotate_log_file(file);
 	} else {
-		/* Original truncation behavior for backward compatibility */
-		_cleanup_free_ char *k8s_log_path_tmp = g_strdup_printf("%s.tmp", k8s_log_path);
+		/* A rotation asked for on the control socket may still be using the fd */
+		finish_file_rotation(file);
 
-		/* Close the current k8s_log_fd */
-		close(k8s_log_fd);
+		/* Original truncation behavior for backward compatibility */
+		_cleanup_free_ char *log_path_tmp = g_strdup_printf("%s.tmp", file->path);
 
 		/* Open with O_TRUNC: reset bytes written */
-		k8s_bytes_written = 0;
+		int old_fd = file->log.fd;
+		file->log.bytes_written = 0;
 
 		/* Open the log path file again */
-		k8s_log_fd = open(k8s_log_path_tmp, O_WRONLY | O_TRUNC | O_CREAT | O_CLOEXEC, 0640);
-		if (k8s_log_fd < 0)
-			pexitf("Failed to open log file %s", k8s_log_path);
+		file->log.fd = open(log_path_tmp, O_WRONLY | O_TRUNC | O_CREAT | O_CLOEXEC, 0640);
+		if (file->log.fd < 0)
+			pexitf("Failed to open log file %s", file->path);
 
 		/* Replace the previous file */
-		if (rename(k8s_log_path_tmp, k8s_log_path) < 0) {
+		if (rename(log_path_tmp, file->path) < 0) {
 			pexit("Failed to rename log file");
 		}
+
+		/* Close the previous fd, once follow clients are done with it */
+		if (file->log.written != NULL)
+			follow_log_reopened(file->log.fd);
+		close(old_fd);
+
+		if (file->log.index != NULL)
+			open_log_index(file->log.index, file->path, TRUE);
 	}
 }
 
+static void reopen_k8s_file(void)
+{
+	reopen_log_file(&k8s_file);
+}
+
+static void reopen_json_file(void)
+{
+	reopen_log_file(&json_file);
+}
+
 
 void sync_logs(void)
 {
 	/* Sync the logs to disk */
-	if (k8s_log_fd > 0)
-		if (fsync(k8s_log_fd) < 0)
-			nwarnf("Failed to sync log file before exit: %m");
+	sync_log_drivers();
 }
@@ -6,10 +6,14 @@
 #include <stdbool.h> /* bool */
 
 void reopen_log_files(void);
+gboolean rotate_log_files(void);
+void finish_log_rotation(void);
 bool write_to_logs(stdpipe_t pipe, char *buf, ssize_t num_read);
 void configure_log_drivers(gchar **log_drivers, int64_t log_size_max_, int64_t log_global_size_max_, char *cuuid_, char *name_, char *tag,
 			   gchar **labels);
 void sync_logs(void);
+void pause_log_capture(gboolean paused);
+gboolean log_capture_is_paused(void);
 gboolean logging_is_passthrough(void);
 gboolean logging_is_journald_enabled(void);
 void close_logging_fds(void);
@@ -5,14 +5,19 @@
 #include "utils.h"
 #include "ctr_logging.h"
 #include "cli.h"
+#include "probes.h"
+#include "counters.h"
+#include "rate_limit.h"
 
 #include <stdbool.h>
 #include <sys/socket.h>
 
 static gboolean tty_hup_timeout_scheduled = false;
 static bool read_stdio(int fd, stdpipe_t pipe, gboolean *eof);
+static bool read_and_forward_stdio(int fd, stdpipe_t pipe, gboolean *eof, ssize_t *num_read_out);
 static void drain_log_buffers(stdpipe_t pipe);
 static gboolean tty_hup_timeout_cb(G_GNUC_UNUSED gpointer user_data);
+static gboolean rate_limit_timeout_cb(gpointer user_data);
 
 
 gboolean stdio_cb(int fd, GIOCondition condition, gpointer user_data)
@@ -81,6 +86,15 @@ gboolean stdio_cb(int fd, GIOCondition condition, gpointer user_data)
 		return G_SOURCE_REMOVE;
 	}
 
+	/* Over the log rate limit with --log-rate-limit-mode block, leave the
+	   output in the pipe until there is budget for it again. */
+	int64_t wait_ms = log_rate_limit_wait_ms();
+	if (wait_ms > 0) {
+		counters.log_rate_blocked++;
+		g_timeout_add(wait_ms, rate_limit_timeout_cb, user_data);
+		return G_SOURCE_REMOVE;
+	}
+
 	return G_SOURCE_CONTINUE;
 }
 
@@ -111,6 +125,16 @@ static void drain_log_buffers(stdpipe_t pipe)
 }
 
 static bool read_stdio(int fd, stdpipe_t pipe, gboolean *eof)
+{
+	ssize_t num_read = 0;
+
+	CONMON_PROBE2(stdio_read_entry, pipe, fd);
+	bool ret = read_and_forward_stdio(fd, pipe, eof, &num_read);
+	CONMON_PROBE3(stdio_read_return, pipe, fd, num_read);
+	return ret;
+}
+
+static bool read_and_forward_stdio(int fd, stdpipe_t pipe, gboolean *eof, ssize_t *num_read_out)
 {
 	/* We use two extra bytes. One at the start, which we don't read into, instead
 	   we use that for marking the pipe when we write to the attached socket.
@@ -124,6 +148,7 @@ static bool read_stdio(int fd, stdpipe_t pipe, gboolean *eof)
 		*eof = false;
 
 	num_read = read(fd, buf, STDIO_BUF_SIZE);
+	*num_read_out = num_read;
 	if (num_read == 0) {
 		if (eof)
 			*eof = true;
@@ -163,3 +188,12 @@ static gboolean tty_hup_timeout_cb(G_GNUC_UNUSED gpointer user_data)
 	g_unix_fd_add(mainfd_stdout, G_IO_IN, stdio_cb, GINT_TO_POINTER(STDOUT_PIPE));
 	return G_SOURCE_REMOVE;
 }
+
+static gboolean rate_limit_timeout_cb(gpointer user_data)
+{
+	int fd = GPOINTER_TO_INT(user_data) == STDOUT_PIPE ? mainfd_stdout : mainfd_stderr;
+
+	if (fd >= 0)
+		g_unix_fd_add(fd, G_IO_IN, stdio_cb, user_data);
+	return G_SOURCE_REMOVE;
+}
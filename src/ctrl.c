@@ -7,7 +7,11 @@
 #include "ctr_logging.h"
 #include "conn_sock.h"
 #include "cmsg.h"
-#include "cli.h" // opt_bundle_path
+#include "cli.h" // opt_bundle_path, opt_terminal
+#include "ctr_exit.h"
+#include "counters.h"
+
+#include <signal.h>
 
 #include <sys/ioctl.h>
 #include <sys/socket.h>
@@ -16,11 +20,20 @@
 #include <unistd.h>
 
 static void resize_winsz(int height, int width);
+static gboolean apply_pending_resize_cb(gpointer user_data);
 static gboolean read_from_ctrl_buffer(int fd, gboolean (*line_process_func)(char *));
 static gboolean process_terminal_ctrl_line(char *line);
 static gboolean process_winsz_ctrl_line(char *line);
 static void setup_fifo(int *fifo_r, int *fifo_w, char *filename, char *error_var_name);
 
+/*
+ * The last requested window size. It is applied from an idle callback, so a
+ * burst of resizes, as from dragging a terminal window, costs one ioctl.
+ */
+static int pending_height = -1;
+static int pending_width = -1;
+static guint pending_resize_source = 0;
+
 gboolean terminal_accept_cb(int fd, G_GNUC_UNUSED GIOCondition condition, G_GNUC_UNUSED gpointer user_data)
 {
 
@@ -79,7 +92,10 @@ exit:
 	/* now that we've set mainfd_stdout, we can register the ctrl_winsz_cb
 	 * if we didn't set it here, we'd risk attempting to run ioctl on
 	 * a negative fd, and fail to resize the window */
-	g_unix_fd_add(winsz_fd_r, G_IO_IN, ctrl_winsz_cb, NULL);
+	if (winsz_fd_r >= 0)
+		g_unix_fd_add(winsz_fd_r, G_IO_IN, ctrl_winsz_cb, NULL);
+	if (pending_height >= 0 && pending_resize_source == 0)
+		pending_resize_source = g_idle_add_full(G_PRIORITY_DEFAULT, apply_pending_resize_cb, NULL, NULL);
 
 	/* Clean up everything */
 	close(connfd);
@@ -98,9 +114,10 @@ gboolean ctrl_winsz_cb(int fd, G_GNUC_UNUSED GIOCondition condition, G_GNUC_UNUS
 }
 
 /*
- * process_winsz_ctrl_line processes a line passed to the winsz fd
- * after the terminal_ctrl fd receives a winsz event.
- * It reads a height and length, and resizes the pty with it.
+ * process_winsz_ctrl_line processes a line passed to the winsz fd.
+ * conmon applies resize events from the terminal_ctrl fd directly, the
+ * fifo is left for callers writing to it themselves.
+ * It reads a height and width, and requests a resize with it.
  */
 static gboolean process_winsz_ctrl_line(char *line)
 {
@@ -111,12 +128,7 @@ static gboolean process_winsz_ctrl_line(char *line)
 		nwarn("Failed to parse window size");
 		return FALSE;
 	}
-	if (height < 0 || width < 0 || height > 1000 || width > 1000) {
-		nwarnf("Invalid window size: %dx%d (must be between 0 and 1000)", height, width);
-		return FALSE;
-	}
-	resize_winsz(height, width);
-	return TRUE;
+	return request_resize(height, width);
 }
 
 /*
@@ -144,6 +156,16 @@ static gboolean process_terminal_ctrl_line(char *line)
 		nwarnf("Invalid control message format");
 		return FALSE;
 	}
+	if (ctl_msg_type == STOP_EVENT) {
+		/* "3 <signal> <grace period in seconds>" */
+		int signal = height, grace = width;
+		if (signal <= 0 || signal >= NSIG || grace < 0) {
+			nwarnf("Invalid stop request: signal %d, grace period %d", signal, grace);
+			return FALSE;
+		}
+		stop_container(signal, grace);
+		return TRUE;
+	}
 	if (ctl_msg_type != WIN_RESIZE_EVENT && ctl_msg_type != REOPEN_LOGS_EVENT) {
 		nwarnf("Invalid control message type: %d", ctl_msg_type);
 		return FALSE;
@@ -155,18 +177,10 @@ static gboolean process_terminal_ctrl_line(char *line)
 
 	ndebugf("Message type: %d", ctl_msg_type);
 	switch (ctl_msg_type) {
-	case WIN_RESIZE_EVENT: {
-		if (height < 0 || width < 0 || height > 1000 || width > 1000) {
-			nwarnf("Invalid window size: %dx%d (must be between 0 and 1000)", height, width);
-			return FALSE;
-		}
-		_cleanup_free_ char *hw_str = g_strdup_printf("%d %d\n", height, width);
-		if (write(winsz_fd_w, hw_str, strlen(hw_str)) < 0) {
-			nwarn("Failed to write to window resizing fd. A resize event may have been dropped");
+	case WIN_RESIZE_EVENT:
+		if (!request_resize(height, width))
 			return FALSE;
-		}
 		break;
-	}
 	case REOPEN_LOGS_EVENT:
 		reopen_log_files();
 		break;
@@ -177,6 +191,40 @@ static gboolean process_terminal_ctrl_line(char *line)
 	return TRUE;
 }
 
+static gboolean apply_pending_resize_cb(G_GNUC_UNUSED gpointer user_data)
+{
+	pending_resize_source = 0;
+	resize_winsz(pending_height, pending_width);
+	return G_SOURCE_REMOVE;
+}
+
+/*
+ * request_resize records a window resize, and has it applied once the main
+ * loop is idle, or once the console arrives. Only the last of the sizes
+ * requested in between is applied.
+ */
+gboolean request_resize(int height, int width)
+{
+	if (height < 0 || width < 0 || height > 1000 || width > 1000) {
+		nwarnf("Invalid window size: %dx%d (must be between 0 and 1000)", height, width);
+		return FALSE;
+	}
+	if (!opt_terminal) {
+		nwarn("Cannot resize, the container has no terminal");
+		return FALSE;
+	}
+
+	counters.resize_requests++;
+	pending_height = height;
+	pending_width = width;
+	/* mainfd_stdout is the console, once we have it. At default priority, as
+	   idle priority would starve while the container keeps stdout busy; the
+	   requests read before it runs still make a single ioctl. */
+	if (mainfd_stdout >= 0 && pending_resize_source == 0)
+		pending_resize_source = g_idle_add_full(G_PRIORITY_DEFAULT, apply_pending_resize_cb, NULL, NULL);
+	return TRUE;
+}
+
 /*
  * read_from_ctrl_buffer reads a line (of no more than CTLBUFSZ) from an fd,
  * and calls line_process_func. It is a generic way to handle input on an fd
@@ -244,6 +292,7 @@ static void resize_winsz(int height, int width)
 	ws.ws_row = height;
 	ws.ws_col = width;
 
+	counters.resize_applied++;
 	int ret = ioctl(mainfd_stdout, TIOCSWINSZ, &ws);
 	if (ret == -1)
 		nwarnf("Failed to set process pty terminal size: %m");
@@ -0,0 +1,502 @@
+#define _GNU_SOURCE
+
+#include "follow_sock.h"
+#include "config.h"
+#include "counters.h"
+#include "utils.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <glib-unix.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define ROTATE_EVENT "{\"event\": \"rotate\"}\n"
+
+/* At most this many queues worth of a log file are read for a client at a time, not to hold up the main loop. */
+#define FOLLOW_READS_PER_WAKEUP 4
+
+/* A log file a client that fell behind has yet to read, up to end, or the current one (-1). */
+struct follow_file {
+	int fd;
+	int64_t end;
+};
+
+struct follow_client {
+	int fd;
+	guint source;
+	GIOCondition watching;
+	gboolean started; /* the request was answered */
+	gboolean eof;	  /* the client sent all it will */
+	size_t req_len;
+	char req[CONTROL_LINE_MAX + 1];
+	/* What is to be sent, from queue_sent to queue_len. FOLLOW_QUEUE_SIZE bytes once started. */
+	char *queue;
+	size_t queue_len;
+	size_t queue_sent;
+	/* While behind, the records are read from files[0] at file_pos, and then from the files after it. */
+	struct follow_file files[FOLLOW_FILES_MAX];
+	int n_files;
+	int64_t file_pos;
+	gint64 last_sent; /* when the client last took anything, in monotonic time */
+};
+
+static int log_fd = -1;
+static int64_t log_offset = 0; /* bytes written to the current log file */
+static GPtrArray *clients = NULL;
+
+static gboolean follow_client_cb(int fd, GIOCondition condition, gpointer user_data);
+
+void configure_follow_log(int fd, int64_t offset)
+{
+	log_fd = fd;
+	log_offset = offset;
+}
+
+/* The log fd is write-only, so open the file behind it again, wherever it was renamed to since. */
+static int open_log_fd(int fd)
+{
+	char path[64];
+
+	snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+	int read_fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (read_fd < 0)
+		nwarnf("Failed to open the log for a follow client: %m");
+	return read_fd;
+}
+
+/*
+ * Watch the client for condition, besides G_IO_HUP and G_IO_ERR. This may
+ * remove the source being dispatched, whose callback has to leave it at that.
+ */
+static void watch_client(struct follow_client *client, GIOCondition condition)
+{
+	if (client->source != 0 && client->watching == condition)
+		return;
+	if (client->source != 0)
+		g_source_remove(client->source);
+	client->watching = condition;
+	client->source = g_unix_fd_add(client->fd, condition | G_IO_HUP | G_IO_ERR, follow_client_cb, client);
+}
+
+static void close_follow_client(struct follow_client *client)
+{
+	if (client->source != 0)
+		g_source_remove(client->source);
+	for (int i = 0; i < client->n_files; i++)
+		close(client->files[i].fd);
+	close(client->fd);
+	g_ptr_array_remove_fast(clients, client);
+	counters.follow_clients--;
+	g_free(client->queue);
+	g_free(client);
+}
+
+static gboolean has_pending(const struct follow_client *client)
+{
+	return client->queue_sent < client->queue_len || client->n_files > 0;
+}
+
+/* Make room for len more bytes in the queue, returns FALSE if it can't take them. */
+static gboolean make_room(struct follow_client *client, size_t len)
+{
+	if (client->queue_sent > 0 && client->queue_len + len > FOLLOW_QUEUE_SIZE) {
+		memmove(client->queue, client->queue + client->queue_sent, client->queue_len - client->queue_sent);
+		client->queue_len -= client->queue_sent;
+		client->queue_sent = 0;
+	}
+	return client->queue_len + len <= FOLLOW_QUEUE_SIZE;
+}
+
+/* Queue a line of our own, the reply or an event, if there is room for it. */
+static gboolean queue_line(struct follow_client *client, const char *line)
+{
+	size_t len = strlen(line);
+
+	if (!make_room(client, len))
+		return FALSE;
+	memcpy(client->queue + client->queue_len, line, len);
+	client->queue_len += len;
+	return TRUE;
+}
+
+/* Queue the records in iov but for the first skip bytes, if there is room for them. */
+static gboolean queue_records(struct follow_client *client, const struct iovec *iov, int iovcnt, size_t skip)
+{
+	size_t len = 0;
+
+	for (int i = 0; i < iovcnt; i++)
+		len += iov[i].iov_len;
+	if (!make_room(client, len - skip))
+		return FALSE;
+
+	for (int i = 0; i < iovcnt; i++) {
+		if (skip >= iov[i].iov_len) {
+			skip -= iov[i].iov_len;
+			continue;
+		}
+		memcpy(client->queue + client->queue_len, (const char *)iov[i].iov_base + skip, iov[i].iov_len - skip);
+		client->queue_len += iov[i].iov_len - skip;
+		skip = 0;
+	}
+	return TRUE;
+}
+
+/* Read the records from pos on out of the log file fd rather than the queue. */
+static gboolean fall_behind(struct follow_client *client, int fd, int64_t pos)
+{
+	int read_fd = open_log_fd(fd);
+
+	if (read_fd < 0)
+		return FALSE;
+	client->files[0] = (struct follow_file){read_fd, -1};
+	client->n_files = 1;
+	client->file_pos = pos;
+	return TRUE;
+}
+
+/*
+ * Queue the next records of a client that is behind, from the file it is
+ * on. Moves on to the next file once that one is done, or back to the queue
+ * once it has caught up with the current one. Returns FALSE on errors.
+ */
+static gboolean read_log_files(struct follow_client *client)
+{
+	struct follow_file *file = &client->files[0];
+	int64_t end = file->end >= 0 ? file->end : log_offset;
+
+	if (client->file_pos < end) {
+		ssize_t num_read;
+		do
+			num_read = pread(file->fd, client->queue, MIN((int64_t)FOLLOW_QUEUE_SIZE, end - client->file_pos), client->file_pos);
+		while (num_read < 0 && errno == EINTR);
+		if (num_read < 0) {
+			nwarnf("Failed to read the log for a follow client: %m");
+			return FALSE;
+		}
+		if (num_read > 0) {
+			client->queue_len = num_read;
+			client->file_pos += num_read;
+			return TRUE;
+		}
+		/* The file is shorter than what was written to it, after a failed write */
+	}
+
+	gboolean rotated = file->end >= 0;
+	close(file->fd);
+	client->n_files--;
+	memmove(client->files, client->files + 1, client->n_files * sizeof(struct follow_file));
+	client->file_pos = 0;
+	if (rotated)
+		queue_line(client, ROTATE_EVENT);
+	return TRUE;
+}
+
+/* Send the client what it is owed, until its socket is full. Returns FALSE if it was disconnected. */
+static gboolean send_pending(struct follow_client *client)
+{
+	int reads = 0;
+
+	for (;;) {
+		if (client->queue_sent < client->queue_len) {
+			ssize_t sent;
+			do
+				sent = send(client->fd, client->queue + client->queue_sent, client->queue_len - client->queue_sent,
+					    MSG_DONTWAIT | MSG_NOSIGNAL);
+			while (sent < 0 && errno == EINTR);
+			if (sent < 0 && errno == EAGAIN) {
+				watch_client(client, G_IO_OUT);
+				return TRUE;
+			}
+			if (sent < 0) {
+				ndebugf("Dropping follow client %d, failed to send: %m", client->fd);
+				close_follow_client(client);
+				return FALSE;
+			}
+			client->queue_sent += sent;
+			client->last_sent = g_get_monotonic_time();
+			if (client->queue_sent == client->queue_len)
+				client->queue_sent = client->queue_len = 0;
+			continue;
+		}
+
+		if (client->n_files == 0) {
+			watch_client(client, client->eof ? 0 : G_IO_IN);
+			return TRUE;
+		}
+		if (reads++ == FOLLOW_READS_PER_WAKEUP) {
+			watch_client(client, G_IO_OUT);
+			return TRUE;
+		}
+		if (!read_log_files(client)) {
+			close_follow_client(client);
+			return FALSE;
+		}
+	}
+}
+
+/* The offset of the first record at pos or after it in the current log file. */
+static int64_t next_record(int64_t pos)
+{
+	char buf[4096];
+
+	if (pos == 0)
+		return 0;
+	_cleanup_close_ int fd = open_log_fd(log_fd);
+	if (fd < 0)
+		return log_offset;
+
+	/* A record starts right after a newline */
+	for (pos--; pos < log_offset;) {
+		ssize_t num_read = pread(fd, buf, MIN((int64_t)sizeof(buf), log_offset - pos), pos);
+		if (num_read <= 0)
+			break;
+		char *newline = memchr(buf, '\n', num_read);
+		if (newline != NULL)
+			return pos + (newline - buf) + 1;
+		pos += num_read;
+	}
+	return log_offset;
+}
+
+/* Parse a request such as {"offset": 4096} and queue the reply. Returns NULL on success or the error to reply with. */
+static const char *start_client(struct follow_client *client, const char *line)
+{
+	int64_t value = 0, start = log_offset;
+	int offset_end = -1, backlog_end = -1, live_end = -1;
+
+	if (sscanf(line, " { \"offset\" : %" SCNd64 " } %n", &value, &offset_end) == 1 && offset_end >= 0 && line[offset_end] == '\0') {
+		if (value < 0 || value > log_offset)
+			return "offset is not in the log file";
+		start = value;
+	} else if (sscanf(line, " { \"backlog\" : %" SCNd64 " } %n", &value, &backlog_end) == 1 && backlog_end >= 0
+		   && line[backlog_end] == '\0') {
+		if (value < 0)
+			return "backlog must not be negative";
+		start = next_record(value < log_offset ? log_offset - value : 0);
+	} else if (sscanf(line, " { } %n", &live_end) != 0 || live_end < 0 || line[live_end] != '\0') {
+		return "request must be an object with an offset or a backlog";
+	}
+
+	if (start < log_offset && !fall_behind(client, log_fd, start))
+		return "failed to open the log";
+
+	_cleanup_free_ char *reply = g_strdup_printf("{\"ok\": true, \"offset\": %" PRId64 "}\n", start);
+	client->queue = g_malloc(FOLLOW_QUEUE_SIZE);
+	queue_line(client, reply);
+	client->started = TRUE;
+	client->last_sent = g_get_monotonic_time();
+	return NULL;
+}
+
+static void reject_client(struct follow_client *client, const char *error)
+{
+	/* errors are our own fixed strings, so they need no escaping */
+	_cleanup_free_ char *reply = g_strdup_printf("{\"ok\": false, \"error\": \"%s\"}\n", error);
+
+	if (send(client->fd, reply, strlen(reply), MSG_DONTWAIT | MSG_NOSIGNAL) < 0)
+		ndebugf("Failed to send follow client %d its error: %m", client->fd);
+	close_follow_client(client);
+}
+
+static gboolean read_request(struct follow_client *client)
+{
+	ssize_t num_read;
+
+	do
+		num_read = read(client->fd, client->req + client->req_len, CONTROL_LINE_MAX - client->req_len);
+	while (num_read < 0 && errno == EINTR);
+	if (num_read < 0 && errno == EAGAIN)
+		return TRUE;
+	if (num_read <= 0) {
+		close_follow_client(client);
+		return FALSE;
+	}
+	client->req_len += num_read;
+	client->req[client->req_len] = '\0';
+
+	char *newline = strchr(client->req, '\n');
+	if (newline == NULL) {
+		if (client->req_len < CONTROL_LINE_MAX)
+			return TRUE;
+		reject_client(client, "request too long");
+		return FALSE;
+	}
+	*newline = '\0';
+	const char *error = start_client(client, client->req);
+	if (error != NULL) {
+		reject_client(client, error);
+		return FALSE;
+	}
+	ndebugf("Follow client %d starts at %s", client->fd, client->req);
+	return send_pending(client);
+}
+
+static gboolean follow_client_cb(G_GNUC_UNUSED int fd, GIOCondition condition, gpointer user_data)
+{
+	struct follow_client *client = user_data;
+	char buf[256];
+
+	if (condition & G_IO_OUT)
+		return send_pending(client) ? G_SOURCE_CONTINUE : G_SOURCE_REMOVE;
+	if ((condition & G_IO_IN) == 0) {
+		close_follow_client(client);
+		return G_SOURCE_REMOVE;
+	}
+	if (!client->started)
+		return read_request(client) ? G_SOURCE_CONTINUE : G_SOURCE_REMOVE;
+
+	/* Anything after the request is ignored, up to the end of what the client sends. */
+	ssize_t num_read = read(client->fd, buf, sizeof(buf));
+	if (num_read == 0) {
+		client->eof = TRUE;
+		watch_client(client, 0);
+	} else if (num_read < 0 && errno != EAGAIN && errno != EINTR) {
+		close_follow_client(client);
+		return G_SOURCE_REMOVE;
+	}
+	return G_SOURCE_CONTINUE;
+}
+
+gboolean follow_accept_cb(int fd, G_GNUC_UNUSED GIOCondition condition, G_GNUC_UNUSED gpointer user_data)
+{
+	int client_fd = accept4(fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if (client_fd < 0) {
+		if (errno != EAGAIN && errno != EINTR && errno != ECONNABORTED)
+			nwarn("Failed to accept follow socket connection");
+		return G_SOURCE_CONTINUE;
+	}
+
+	struct follow_client *client = g_new0(struct follow_client, 1);
+	client->fd = client_fd;
+	if (clients == NULL)
+		clients = g_ptr_array_new();
+	g_ptr_array_add(clients, client);
+	counters.follow_clients++;
+	watch_client(client, G_IO_IN);
+	ndebugf("Accepted follow connection %d", client_fd);
+	return G_SOURCE_CONTINUE;
+}
+
+void follow_log_written(const struct iovec *iov, int iovcnt)
+{
+	size_t len = 0;
+
+	for (int i = 0; i < iovcnt; i++)
+		len += iov[i].iov_len;
+
+	/* Backwards, as closing a client moves the last one in its place */
+	for (guint i = clients != NULL ? clients->len : 0; i > 0; i--) {
+		struct follow_client *client = g_ptr_array_index(clients, i - 1);
+		ssize_t sent = 0;
+
+		/* Still to send its request, or reading the records from the log files */
+		if (!client->started || client->n_files > 0)
+			continue;
+
+		if (client->queue_sent == client->queue_len) {
+			struct msghdr msg = {.msg_iov = (struct iovec *)iov, .msg_iovlen = iovcnt};
+			do
+				sent = sendmsg(client->fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+			while (sent < 0 && errno == EINTR);
+			if (sent < 0 && errno != EAGAIN) {
+				ndebugf("Dropping follow client %d, failed to send: %m", client->fd);
+				close_follow_client(client);
+				continue;
+			}
+			if (sent < 0)
+				sent = 0;
+		}
+		if ((size_t)sent == len)
+			continue;
+
+		if (!queue_records(client, iov, iovcnt, sent)) {
+			/* Too far behind for the queue, the rest is read back from the log once it caught up with that */
+			counters.follow_lagged++;
+			if (!fall_behind(client, log_fd, log_offset + sent)) {
+				close_follow_client(client);
+				continue;
+			}
+		}
+		watch_client(client, G_IO_OUT);
+	}
+	log_offset += len;
+}
+
+void follow_log_reopened(int fd)
+{
+	for (guint i = clients != NULL ? clients->len : 0; i > 0; i--) {
+		struct follow_client *client = g_ptr_array_index(clients, i - 1);
+
+		if (!client->started)
+			continue;
+		if (client->n_files == 0 && queue_line(client, ROTATE_EVENT)) {
+			watch_client(client, G_IO_OUT);
+			continue;
+		}
+
+		/* Behind, or just falling behind as even the event does not fit: the file it reads ends here, the new one comes next. */
+		if (client->n_files == 0 && !fall_behind(client, log_fd, log_offset)) {
+			close_follow_client(client);
+			continue;
+		}
+		int read_fd = client->n_files < FOLLOW_FILES_MAX ? open_log_fd(fd) : -1;
+		if (read_fd < 0) {
+			nwarnf("Dropping follow client %d, %d log files behind", client->fd, client->n_files);
+			close_follow_client(client);
+			continue;
+		}
+		client->files[client->n_files - 1].end = log_offset;
+		client->files[client->n_files++] = (struct follow_file){read_fd, -1};
+		watch_client(client, G_IO_OUT);
+	}
+	log_fd = fd;
+	log_offset = 0;
+}
+
+void drain_follow_clients(int timeout_ms)
+{
+	gint64 deadline = g_get_monotonic_time() + timeout_ms * G_TIME_SPAN_MILLISECOND;
+
+	if (clients == NULL)
+		return;
+
+	for (;;) {
+		gint64 stalled = g_get_monotonic_time() - FOLLOW_DRAIN_STALL_MS * G_TIME_SPAN_MILLISECOND;
+		for (guint i = clients->len; i > 0; i--) {
+			struct follow_client *client = g_ptr_array_index(clients, i - 1);
+			if (!client->started)
+				close_follow_client(client);
+			else if (!send_pending(client))
+				continue;
+			else if (!has_pending(client))
+				close_follow_client(client);
+			else if (client->last_sent < stalled) {
+				/* Only clients that keep reading are waited for */
+				ndebugf("Dropping follow client %d at exit, it stopped reading", client->fd);
+				close_follow_client(client);
+			}
+		}
+
+		gint64 left = deadline - g_get_monotonic_time();
+		if (clients->len == 0 || left <= 0)
+			break;
+
+		_cleanup_free_ struct pollfd *fds = g_new(struct pollfd, clients->len);
+		for (guint i = 0; i < clients->len; i++)
+			fds[i] = (struct pollfd){.fd = ((struct follow_client *)g_ptr_array_index(clients, i))->fd, .events = POLLOUT};
+		int timeout = MIN(left / G_TIME_SPAN_MILLISECOND + 1, FOLLOW_DRAIN_STALL_MS);
+		if (poll(fds, clients->len, timeout) < 0 && errno != EINTR)
+			break;
+	}
+
+	while (clients->len > 0) {
+		struct follow_client *client = g_ptr_array_index(clients, clients->len - 1);
+		ndebugf("Dropping follow client %d at exit, with records left to send", client->fd);
+		close_follow_client(client);
+	}
+}
@@ -0,0 +1,48 @@
+#if !defined(FOLLOW_SOCK_H)
+#define FOLLOW_SOCK_H
+
+/*
+ * The follow socket, a SOCK_STREAM unix socket named "follow" next to the
+ * attach socket, streaming the k8s-file log as it is written.
+ *
+ * A subscriber sends a single line saying where to start in the current log
+ * file, and gets a single line in reply, as on the control socket:
+ *
+ *   {}                     from the end, only what is written from now on
+ *   {"offset": 4096}       from that byte offset, the start of a record
+ *   {"backlog": 65536}     from the first record in the last that many bytes
+ *
+ *   {"ok": true, "offset": 4096}
+ *
+ * The records follow, exactly as in the file. When the log moves to a new
+ * file, a {"event": "rotate"} line comes between the last record of the old
+ * file and the first one of the new file, whose offsets start from 0 again.
+ * Records start with a timestamp, so these lines can't be mistaken for one.
+ *
+ * Each subscriber has a queue of FOLLOW_QUEUE_SIZE bytes. One that falls
+ * behind is sent the records from the log files instead, which it keeps open
+ * until it catches up; one more than FOLLOW_FILES_MAX files behind is
+ * disconnected.
+ */
+
+#include <glib.h>    /* gboolean */
+#include <stdint.h>  /* int64_t */
+#include <sys/uio.h> /* struct iovec */
+
+/* The k8s-file log is fd, with offset bytes in it already. */
+void configure_follow_log(int fd, int64_t offset);
+/* Records were written to the log, see k8s_log_t. */
+void follow_log_written(const struct iovec *iov, int iovcnt);
+/* The log was switched to the new file fd, by a rotation or a truncation. */
+void follow_log_reopened(int fd);
+
+gboolean follow_accept_cb(int fd, GIOCondition condition, gpointer user_data);
+
+/*
+ * Send subscribers what they were not sent yet, for up to timeout_ms, and
+ * disconnect them. One that takes nothing for FOLLOW_DRAIN_STALL_MS is
+ * disconnected right away.
+ */
+void drain_follow_clients(int timeout_ms);
+
+#endif // FOLLOW_SOCK_H
@@ -10,7 +10,6 @@ int mainfd_stderr = -1;
 int attach_socket_fd = -1;
 int console_socket_fd = -1;
 int terminal_ctrl_fd = -1;
-int inotify_fd = -1;
 int winsz_fd_w = -1;
 int winsz_fd_r = -1;
 int attach_pipe_fd = -1;
@@ -14,7 +14,6 @@ extern int mainfd_stderr;
 extern int attach_socket_fd;
 extern int console_socket_fd;
 extern int terminal_ctrl_fd;
-extern int inotify_fd;
 extern int winsz_fd_w;
 extern int winsz_fd_r;
 extern int attach_pipe_fd;
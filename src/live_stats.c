@@ -0,0 +1,77 @@
+#define _GNU_SOURCE
+
+#include "live_stats.h"
+#include "cli.h"
+#include "counters.h"
+#include "utils.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <glib.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+static struct live_stats_page *page = NULL;
+
+static uint64_t monotonic_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void setup_live_stats(void)
+{
+	if (!opt_live_stats)
+		return;
+
+	_cleanup_free_ char *path = g_build_filename(opt_persist_path, "live-stats", NULL);
+
+	/* A fresh file rather than truncating one still mapped by readers, which would get SIGBUS. */
+	if (unlink(path) < 0 && errno != ENOENT)
+		nwarnf("Failed to remove %s", path);
+	_cleanup_close_ int fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		nwarnf("Failed to create %s", path);
+		return;
+	}
+	if (ftruncate(fd, LIVE_STATS_SIZE) < 0) {
+		nwarnf("Failed to size %s", path);
+		return;
+	}
+	void *mem = mmap(NULL, LIVE_STATS_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (mem == MAP_FAILED) {
+		nwarnf("Failed to map %s", path);
+		return;
+	}
+
+	page = mem;
+	page->version = LIVE_STATS_VERSION;
+	page->pid = getpid();
+	page->started_ns = monotonic_ns();
+	publish_live_stats();
+	/* Readers take the page as valid once the magic is there. */
+	__atomic_store_n(&page->magic, LIVE_STATS_MAGIC, __ATOMIC_RELEASE);
+}
+
+void publish_live_stats(void)
+{
+	if (page == NULL)
+		return;
+
+	live_stats_write_begin(page);
+	page->updated_ns = monotonic_ns();
+	page->stdout_bytes = counters.stdout_bytes;
+	page->stdout_lines = counters.stdout_lines;
+	page->stderr_bytes = counters.stderr_bytes;
+	page->stderr_lines = counters.stderr_lines;
+	page->dropped_bytes = counters.log_paused_bytes;
+	page->log_write_errors = counters.log_write_errors;
+	page->log_rotations = counters.log_rotations;
+	page->attach_clients = counters.attach_clients;
+	page->last_write_latency_ns = counters.last_write_latency_ns;
+	page->oom_events = counters.oom_events;
+	live_stats_write_end(page);
+}
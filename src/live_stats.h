@@ -0,0 +1,87 @@
+#if !defined(LIVE_STATS_H)
+#define LIVE_STATS_H
+
+/*
+ * The live stats page: conmon's counters in a page of shared memory that
+ * node agents can mmap and read without a syscall per conmon per scrape.
+ *
+ * With --live-stats, conmon maps <persist-dir>/live-stats (on tmpfs under
+ * /run in practice) and updates it as the counters change. The layout below
+ * is fixed for a given version and in host byte order. Updates are guarded
+ * by a seqlock: seq is odd while conmon is writing, and a reader retries a
+ * copy made while seq was odd or changed. live_stats_read() does just that;
+ * this header can be used on its own, without glib.
+ *
+ * A page left with an odd seq is from a conmon that died mid-update, and a
+ * page whose pid is gone is from one that exited.
+ */
+
+#include <stdint.h> /* uint32_t and uint64_t */
+#include <string.h> /* memcpy */
+
+#define LIVE_STATS_MAGIC 0x5453434c /* "LCST" */
+#define LIVE_STATS_VERSION 1
+#define LIVE_STATS_SIZE 4096
+
+/* Copies made while seq keeps changing are retried this many times. */
+#define LIVE_STATS_READ_RETRIES 1000
+
+struct live_stats_page {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t seq;
+	uint32_t pid;		/* of conmon */
+	uint64_t started_ns;	/* CLOCK_MONOTONIC; the uptime is now - started_ns */
+	uint64_t updated_ns;	/* CLOCK_MONOTONIC */
+	uint64_t stdout_bytes;
+	uint64_t stdout_lines;
+	uint64_t stderr_bytes;
+	uint64_t stderr_lines;
+	/* not logged, because log capture was paused */
+	uint64_t dropped_bytes;
+	uint64_t log_write_errors;
+	uint64_t log_rotations;
+	/* connected right now */
+	uint64_t attach_clients;
+	/* time taken to log the last buffer read from the container */
+	uint64_t last_write_latency_ns;
+	uint64_t oom_events;
+};
+
+static inline void live_stats_write_begin(struct live_stats_page *page)
+{
+	__atomic_store_n(&page->seq, page->seq + 1, __ATOMIC_RELAXED);
+	/* Keep the stores to the counters after seq went odd. */
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void live_stats_write_end(struct live_stats_page *page)
+{
+	__atomic_store_n(&page->seq, page->seq + 1, __ATOMIC_RELEASE);
+}
+
+/* Copy a consistent snapshot of page to out. Returns the number of retries it took, or -1 if it gave up. */
+static inline int live_stats_read(const struct live_stats_page *page, struct live_stats_page *out)
+{
+	for (int retries = 0; retries <= LIVE_STATS_READ_RETRIES; retries++) {
+		uint32_t seq = __atomic_load_n(&page->seq, __ATOMIC_ACQUIRE);
+		if (seq & 1)
+			continue;
+		memcpy(out, page, sizeof(*out));
+		/* Keep the loads of the counters before seq is checked again. */
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&page->seq, __ATOMIC_RELAXED) == seq) {
+			out->seq = seq;
+			return retries;
+		}
+	}
+	return -1;
+}
+
+/* Map the page in the persist directory, with --live-stats. */
+void setup_live_stats(void);
+
+/* Copy the counters to the page, if there is one. */
+void publish_live_stats(void);
+
+#endif // LIVE_STATS_H
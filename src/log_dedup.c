@@ -0,0 +1,87 @@
+#define _GNU_SOURCE
+
+#include "log_dedup.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+/* A multiply and shift for every 8 bytes, in two independent lanes so that
+   lines are hashed about as fast as memchr() finds them. */
+uint64_t log_dedup_hash(const char *buf, size_t len)
+{
+	uint64_t h1 = 0x9e3779b97f4a7c15ULL ^ len, h2 = 0x6a09e667f3bcc909ULL;
+	uint64_t w1, w2;
+
+	for (; len >= 2 * sizeof(w1); buf += 2 * sizeof(w1), len -= 2 * sizeof(w1)) {
+		memcpy(&w1, buf, sizeof(w1));
+		memcpy(&w2, buf + sizeof(w1), sizeof(w2));
+		h1 = (h1 ^ w1) * 0xff51afd7ed558ccdULL;
+		h2 = (h2 ^ w2) * 0xc4ceb9fe1a85ec53ULL;
+		h1 ^= h1 >> 32;
+		h2 ^= h2 >> 32;
+	}
+	w1 = w2 = 0;
+	memcpy(&w1, buf, MIN(len, sizeof(w1)));
+	if (len > sizeof(w1))
+		memcpy(&w2, buf + sizeof(w1), len - sizeof(w1));
+	h1 = (h1 ^ w1 ^ (h2 ^ w2) * 0x9fb21c651e98df25ULL) * 0xff51afd7ed558ccdULL;
+	return h1 ^ (h1 >> 29);
+}
+
+bool log_dedup_flush(log_dedup_t *dedup, stdpipe_t pipe, log_dedup_write_t write)
+{
+	char buf[64];
+
+	if (dedup->repeats == 0)
+		return true;
+	int len = snprintf(buf, sizeof(buf), "conmon: last message repeated %" PRIu64 " times\n", dedup->repeats);
+	dedup->repeats = 0;
+	return write(pipe, buf, len);
+}
+
+bool log_dedup_filter(log_dedup_t *dedup, stdpipe_t pipe, char *buf, ssize_t buflen, log_dedup_write_t write)
+{
+	char *end = buf + buflen;
+	char *kept = buf; /* the start of the output kept but not written yet */
+	bool ret = true;
+
+	for (char *line = buf; line < end;) {
+		char *eol = memchr(line, '\n', end - line);
+		if (eol == NULL) {
+			/* The start of a line, which is not compared. A run of repeats before it is over. */
+			ret &= log_dedup_flush(dedup, pipe, write);
+			dedup->have_last = false;
+			dedup->mid_line = true;
+			break;
+		}
+
+		size_t len = eol + 1 - line;
+		if (dedup->mid_line) {
+			/* The end of a line begun in an earlier read */
+			dedup->mid_line = false;
+			line = eol + 1;
+			continue;
+		}
+
+		uint64_t hash = log_dedup_hash(line, len);
+		if (dedup->have_last && hash == dedup->last_hash && len == dedup->last_len) {
+			if (kept < line)
+				ret &= write(pipe, kept, line - kept);
+			kept = eol + 1;
+			dedup->repeats++;
+			dedup->collapsed++;
+		} else {
+			/* Nothing was kept since the repeats, so the summary goes right before this line. */
+			ret &= log_dedup_flush(dedup, pipe, write);
+			dedup->have_last = true;
+			dedup->last_hash = hash;
+			dedup->last_len = len;
+		}
+		line = eol + 1;
+	}
+
+	if (kept < end)
+		ret &= write(pipe, kept, end - kept);
+	return ret;
+}
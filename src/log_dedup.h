@@ -0,0 +1,42 @@
+#if !defined(LOG_DEDUP_H)
+#define LOG_DEDUP_H
+
+/*
+ * Collapsing repeated lines, with --log-dedup.
+ *
+ * Each complete line of a stream is compared with the one before it by its
+ * length and a 64-bit hash, so the previous line need not be kept. Copies of
+ * the same line in a row are left out, and once the run ends (or a timeout
+ * makes conmon call log_dedup_flush()) a single line takes their place:
+ *
+ *   conmon: last message repeated N times
+ *
+ * Lines split across reads are passed on as they are and never collapsed.
+ */
+
+#include "utils.h"     /* stdpipe_t */
+#include <stdbool.h>   /* bool */
+#include <stdint.h>    /* uint64_t */
+#include <sys/types.h> /* ssize_t */
+
+/* Where log_dedup_filter() sends the output it keeps, in order. */
+typedef bool (*log_dedup_write_t)(stdpipe_t pipe, char *buf, ssize_t len);
+
+typedef struct {
+	bool mid_line;	    /* the output so far ends in the middle of a line */
+	bool have_last;	    /* last_hash and last_len are of the line before */
+	uint64_t last_hash;
+	size_t last_len;
+	uint64_t repeats;   /* copies of that line left out since the last summary */
+	uint64_t collapsed; /* copies of any line left out, ever */
+} log_dedup_t;
+
+uint64_t log_dedup_hash(const char *buf, size_t len);
+
+/* Pass the output in buf on to write, leaving out repeated lines. */
+bool log_dedup_filter(log_dedup_t *dedup, stdpipe_t pipe, char *buf, ssize_t buflen, log_dedup_write_t write);
+
+/* Write the summary of the repeats left out so far, if there are any. Later copies are still left out. */
+bool log_dedup_flush(log_dedup_t *dedup, stdpipe_t pipe, log_dedup_write_t write);
+
+#endif // LOG_DEDUP_H
@@ -0,0 +1,92 @@
+#define _GNU_SOURCE
+
+#include "log_driver.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+
+static log_driver_t *drivers[LOG_DRIVERS_MAX];
+static size_t n_drivers = 0;
+
+void register_log_driver(log_driver_t *driver)
+{
+	if (n_drivers == LOG_DRIVERS_MAX)
+		nexitf("Too many log drivers, at most %d can be enabled", LOG_DRIVERS_MAX);
+	drivers[n_drivers++] = driver;
+}
+
+size_t log_driver_count(void)
+{
+	return n_drivers;
+}
+
+int write_log_drivers(stdpipe_t pipe, const char *buf, ssize_t buflen)
+{
+	log_line_t lines[LOG_LINES_MAX];
+	bool failed[LOG_DRIVERS_MAX] = {false};
+	struct timespec ts = {0};
+	ssize_t consumed;
+	int n_failed = 0;
+
+	if (n_drivers == 0)
+		return 0;
+
+	/* The same timestamp for every line of the buffer, as for every driver */
+	if (clock_gettime(CLOCK_REALTIME, &ts) < 0)
+		nwarnf("Failed to get the time for the log: %m");
+
+	if (buflen == 0) {
+		for (size_t i = 0; i < n_drivers; i++) {
+			if (drivers[i]->flush != NULL && drivers[i]->flush(drivers[i], pipe, &ts) < 0)
+				failed[i] = true;
+		}
+	}
+
+	while (buflen > 0) {
+		size_t n_lines = split_log_lines(buf, buflen, lines, LOG_LINES_MAX, &consumed);
+		for (size_t i = 0; i < n_drivers; i++) {
+			if (!failed[i] && drivers[i]->write(drivers[i], pipe, lines, n_lines, &ts) < 0)
+				failed[i] = true;
+		}
+		buf += consumed;
+		buflen -= consumed;
+	}
+
+	for (size_t i = 0; i < n_drivers; i++) {
+		if (failed[i]) {
+			nwarnf("%s log driver failed to write %s output", drivers[i]->name, stdpipe_name(pipe));
+			drivers[i]->errors++;
+			n_failed++;
+		}
+	}
+	return n_failed;
+}
+
+int format_log_driver_errors(char *buf, size_t len)
+{
+	int off = snprintf(buf, len, "{");
+
+	for (size_t i = 0; i < n_drivers; i++) {
+		size_t used = MIN((size_t)off, len);
+		off += snprintf(buf + used, len - used, "%s\"%s\": %" PRIu64, i > 0 ? ", " : "", drivers[i]->name, drivers[i]->errors);
+	}
+	size_t used = MIN((size_t)off, len);
+	return off + snprintf(buf + used, len - used, "}");
+}
+
+void sync_log_drivers(void)
+{
+	for (size_t i = 0; i < n_drivers; i++) {
+		if (drivers[i]->sync != NULL)
+			drivers[i]->sync(drivers[i]);
+	}
+}
+
+void close_log_drivers(void)
+{
+	for (size_t i = 0; i < n_drivers; i++) {
+		if (drivers[i]->close != NULL)
+			drivers[i]->close(drivers[i]);
+	}
+}
@@ -0,0 +1,52 @@
+#if !defined(LOG_DRIVER_H)
+#define LOG_DRIVER_H
+
+/*
+ * The log driver pipeline.
+ *
+ * Container output is split into lines and timestamped once, here, and then
+ * handed to each registered driver in turn. A driver keeps whatever it holds
+ * back between writes (such as the start of a line) in its own state, and a
+ * driver that fails is counted and warned about without keeping the output
+ * from the drivers after it.
+ */
+
+#include "log_format.h" /* log_line_t */
+#include "utils.h"	/* stdpipe_t */
+#include <stdint.h>	/* uint64_t */
+#include <sys/types.h>	/* ssize_t */
+#include <time.h>	/* struct timespec */
+
+/* More than there are kinds of drivers, each can only be enabled once. */
+#define LOG_DRIVERS_MAX 8
+
+typedef struct log_driver log_driver_t;
+
+struct log_driver {
+	const char *name;
+	/* Write a batch of lines, all read at ts. Only the last one can be partial. Returns < 0 on errors. */
+	int (*write)(log_driver_t *driver, stdpipe_t pipe, const log_line_t *lines, size_t n_lines, const struct timespec *ts);
+	/* Write out what is held back for pipe, as at exit. Optional. */
+	int (*flush)(log_driver_t *driver, stdpipe_t pipe, const struct timespec *ts);
+	/* Optional, for sync_log_drivers() and close_log_drivers(). */
+	void (*sync)(log_driver_t *driver);
+	void (*close)(log_driver_t *driver);
+	uint64_t errors; /* failed writes and flushes */
+};
+
+void register_log_driver(log_driver_t *driver);
+size_t log_driver_count(void);
+
+/*
+ * Write the output in buf to every driver, or flush them with a buflen of 0.
+ * Returns the number of drivers that failed.
+ */
+int write_log_drivers(stdpipe_t pipe, const char *buf, ssize_t buflen);
+
+/* Format each driver's errors as a JSON object keyed by name, returns the length snprintf would have written. */
+int format_log_driver_errors(char *buf, size_t len);
+
+void sync_log_drivers(void);
+void close_log_drivers(void);
+
+#endif // LOG_DRIVER_H
@@ -0,0 +1,672 @@
+#define _GNU_SOURCE
+
+#include "log_format.h"
+#include "probes.h"
+
+#include <errno.h>
+#include <glib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Flush the records in bufv to the log, and hand them to log->written once
+ * they are in the file.
+ */
+static ssize_t flush_k8s_records(k8s_log_t *log, writev_buffer_t *bufv)
+{
+	struct iovec iov[WRITEV_BUFFER_N_IOV];
+	int iovcnt = bufv->iovcnt;
+
+	/* writev_buffer_flush() moves the iovecs along as it goes */
+	if (log->written != NULL)
+		memcpy(iov, bufv->iov, iovcnt * sizeof(struct iovec));
+	ssize_t flushed = writev_buffer_flush(log->fd, bufv);
+	if (log->written != NULL && flushed > 0)
+		log->written(iov, iovcnt);
+	return flushed;
+}
+
+static ssize_t append_k8s_segment(k8s_log_t *log, writev_buffer_t *bufv, const void *data, ssize_t len)
+{
+	if (bufv->iovcnt == WRITEV_BUFFER_N_IOV && flush_k8s_records(log, bufv) < 0)
+		return -1;
+	return writev_buffer_append_segment_no_flush(bufv, data, len);
+}
+
+/*
+ * Append one record, made of the timestamp, the tag and the a and b parts of
+ * the line, to bufv. Returns false once the global size limit was reached.
+ */
+static bool append_k8s_record(k8s_log_t *log, writev_buffer_t *bufv, const char *tsbuf, bool partial, const char *a, ssize_t alen,
+			      const char *b, ssize_t blen)
+{
+	/* This is the line + TSBUFLEN - 1 + 2 (- 1 is for ignoring \0). */
+	int64_t bytes_to_be_written = alen + blen + TSBUFLEN + 1;
+
+	/* If partial, then we add a \n */
+	if (partial) {
+		bytes_to_be_written += 1;
+	}
+
+	/* If the caller specified a global max, enforce it before writing */
+	if (log->global_size_max > 0 && log->total_bytes_written >= log->global_size_max)
+		return false;
+
+	/*
+	 * We re-open the log file if writing out the bytes will exceed the max
+	 * log size. We also reset the state so that the new file is started with
+	 * a timestamp.
+	 */
+	if ((log->size_max > 0) && !log->rotation_pending && (log->bytes_written + bytes_to_be_written) > log->size_max) {
+		if (flush_k8s_records(log, bufv) < 0) {
+			nwarn("failed to flush buffer to log");
+		}
+		log->reopen();
+	}
+
+	/* Output the timestamp */
+	if (append_k8s_segment(log, bufv, tsbuf, TSBUFLEN - 1) < 0) {
+		nwarn("failed to write (timestamp, stream) to log");
+		return true;
+	}
+
+	/* Output log tag for partial or newline */
+	if (partial) {
+		if (append_k8s_segment(log, bufv, "P ", 2) < 0) {
+			nwarn("failed to write partial log tag");
+			return true;
+		}
+	} else {
+		if (append_k8s_segment(log, bufv, "F ", 2) < 0) {
+			nwarn("failed to write end log tag");
+			return true;
+		}
+	}
+
+	/* Output the actual contents. */
+	if (append_k8s_segment(log, bufv, a, alen) < 0 || append_k8s_segment(log, bufv, b, blen) < 0) {
+		nwarn("failed to write buffer to log");
+		return true;
+	}
+
+	/* Output a newline for partial */
+	if (partial) {
+		if (append_k8s_segment(log, bufv, "\n", 1) < 0) {
+			nwarn("failed to write newline to log");
+			return true;
+		}
+	}
+
+	log->bytes_written += bytes_to_be_written;
+	log->total_bytes_written += bytes_to_be_written;
+	return true;
+}
+
+/*
+ * Write the line in buf, line_len bytes long and ending with a newline unless
+ * partial, as records of at most max_line_size bytes. The part of the line
+ * held from earlier reads comes first.
+ */
+static bool split_k8s_line(k8s_log_t *log, writev_buffer_t *bufv, const char *tsbuf, k8s_partial_t *held, bool partial, const char *buf,
+			   ssize_t line_len)
+{
+	const ssize_t max = log->max_line_size;
+	ssize_t left = partial ? line_len : line_len - 1;
+
+	/* Full-size P records while more than max bytes are left, so that the rest (up to max bytes)
+	   makes the F record, or is held until it is known whether the line ends right there. */
+	while ((ssize_t)held->len + left > max) {
+		ssize_t take = max - held->len;
+		if (!append_k8s_record(log, bufv, tsbuf, true, held->buf, held->len, buf, take))
+			return false;
+		held->len = 0;
+		buf += take;
+		left -= take;
+	}
+
+	if (!partial) {
+		bool ret = append_k8s_record(log, bufv, tsbuf, false, held->buf, held->len, buf, left + 1);
+		held->len = 0;
+		return ret;
+	}
+
+	if (left > 0) {
+		/* held->buf may still be in bufv. */
+		if (flush_k8s_records(log, bufv) < 0) {
+			nwarn("failed to flush buffer to log");
+		}
+		if (held->buf == NULL)
+			held->buf = g_malloc(max);
+		memcpy(held->buf + held->len, buf, left);
+		held->len += left;
+	}
+	return true;
+}
+
+/*
+ * Split buf into lines, up to max_lines of them. Returns the number of lines,
+ * and the number of bytes they cover in consumed.
+ */
+size_t split_log_lines(const char *buf, ssize_t buflen, log_line_t *lines, size_t max_lines, ssize_t *consumed)
+{
+	const char *start = buf;
+	ptrdiff_t line_len;
+	size_t n = 0;
+
+	for (; buflen > 0 && n < max_lines; n++) {
+		lines[n].partial = get_line_len(&line_len, buf, buflen);
+		lines[n].buf = buf;
+		lines[n].len = line_len;
+		buf += line_len;
+		buflen -= line_len;
+	}
+	*consumed = buf - start;
+	return n;
+}
+
+/*
+ * The CRI requires us to write logs with a (timestamp, stream, line) format
+ * for every newline-separated line. write_k8s_lines writes said format for
+ * every line, and will partially write the final line if it is partial.
+ * All of them are timestamped ts.
+ */
+int write_k8s_lines(k8s_log_t *log, stdpipe_t pipe, const log_line_t *lines, size_t n_lines, const struct timespec *ts)
+{
+	writev_buffer_t bufv = {0};
+	k8s_partial_t *held = &log->partial[pipe];
+	char tsbuf[TSBUFLEN];
+
+	format_k8s_timestamp(tsbuf, sizeof tsbuf, ts, stdpipe_name(pipe));
+	if (log->index != NULL)
+		log_index_note(log->index, (int64_t)ts->tv_sec * 1000000000 + ts->tv_nsec, log->bytes_written);
+
+	for (size_t i = 0; i < n_lines; i++) {
+		if (log->max_line_size > 0) {
+			if (!split_k8s_line(log, &bufv, tsbuf, held, lines[i].partial, lines[i].buf, lines[i].len))
+				break;
+		} else if (!append_k8s_record(log, &bufv, tsbuf, lines[i].partial, NULL, 0, lines[i].buf, lines[i].len)) {
+			break;
+		}
+	}
+
+	ssize_t flushed = flush_k8s_records(log, &bufv);
+	CONMON_PROBE2(k8s_log_flush, log->fd, flushed);
+	if (flushed < 0) {
+		nwarn("failed to flush buffer to log");
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Write out the held start of a line, see max_line_size, as a last P record. */
+int flush_k8s_log(k8s_log_t *log, stdpipe_t pipe, const struct timespec *ts)
+{
+	writev_buffer_t bufv = {0};
+	k8s_partial_t *held = &log->partial[pipe];
+	char tsbuf[TSBUFLEN];
+
+	if (held->len == 0)
+		return 0;
+	format_k8s_timestamp(tsbuf, sizeof tsbuf, ts, stdpipe_name(pipe));
+	if (log->index != NULL)
+		log_index_note(log->index, (int64_t)ts->tv_sec * 1000000000 + ts->tv_nsec, log->bytes_written);
+	append_k8s_record(log, &bufv, tsbuf, true, held->buf, held->len, NULL, 0);
+	held->len = 0;
+	if (flush_k8s_records(log, &bufv) < 0) {
+		nwarn("failed to flush buffer to log");
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * write_k8s_lines() for the output in buf, timestamped now. A buflen of 0
+ * flushes the held start of a line.
+ */
+int write_k8s_log(k8s_log_t *log, stdpipe_t pipe, const char *buf, ssize_t buflen)
+{
+	log_line_t lines[LOG_LINES_MAX];
+	ssize_t consumed;
+
+	/*
+	 * Use the same timestamp for every line of the log in this buffer.
+	 * There is no practical difference in the output since write(2) is
+	 * fast.
+	 */
+	struct timespec ts = {0};
+	if (clock_gettime(CLOCK_REALTIME, &ts) < 0 && errno != EINVAL)
+		ts.tv_nsec = 0;
+
+	if (buflen == 0)
+		return flush_k8s_log(log, pipe, &ts);
+
+	int ret = 0;
+	while (buflen > 0) {
+		size_t n_lines = split_log_lines(buf, buflen, lines, LOG_LINES_MAX, &consumed);
+		if (write_k8s_lines(log, pipe, lines, n_lines, &ts) < 0)
+			ret = -1;
+		buf += consumed;
+		buflen -= consumed;
+	}
+	return ret;
+}
+
+/* Scratch space for the records write_json_lines() builds, grown as needed */
+static char *json_buf = NULL;
+static size_t json_buf_size = 0;
+
+/*
+ * Write docker's json-file format, one {"log":...,"stream":...,"time":...}
+ * record for every line. A partial line makes a record of its own, without
+ * the newline at the end of "log", as docker does for long lines. timebuf is
+ * from format_json_timestamp(). The records are built in one buffer and
+ * written at once, unless the file has to be reopened on the way.
+ */
+int write_json_lines(k8s_log_t *log, stdpipe_t pipe, const log_line_t *lines, size_t n_lines, const char *timebuf)
+{
+	static const char log_key[] = "{\"log\":\"", stream_key[] = "\",\"stream\":\"", time_key[] = "\",\"time\":\"", end[] = "\"}\n";
+	const char *stream = stdpipe_name(pipe);
+	const size_t stream_len = strlen(stream);
+	const size_t overhead = sizeof(log_key) + sizeof(stream_key) + sizeof(time_key) + sizeof(end) - 4 + stream_len + JSON_TIMEBUFLEN - 1;
+	size_t needed = 0;
+	int ret = 0;
+
+	for (size_t i = 0; i < n_lines; i++)
+		needed += JSON_ESCAPED_MAX((size_t)lines[i].len) + overhead;
+	if (needed > json_buf_size) {
+		json_buf_size = MAX(needed, 2 * json_buf_size);
+		json_buf = g_realloc(json_buf, json_buf_size);
+	}
+
+	char *start = json_buf; /* the records not written yet */
+	char *out = json_buf;
+	for (size_t i = 0; i < n_lines; i++) {
+		if (log->global_size_max > 0 && log->total_bytes_written >= log->global_size_max)
+			break;
+
+		char *record = out;
+		out = mempcpy(out, log_key, sizeof(log_key) - 1);
+		out += escape_json(out, lines[i].buf, lines[i].len);
+		out = mempcpy(out, stream_key, sizeof(stream_key) - 1);
+		out = mempcpy(out, stream, stream_len);
+		out = mempcpy(out, time_key, sizeof(time_key) - 1);
+		out = mempcpy(out, timebuf, JSON_TIMEBUFLEN - 1);
+		out = mempcpy(out, end, sizeof(end) - 1);
+
+		/* As with k8s-file, reopen the log before a record that would take it over size_max. */
+		int64_t record_len = out - record;
+		if (log->size_max > 0 && !log->rotation_pending && log->bytes_written + record_len > log->size_max) {
+			if (record > start && write_all(log->fd, start, record - start) < 0) {
+				nwarn("failed to write json-file records");
+				ret = -1;
+			}
+			start = record;
+			log->reopen();
+		}
+		log->bytes_written += record_len;
+		log->total_bytes_written += record_len;
+	}
+
+	if (out > start && write_all(log->fd, start, out - start) < 0) {
+		nwarn("failed to write json-file records");
+		ret = -1;
+	}
+	return ret;
+}
+
+/* Find the end of the line, or alternatively the end of the buffer.
+ * Returns false in the former case (it's a whole line) or true in the latter (it's a partial)
+ */
+bool get_line_len(ptrdiff_t *line_len, const char *buf, ssize_t buflen)
+{
+	bool partial = FALSE;
+	const char *line_end = memchr(buf, '\n', buflen);
+	if (line_end == NULL) {
+		line_end = &buf[buflen - 1];
+		partial = TRUE;
+	}
+	*line_len = line_end - buf + 1;
+	return partial;
+}
+
+
+ssize_t writev_buffer_flush(int fd, writev_buffer_t *buf)
+{
+	ssize_t count = 0;
+	int iovcnt = buf->iovcnt;
+	struct iovec *iov = buf->iov;
+
+	/*
+	 * By definition, flushing the buffers will either be entirely successful, or will fail at some point
+	 * along the way.  There is no facility to attempt to retry a writev() system call outside of an EINTR
+	 * errno.  Therefore, no matter the outcome, always reset the writev_buffer_t data structure.
+	 */
+	buf->iovcnt = 0;
+
+	while (iovcnt > 0) {
+		ssize_t res;
+		do {
+			res = writev(fd, iov, iovcnt);
+		} while (res == -1 && errno == EINTR);
+
+		if (res <= 0) {
+			/*
+			 * Any unflushed data is lost (this would be a good place to add a counter for how many times
+			 * this occurs and another count for how much data is lost).
+			 *
+			 * Note that if writev() returns a 0, this logic considers it an error.
+			 */
+			return -1;
+		}
+
+		count += res;
+
+		while (res > 0) {
+			size_t iov_len = iov->iov_len;
+			size_t from_this = MIN((size_t)res, iov_len);
+			res -= from_this;
+			iov_len -= from_this;
+
+			if (iov_len == 0) {
+				iov++;
+				iovcnt--;
+				/* continue, res still > 0 */
+			} else {
+				iov->iov_len = iov_len;
+				iov->iov_base += from_this;
+				/* break, res is 0 */
+			}
+		}
+	}
+
+	return count;
+}
+
+
+ssize_t writev_buffer_append_segment(int fd, writev_buffer_t *buf, const void *data, ssize_t len)
+{
+	if (data == NULL)
+		return 1;
+
+	if (buf->iovcnt == WRITEV_BUFFER_N_IOV && writev_buffer_flush(fd, buf) < 0)
+		return -1;
+
+	if (len > 0) {
+		buf->iov[buf->iovcnt].iov_base = (void *)data;
+		buf->iov[buf->iovcnt].iov_len = (size_t)len;
+		buf->iovcnt++;
+	}
+
+	return 1;
+}
+
+ssize_t writev_buffer_append_segment_no_flush(writev_buffer_t *buf, const void *data, ssize_t len)
+{
+	if (data == NULL)
+		return 1;
+
+	if (buf->iovcnt == WRITEV_BUFFER_N_IOV)
+		return -1;
+
+	if (len > 0) {
+		buf->iov[buf->iovcnt].iov_base = (void *)data;
+		buf->iov[buf->iovcnt].iov_len = (size_t)len;
+		buf->iovcnt++;
+	}
+
+	return 1;
+}
+
+
+const char *stdpipe_name(stdpipe_t pipe)
+{
+	switch (pipe) {
+	case STDIN_PIPE:
+		return "stdin";
+	case STDOUT_PIPE:
+		return "stdout";
+	case STDERR_PIPE:
+		return "stderr";
+	default:
+		return "NONE";
+	}
+}
+
+/* Generate timestamp string to buf. */
+void set_k8s_timestamp(char *buf, ssize_t buflen, const char *pipename)
+{
+	/* Initialize timestamp variables with sensible defaults. */
+	struct timespec ts = {0};
+
+	/* Attempt to get the current time. */
+	if (clock_gettime(CLOCK_REALTIME, &ts) < 0) {
+		if (errno != EINVAL) {
+			ts.tv_nsec = 0; /* If other errors, fallback to nanoseconds = 0. */
+		}
+	}
+
+	format_k8s_timestamp(buf, buflen, &ts, pipename);
+}
+
+/* Generate the timestamp string for ts to buf. */
+void format_k8s_timestamp(char *buf, ssize_t buflen, const struct timespec *ts, const char *pipename)
+{
+	static int tzset_called = 0;
+	struct tm current_tm = {0};
+	char off_sign = '+';
+	int off = 0;
+
+	/* Ensure tzset is called only once. */
+	if (!tzset_called) {
+		tzset();
+		tzset_called = 1;
+	}
+
+	/* Get the local time or fallback to defaults. */
+	if (localtime_r(&ts->tv_sec, &current_tm) == NULL) {
+		current_tm.tm_year = 70; /* 1970 (default epoch year) */
+		current_tm.tm_mon = 0;	 /* January */
+		current_tm.tm_mday = 1;	 /* 1st day of the month */
+		current_tm.tm_hour = 0;	 /* midnight */
+		current_tm.tm_min = 0;
+		current_tm.tm_sec = 0;
+		current_tm.tm_gmtoff = 0; /* UTC offset */
+	}
+
+	/* Calculate timezone offset. */
+	off = (int)current_tm.tm_gmtoff;
+	if (off < 0) {
+		off_sign = '-';
+		off = -off;
+	}
+
+	/* Format the timestamp into the buffer. */
+	int len = snprintf(buf, buflen, "%d-%02d-%02dT%02d:%02d:%02d.%09ld%c%02d:%02d %s ", current_tm.tm_year + 1900,
+			   current_tm.tm_mon + 1, current_tm.tm_mday, current_tm.tm_hour, current_tm.tm_min, current_tm.tm_sec, ts->tv_nsec,
+			   off_sign, off / 3600, (off % 3600) / 60, pipename);
+
+	/* Ensure null termination if snprintf output exceeds buffer length. */
+	if (len >= buflen && buflen > 0) {
+		buf[buflen - 1] = '\0';
+	}
+}
+
+/* Generate docker's RFC 3339 timestamp in UTC, with nanoseconds, for ts to buf. */
+void format_json_timestamp(char *buf, size_t buflen, const struct timespec *ts)
+{
+	struct tm tm = {0};
+
+	if (gmtime_r(&ts->tv_sec, &tm) == NULL) {
+		tm.tm_year = 70; /* 1970-01-01T00:00:00 */
+		tm.tm_mday = 1;
+	}
+	snprintf(buf, buflen, "%04d-%02d-%02dT%02d:%02d:%02d.%09ldZ", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min,
+		 tm.tm_sec, ts->tv_nsec);
+}
+
+/*
+ * parse_priority_prefix checks if the buffer starts with a systemd priority prefix
+ * in the format <N> where N is a digit 0-7. If found, it extracts the priority
+ * and returns a pointer to the message content after the prefix.
+ *
+ * Returns:
+ *  1 if priority prefix was found and parsed
+ *  0 if no valid priority prefix was found
+ * -1 on error (invalid parameters)
+ */
+int parse_priority_prefix(const char *buf, ssize_t buflen, int *priority, const char **message_start)
+{
+	if (!buf || !priority || !message_start) {
+		return -1;
+	}
+
+	/* Need at least 3 characters for <N> pattern */
+	if (buflen < 3) {
+		return 0;
+	}
+
+	/* Check for minimum pattern: <N> where N is 0-7 */
+	if (buf[0] != '<') {
+		return 0;
+	}
+
+	/* Check if second character is a valid priority digit (0-7) */
+	if (buf[1] < '0' || buf[1] > '7') {
+		return 0;
+	}
+
+	/* Check for closing bracket */
+	if (buf[2] != '>') {
+		return 0;
+	}
+
+	/* Extract the priority */
+	*priority = buf[1] - '0';
+	*message_start = buf + 3;
+
+	return 1;
+}
+
+/*
+ * How each byte is escaped in JSON: 0 if it is copied as it is, the letter of
+ * its two-character escape, or 'u' for \u00XX. Forward slashes are escaped as
+ * well, as they always were in conmon's JSON. Bytes from 0x80 on, '8', start
+ * or continue UTF-8 sequences, which are checked before they are copied.
+ */
+static const char json_escapes[256] = {
+	'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'b', 't', 'n', 'u', 'f', 'r', 'u', 'u',
+	'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+	['"'] = '"', ['/'] = '/', ['\\'] = '\\', [0x7f] = 'u',
+	[0x80] = '8', '8', '8', '8', '8', '8', '8', '8', '8', '8', '8', '8', '8', '8', '8', '8',
+	'8', '8', '8', '8', '8', '8', '8', '8', '8', '8', '8', '8', '8', '8', '8', '8',
+	'8', '8', '8', '8', '8', '8', '8', '8', '8', '8', '8', '8', '8', '8', '8', '8',
+	'8', '8', '8', '8', '8', '8', '8', '8', '8', '8', '8', '8', '8', '8', '8', '8',
+	'8', '8', '8', '8', '8', '8', '8', '8', '8', '8', '8', '8', '8', '8', '8', '8',
+	'8', '8', '8', '8', '8', '8', '8', '8', '8', '8', '8', '8', '8', '8', '8', '8',
+	'8', '8', '8', '8', '8', '8', '8', '8', '8', '8', '8', '8', '8', '8', '8', '8',
+	'8', '8', '8', '8', '8', '8', '8', '8', '8', '8', '8', '8', '8', '8', '8', '8',
+};
+
+/*
+ * The length of the well-formed UTF-8 sequence at p, as in table 3-7 of the
+ * Unicode standard (no overlong forms, surrogates or code points past
+ * U+10FFFF), or 0 if there is none.
+ */
+static size_t utf8_sequence_len(const unsigned char *p, const unsigned char *end)
+{
+	unsigned char lo = 0x80, hi = 0xbf;
+	size_t len;
+
+	if (*p >= 0xc2 && *p <= 0xdf)
+		len = 2;
+	else if (*p >= 0xe0 && *p <= 0xef)
+		len = 3;
+	else if (*p >= 0xf0 && *p <= 0xf4)
+		len = 4;
+	else
+		return 0;
+
+	/* The second byte has a narrower range after some of the lead bytes */
+	if (*p == 0xe0)
+		lo = 0xa0;
+	else if (*p == 0xed)
+		hi = 0x9f;
+	else if (*p == 0xf0)
+		lo = 0x90;
+	else if (*p == 0xf4)
+		hi = 0x8f;
+
+	if ((size_t)(end - p) < len || p[1] < lo || p[1] > hi)
+		return 0;
+	for (size_t i = 2; i < len; i++) {
+		if (p[i] < 0x80 || p[i] > 0xbf)
+			return 0;
+	}
+	return len;
+}
+
+/*
+ * Escape len bytes of src into dst, which must have room for
+ * JSON_ESCAPED_MAX(len) bytes. Returns the length of the result, which is not
+ * NUL-terminated. Runs of bytes that need no escaping are copied at once.
+ * Bytes that are not valid UTF-8 become \ufffd, as docker's json-file has it.
+ */
+size_t escape_json(char *dst, const char *src, size_t len)
+{
+	static const char hex[] = "0123456789abcdef";
+	const unsigned char *p = (const unsigned char *)src;
+	const unsigned char *end = p + len;
+	char *out = dst;
+
+	while (p < end) {
+		const unsigned char *run = p;
+		while (p < end && json_escapes[*p] == 0)
+			p++;
+		memcpy(out, run, p - run);
+		out += p - run;
+		if (p == end)
+			break;
+
+		char escape = json_escapes[*p];
+		if (escape == '8') {
+			size_t seq_len = utf8_sequence_len(p, end);
+			if (seq_len > 0) {
+				memcpy(out, p, seq_len);
+				out += seq_len;
+				p += seq_len;
+			} else {
+				memcpy(out, "\\ufffd", 6);
+				out += 6;
+				p++;
+			}
+			continue;
+		}
+
+		*out++ = '\\';
+		if (escape == 'u') {
+			memcpy(out, "u00", 3);
+			out[3] = hex[*p >> 4];
+			out[4] = hex[*p & 0xf];
+			out += 5;
+		} else {
+			*out++ = escape;
+		}
+		p++;
+	}
+	return out - dst;
+}
+
+char *escape_json_string(const char *str)
+{
+	if (str == NULL) {
+		return NULL;
+	}
+
+	size_t str_len = strlen(str);
+	char *escaped = g_malloc(JSON_ESCAPED_MAX(str_len) + 1);
+
+	escaped[escape_json(escaped, str, str_len)] = '\0';
+	return escaped;
+}
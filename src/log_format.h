@@ -0,0 +1,99 @@
+#if !defined(LOG_FORMAT_H)
+#define LOG_FORMAT_H
+
+/*
+ * The log formatting engine: turning container output into k8s-file and
+ * json-file records and journald fields, and writing them out with writev(2). None of it knows
+ * about conmon's options or drivers; it works on the fd and buffers it is
+ * given, so it is built into libconmon-core and benchmarked on its own.
+ */
+
+#include "log_index.h" /* log_index_t */
+#include "utils.h"     /* stdpipe_t */
+#include <stdbool.h>   /* bool */
+#include <stddef.h>    /* ptrdiff_t */
+#include <stdint.h>    /* int64_t */
+#include <sys/types.h> /* ssize_t */
+#include <sys/uio.h>   /* struct iovec */
+#include <time.h>      /* struct timespec */
+
+/* Not declared by <time.h> under plain -std=c99 */
+struct timespec;
+
+/* strlen("1997-03-25T13:20:42.999999999+01:00 stdout ") + 1 */
+#define TSBUFLEN 44
+
+/* strlen("1997-03-25T12:20:42.999999999Z") + 1 */
+#define JSON_TIMEBUFLEN 31
+
+/* The most that escape_json() can turn len bytes into, as \u00XX */
+#define JSON_ESCAPED_MAX(len) (6 * (len))
+
+#define WRITEV_BUFFER_N_IOV 128
+
+/* Output is split into lines in batches of at most this many. */
+#define LOG_LINES_MAX 256
+
+/* A line of container output, split up once for all the log drivers. */
+typedef struct {
+	const char *buf;
+	ssize_t len;  /* with the newline, unless partial */
+	bool partial; /* the read ended before the line did */
+} log_line_t;
+
+typedef struct {
+	int iovcnt;
+	struct iovec iov[WRITEV_BUFFER_N_IOV];
+} writev_buffer_t;
+
+/* The start of a line held back until it makes a full record, see max_line_size. */
+typedef struct {
+	char *buf; /* max_line_size bytes, allocated when first needed */
+	size_t len;
+} k8s_partial_t;
+
+/* A k8s-file or json-file log and its size limits, as used by write_k8s_log() and write_json_lines(). */
+typedef struct {
+	int fd;
+	int64_t bytes_written;	     /* to the current file */
+	int64_t total_bytes_written; /* to all files, for global_size_max */
+	int64_t size_max;	     /* of a file, -1 for no limit */
+	int64_t global_size_max;     /* of all files, -1 for no limit */
+	/* Called before a line that would take the file over size_max. Switches fd to
+	   the next file and resets bytes_written, now or once a rotation is done. */
+	void (*reopen)(void);
+	/* Set while reopen's switch to the next file is under way in the background.
+	   Records keep being batched into fd meanwhile, past size_max. */
+	bool rotation_pending;
+	/* With a max_line_size, lines are split into P records of exactly that many
+	   bytes and an F record with the rest, however they were read. The start of
+	   a line too short for a P record is held until it is longer, ends, or a
+	   write with a buflen of 0 flushes it. 0 for no limit. */
+	int64_t max_line_size;
+	k8s_partial_t partial[STDERR_PIPE + 1];
+	log_index_t *index; /* the time index of the k8s-file log, NULL for none */
+	/* Called with the records once they were written to fd, for the follow socket. NULL for none. */
+	void (*written)(const struct iovec *iov, int iovcnt);
+} k8s_log_t;
+
+size_t split_log_lines(const char *buf, ssize_t buflen, log_line_t *lines, size_t max_lines, ssize_t *consumed);
+
+int write_k8s_log(k8s_log_t *log, stdpipe_t pipe, const char *buf, ssize_t buflen);
+int write_k8s_lines(k8s_log_t *log, stdpipe_t pipe, const log_line_t *lines, size_t n_lines, const struct timespec *ts);
+int flush_k8s_log(k8s_log_t *log, stdpipe_t pipe, const struct timespec *ts);
+void set_k8s_timestamp(char *buf, ssize_t buflen, const char *pipename);
+void format_k8s_timestamp(char *buf, ssize_t buflen, const struct timespec *ts, const char *pipename);
+int write_json_lines(k8s_log_t *log, stdpipe_t pipe, const log_line_t *lines, size_t n_lines, const char *timebuf);
+void format_json_timestamp(char *buf, size_t buflen, const struct timespec *ts);
+const char *stdpipe_name(stdpipe_t pipe);
+bool get_line_len(ptrdiff_t *line_len, const char *buf, ssize_t buflen);
+
+ssize_t writev_buffer_append_segment(int fd, writev_buffer_t *buf, const void *data, ssize_t len);
+ssize_t writev_buffer_append_segment_no_flush(writev_buffer_t *buf, const void *data, ssize_t len);
+ssize_t writev_buffer_flush(int fd, writev_buffer_t *buf);
+
+int parse_priority_prefix(const char *buf, ssize_t buflen, int *priority, const char **message_start);
+size_t escape_json(char *dst, const char *src, size_t len);
+char *escape_json_string(const char *str);
+
+#endif // LOG_FORMAT_H
@@ -0,0 +1,102 @@
+#define _GNU_SOURCE
+
+#include "log_index.h"
+#include "utils.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define NSEC_PER_SEC 1000000000LL
+
+void configure_log_index(log_index_t *index, const char *spec)
+{
+	int64_t bytes, seconds;
+
+	_cleanup_(strv_cleanup) char **parts = g_strsplit(spec, ":", -1);
+	if (g_strv_length(parts) != 2)
+		nexitf("Invalid log index %s, expected BYTES:SECONDS", spec);
+	if (!parse_count(parts[0], &bytes) || !parse_count(parts[1], &seconds) || (bytes == 0 && seconds == 0))
+		nexitf("Invalid log index %s, bytes and seconds must be numbers, not both 0", spec);
+	if (seconds > INT64_MAX / NSEC_PER_SEC)
+		nexitf("Invalid log index %s, too many seconds", spec);
+
+	index->fd = -1;
+	index->every_bytes = bytes;
+	index->every_ns = seconds * NSEC_PER_SEC;
+	index->have_last = false;
+}
+
+int open_log_index(log_index_t *index, const char *log_path, bool truncate)
+{
+	_cleanup_free_ char *path = g_strdup_printf("%s%s", log_path, LOG_INDEX_SUFFIX);
+
+	close_log_index(index);
+	index->fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC | (truncate ? O_TRUNC : 0), 0640);
+	if (index->fd < 0) {
+		nwarnf("Failed to open log index %s: %m", path);
+		return -1;
+	}
+
+	/* Drop a torn entry left by a crash, so that the array stays aligned. */
+	struct stat st;
+	if (fstat(index->fd, &st) == 0 && st.st_size % sizeof(struct log_index_entry) != 0)
+		if (ftruncate(index->fd, st.st_size - st.st_size % sizeof(struct log_index_entry)) < 0)
+			nwarnf("Failed to truncate log index %s: %m", path);
+	return 0;
+}
+
+void close_log_index(log_index_t *index)
+{
+	if (index->fd >= 0)
+		close(index->fd);
+	index->fd = -1;
+	index->have_last = false;
+}
+
+void log_index_note(log_index_t *index, int64_t time_ns, uint64_t offset)
+{
+	if (index->fd < 0)
+		return;
+	if (index->have_last && offset >= index->last_offset) {
+		bool bytes_due = index->every_bytes > 0 && offset - index->last_offset >= (uint64_t)index->every_bytes;
+		bool time_due = index->every_ns > 0 && time_ns - index->last_ns >= index->every_ns;
+		if (!bytes_due && !time_due)
+			return;
+	}
+
+	struct log_index_entry entry = {.time_ns = time_ns, .offset = offset};
+	if (write_all(index->fd, &entry, sizeof(entry)) < 0) {
+		nwarnf("Failed to write log index entry: %m");
+		return;
+	}
+	index->have_last = true;
+	index->last_offset = offset;
+	index->last_ns = time_ns;
+}
+
+int64_t log_index_lookup(int fd, int64_t since_ns)
+{
+	struct log_index_entry entry;
+	struct stat st;
+	uint64_t offset = 0;
+
+	if (fstat(fd, &st) < 0)
+		return -1;
+
+	/* The first entry at since_ns or later is in [lo, hi) */
+	off_t lo = 0, hi = st.st_size / sizeof(entry);
+	while (lo < hi) {
+		off_t mid = lo + (hi - lo) / 2;
+		if (pread(fd, &entry, sizeof(entry), mid * sizeof(entry)) != sizeof(entry))
+			return -1;
+		if (entry.time_ns < since_ns) {
+			offset = entry.offset;
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return offset;
+}
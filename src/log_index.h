@@ -0,0 +1,57 @@
+#if !defined(LOG_INDEX_H)
+#define LOG_INDEX_H
+
+/*
+ * The sidecar time index of a k8s-file log, with --log-index BYTES:SECONDS.
+ *
+ * Next to the log at PATH, PATH.idx is an array of log_index_entry, each
+ * saying that the record at offset in the log was written at time_ns, so
+ * that every record before it is no newer. An entry is added for the first
+ * record written to the file, and then for the first one after BYTES were
+ * written or SECONDS went by since the last entry. The index is truncated
+ * and rotated along with the log, PATH.1 going with PATH.1.idx.
+ *
+ * To read the records since a time, log_index_lookup() bisects the index for
+ * the last entry older than it, and the log is read from the entry's offset,
+ * skipping the few records that are still older. Entries are in host byte
+ * order. Should the clock go back while the log is written, records written
+ * around then may be left out of a lookup.
+ */
+
+#include <stdbool.h> /* bool */
+#include <stdint.h>  /* int64_t */
+
+#define LOG_INDEX_SUFFIX ".idx"
+
+struct log_index_entry {
+	int64_t time_ns; /* CLOCK_REALTIME */
+	uint64_t offset;
+};
+
+typedef struct {
+	int fd;
+	int64_t every_bytes; /* 0 to only go by time */
+	int64_t every_ns;    /* 0 to only go by size */
+	bool have_last;	     /* an entry was added to the file behind fd */
+	uint64_t last_offset;
+	int64_t last_ns;
+} log_index_t;
+
+/* Parse --log-index BYTES:SECONDS into index, exits on errors. */
+void configure_log_index(log_index_t *index, const char *spec);
+
+/* Open the index of the log at log_path, appending to it or truncating it. Returns -1 on errors. */
+int open_log_index(log_index_t *index, const char *log_path, bool truncate);
+void close_log_index(log_index_t *index);
+
+/* A record is about to be written at offset, at time_ns. Adds an entry if one is due. */
+void log_index_note(log_index_t *index, int64_t time_ns, uint64_t offset);
+
+/*
+ * The offset in the log to read from for the records written at since_ns or
+ * later, using the index in fd: that of the last entry older than since_ns,
+ * or 0. Returns -1 on errors.
+ */
+int64_t log_index_lookup(int fd, int64_t since_ns);
+
+#endif // LOG_INDEX_H
@@ -8,6 +8,8 @@
 #include <unistd.h>
 
 int old_oom_score = 0;
+/* old_oom_score, preformatted for reset_oom_adjust_async_safe() */
+static char old_oom_score_str[16] = "0";
 
 static void write_oom_adjust(int oom_score, int *old_value)
 {
@@ -41,9 +43,25 @@ static void write_oom_adjust(int oom_score, int *old_value)
 void attempt_oom_adjust(int oom_score)
 {
 	write_oom_adjust(oom_score, &old_oom_score);
+	snprintf(old_oom_score_str, sizeof(old_oom_score_str), "%d", old_oom_score);
 }
 
 void reset_oom_adjust()
 {
 	write_oom_adjust(old_oom_score, NULL);
 }
+
+/*
+ * Same as reset_oom_adjust(), but only uses async-signal-safe functions and
+ * does not log, so it can be used in a child sharing memory with conmon.
+ */
+void reset_oom_adjust_async_safe()
+{
+#ifdef __linux__
+	int oom_score_fd = open("/proc/self/oom_score_adj", O_WRONLY | O_CLOEXEC);
+	if (oom_score_fd < 0)
+		return;
+	ssize_t ret __attribute__((unused)) = write(oom_score_fd, old_oom_score_str, strlen(old_oom_score_str));
+	close(oom_score_fd);
+#endif
+}
@@ -3,5 +3,6 @@
 
 void attempt_oom_adjust(int oom_score);
 void reset_oom_adjust();
+void reset_oom_adjust_async_safe();
 
 #endif // OOM_H
@@ -1,13 +1,14 @@
+#define _GNU_SOURCE
+
 #include "parent_pipe_fd.h"
 #include "utils.h"
 #include "cli.h"
+#include "log_format.h"
 
 #include <glib.h>
 
 int sync_pipe_fd = -1;
 
-static char *escape_json_string(const char *str);
-
 int get_pipe_fd_from_env(const char *envname)
 {
 	char *endptr = NULL;
@@ -71,55 +72,3 @@ void write_or_close_sync_fd(int *fd, int res, const char *message)
 		pexit("Unable to send container stderr message to parent");
 	}
 }
-
-static char *escape_json_string(const char *str)
-{
-	if (str == NULL) {
-		return NULL;
-	}
-
-	size_t str_len = strlen(str);
-	if (str_len == 0) {
-		return g_strdup("");
-	}
-
-	const char *p = str;
-	GString *escaped = g_string_sized_new(str_len * 2); /* Pre-allocate extra space for escaping */
-
-	if (escaped == NULL) {
-		return NULL;
-	}
-
-	while (*p != 0) {
-		unsigned char c = (unsigned char)*p++;
-
-		/* Handle standard JSON escape sequences */
-		if (c == '\\' || c == '"') {
-			g_string_append_c(escaped, '\\');
-			g_string_append_c(escaped, c);
-		} else if (c == '/') {
-			g_string_append_printf(escaped, "\\/");
-		} else if (c == '\n') {
-			g_string_append_printf(escaped, "\\n");
-		} else if (c == '\r') {
-			g_string_append_printf(escaped, "\\r");
-		} else if (c == '\t') {
-			g_string_append_printf(escaped, "\\t");
-		} else if (c == '\b') {
-			g_string_append_printf(escaped, "\\b");
-		} else if (c == '\f') {
-			g_string_append_printf(escaped, "\\f");
-		} else if (c < 0x20 || c == 0x7f) {
-			/* Escape control characters */
-			g_string_append_printf(escaped, "\\u00%02x", c);
-		} else if (c >= 0x80) {
-			/* For non-ASCII characters, pass through as-is for UTF-8 compatibility */
-			g_string_append_c(escaped, c);
-		} else {
-			/* Regular ASCII characters */
-			g_string_append_c(escaped, c);
-		}
-	}
-
-	return g_string_free(escaped, FALSE);
-}
@@ -0,0 +1,27 @@
+#if !defined(PROBES_H)
+#define PROBES_H
+
+/*
+ * USDT probes, for tracing conmon on a live node with bpftrace or perf
+ * without rebuilding it, e.g.
+ *
+ *   bpftrace -e 'usdt:/usr/bin/conmon:conmon:stdio_read_return { @[arg0] = hist(arg2); }'
+ *
+ * A probe is a single nop until something attaches to it. Without sys/sdt.h
+ * (systemtap-sdt-devel) they are compiled out. The list of probes and their
+ * arguments is in conmon(8).
+ */
+
+#if defined(HAVE_SYS_SDT_H) && defined(__linux__)
+#include <sys/sdt.h>
+
+#define CONMON_PROBE1(name, a) DTRACE_PROBE1(conmon, name, a)
+#define CONMON_PROBE2(name, a, b) DTRACE_PROBE2(conmon, name, a, b)
+#define CONMON_PROBE3(name, a, b, c) DTRACE_PROBE3(conmon, name, a, b, c)
+#else
+#define CONMON_PROBE1(name, a) ((void)(a))
+#define CONMON_PROBE2(name, a, b) ((void)(a), (void)(b))
+#define CONMON_PROBE3(name, a, b, c) ((void)(a), (void)(b), (void)(c))
+#endif
+
+#endif // PROBES_H
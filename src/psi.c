@@ -0,0 +1,191 @@
+#define _GNU_SOURCE
+
+#include "psi.h"
+#include "cli.h"
+#include "utils.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <glib.h>
+#include <glib-unix.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Limits the kernel puts on trigger windows. */
+#define PSI_WINDOW_MIN_US 500000
+#define PSI_WINDOW_MAX_US 10000000
+
+struct pressure_trigger {
+	const char *resource;
+	const char *type;
+	uint64_t stall_us;
+	uint64_t window_us;
+	int fd;
+};
+
+static struct pressure_trigger *triggers = NULL;
+static size_t n_triggers = 0;
+
+static int pressure_events_fd = -1;
+
+static gboolean parse_us(const char *str, uint64_t *value)
+{
+	char *endptr;
+
+	if (str[0] < '0' || str[0] > '9')
+		return FALSE;
+	errno = 0;
+	*value = strtoull(str, &endptr, 10);
+	return errno == 0 && *endptr == '\0';
+}
+
+static void parse_pressure_trigger(const char *spec, struct pressure_trigger *trigger)
+{
+	static const char *const resources[] = {"memory", "io", "cpu"};
+	static const char *const types[] = {"some", "full"};
+	_cleanup_(strv_cleanup) char **parts = g_strsplit(spec, ":", -1);
+
+	if (g_strv_length(parts) != 4)
+		nexitf("Invalid pressure trigger %s, expected RESOURCE:TYPE:STALL_US:WINDOW_US", spec);
+
+	trigger->resource = NULL;
+	for (size_t i = 0; i < G_N_ELEMENTS(resources); i++)
+		if (strcmp(parts[0], resources[i]) == 0)
+			trigger->resource = resources[i];
+	if (trigger->resource == NULL)
+		nexitf("Invalid pressure trigger %s, resource must be one of memory, io or cpu", spec);
+
+	trigger->type = NULL;
+	for (size_t i = 0; i < G_N_ELEMENTS(types); i++)
+		if (strcmp(parts[1], types[i]) == 0)
+			trigger->type = types[i];
+	if (trigger->type == NULL)
+		nexitf("Invalid pressure trigger %s, type must be some or full", spec);
+
+	if (!parse_us(parts[3], &trigger->window_us) || trigger->window_us < PSI_WINDOW_MIN_US || trigger->window_us > PSI_WINDOW_MAX_US)
+		nexitf("Invalid pressure trigger %s, window must be between %d and %d us", spec, PSI_WINDOW_MIN_US, PSI_WINDOW_MAX_US);
+
+	if (!parse_us(parts[2], &trigger->stall_us) || trigger->stall_us == 0 || trigger->stall_us > trigger->window_us)
+		nexitf("Invalid pressure trigger %s, stall must be greater than 0 and at most the window", spec);
+
+	trigger->fd = -1;
+}
+
+void configure_pressure_triggers(gchar **specs)
+{
+	if (specs == NULL)
+		return;
+
+	n_triggers = g_strv_length(specs);
+	triggers = g_new0(struct pressure_trigger, n_triggers);
+	for (size_t i = 0; i < n_triggers; i++)
+		parse_pressure_trigger(specs[i], &triggers[i]);
+}
+
+/* Get the total stall time for the trigger's type from the contents of a
+   pressure file, e.g. "some avg10=0.00 avg60=0.00 avg300=0.00 total=1234". */
+static uint64_t read_total_stall(struct pressure_trigger *trigger)
+{
+	char buf[256];
+	ssize_t len;
+
+	do
+		len = pread(trigger->fd, buf, sizeof(buf) - 1, 0);
+	while (len < 0 && errno == EINTR);
+	if (len <= 0)
+		return 0;
+	buf[len] = '\0';
+
+	for (char *line = buf; line != NULL && *line != '\0';) {
+		char *eol = strchr(line, '\n');
+		if (eol != NULL)
+			*eol = '\0';
+		if (g_str_has_prefix(line, trigger->type) && line[strlen(trigger->type)] == ' ') {
+			char *total = strstr(line, " total=");
+			if (total != NULL)
+				return strtoull(total + strlen(" total="), NULL, 10);
+		}
+		line = eol != NULL ? eol + 1 : NULL;
+	}
+	return 0;
+}
+
+static void record_pressure_event(struct pressure_trigger *trigger)
+{
+	struct timespec ts;
+	char record[160];
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	int len = snprintf(record, sizeof(record), "%lld.%09ld %s %s %" PRIu64 " %" PRIu64 " %" PRIu64 "\n", (long long)ts.tv_sec,
+			   ts.tv_nsec, trigger->resource, trigger->type, trigger->stall_us, trigger->window_us, read_total_stall(trigger));
+
+	/* A single write to an O_APPEND file, so readers never see a partial record from us. */
+	if (write_all(pressure_events_fd, record, len) < 0)
+		nwarnf("Failed to record %s pressure event", trigger->resource);
+}
+
+static gboolean pressure_cb(int fd, GIOCondition condition, gpointer user_data)
+{
+	struct pressure_trigger *trigger = user_data;
+
+	/* The cgroup, and the trigger with it, is gone. */
+	if ((condition & (G_IO_ERR | G_IO_HUP)) != 0) {
+		ndebugf("%s pressure trigger removed", trigger->resource);
+		close(fd);
+		trigger->fd = -1;
+		return G_SOURCE_REMOVE;
+	}
+
+	ninfof("%s %s pressure above %" PRIu64 "us in %" PRIu64 "us", trigger->resource, trigger->type, trigger->stall_us,
+	       trigger->window_us);
+	record_pressure_event(trigger);
+	return G_SOURCE_CONTINUE;
+}
+
+static void setup_pressure_trigger(struct pressure_trigger *trigger)
+{
+	_cleanup_free_ char *file_name = g_strdup_printf("%s.pressure", trigger->resource);
+	_cleanup_free_ char *path = g_build_filename(cgroup2_path, file_name, NULL);
+	_cleanup_free_ char *spec = g_strdup_printf("%s %" PRIu64 " %" PRIu64, trigger->type, trigger->stall_us, trigger->window_us);
+
+	_cleanup_close_ int fd = open(path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+	if (fd < 0) {
+		nwarnf("Failed to open %s for a pressure trigger", path);
+		return;
+	}
+
+	/* The kernel expects the trigger with its terminating NUL. */
+	if (write(fd, spec, strlen(spec) + 1) < 0) {
+		nwarnf("Failed to register pressure trigger \"%s\" on %s", spec, path);
+		return;
+	}
+
+	trigger->fd = fd;
+	fd = -1;
+	g_unix_fd_add(trigger->fd, G_IO_PRI, pressure_cb, trigger);
+}
+
+void setup_pressure_triggers()
+{
+	if (n_triggers == 0)
+		return;
+
+	if (!is_cgroup_v2 || cgroup2_path == NULL) {
+		nwarn("Pressure triggers need the container's cgroup v2, ignoring them");
+		return;
+	}
+
+	_cleanup_free_ char *events_path = g_build_filename(opt_persist_path, "pressure", NULL);
+	pressure_events_fd = open(events_path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+	if (pressure_events_fd < 0) {
+		nwarnf("Failed to open %s", events_path);
+		return;
+	}
+
+	for (size_t i = 0; i < n_triggers; i++)
+		setup_pressure_trigger(&triggers[i]);
+}
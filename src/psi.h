@@ -0,0 +1,24 @@
+#if !defined(PSI_H)
+#define PSI_H
+
+/*
+ * Pressure stall information (PSI) triggers on the container's cgroup v2.
+ *
+ * Each --pressure-trigger RESOURCE:TYPE:STALL_US:WINDOW_US registers a trigger
+ * on RESOURCE.pressure in the container cgroup. The kernel raises POLLPRI on
+ * the trigger fd whenever the tasks of the cgroup were stalled on RESOURCE for
+ * more than STALL_US within WINDOW_US, which is picked up by the main loop and
+ * appended as a line to the "pressure" file in the persist directory:
+ *
+ *   <seconds.nanoseconds since the epoch> RESOURCE TYPE STALL_US WINDOW_US <total stall time in us>
+ */
+
+#include <glib.h> /* gchar */
+
+/* Parse and validate the trigger specs, exits on errors. */
+void configure_pressure_triggers(gchar **specs);
+
+/* Register the triggers, once the container cgroup (cgroup2_path) is known. */
+void setup_pressure_triggers();
+
+#endif // PSI_H
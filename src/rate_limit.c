@@ -0,0 +1,121 @@
+#define _GNU_SOURCE
+
+#include "rate_limit.h"
+#include "utils.h"
+
+#include <stdlib.h>
+#include <time.h>
+
+#define NSEC_PER_SEC 1000000000LL
+#define RATE_LIMIT_BURST_MAX_MS 60000
+
+static struct {
+	bool enabled;
+	bool block;
+	struct token_bucket bytes;
+	struct token_bucket lines;
+} limiter;
+
+static int64_t monotonic_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+void token_bucket_init(struct token_bucket *bucket, int64_t rate, int64_t burst_ms, int64_t now_ns)
+{
+	bucket->rate = rate;
+	bucket->burst = (double)rate * burst_ms / 1000;
+	bucket->tokens = bucket->burst;
+	bucket->last_ns = now_ns;
+}
+
+void token_bucket_refill(struct token_bucket *bucket, int64_t now_ns)
+{
+	if (now_ns <= bucket->last_ns)
+		return;
+	bucket->tokens += bucket->rate * (now_ns - bucket->last_ns) / NSEC_PER_SEC;
+	if (bucket->tokens > bucket->burst)
+		bucket->tokens = bucket->burst;
+	bucket->last_ns = now_ns;
+}
+
+int64_t token_bucket_wait_ns(const struct token_bucket *bucket)
+{
+	if (bucket->rate == 0 || bucket->tokens > 0)
+		return 0;
+	/* Until there is more than 0, rather than just 0 */
+	return (int64_t)(-bucket->tokens * NSEC_PER_SEC / bucket->rate) + 1;
+}
+
+void configure_log_rate_limit(const char *limit, const char *mode)
+{
+	int64_t bytes, lines, burst_ms;
+
+	if (mode != NULL && strcmp(mode, "drop") && strcmp(mode, "block"))
+		nexitf("Invalid --log-rate-limit-mode %s, must be drop or block", mode);
+	if (limit == NULL) {
+		if (mode != NULL)
+			nexit("--log-rate-limit-mode requires --log-rate-limit");
+		return;
+	}
+
+	_cleanup_(strv_cleanup) char **parts = g_strsplit(limit, ":", -1);
+	if (g_strv_length(parts) != 3)
+		nexitf("Invalid log rate limit %s, expected BYTES:LINES:BURST_MS", limit);
+	if (!parse_count(parts[0], &bytes) || !parse_count(parts[1], &lines) || (bytes == 0 && lines == 0))
+		nexitf("Invalid log rate limit %s, bytes and lines a second must be numbers, not both 0", limit);
+	if (!parse_count(parts[2], &burst_ms) || burst_ms == 0 || burst_ms > RATE_LIMIT_BURST_MAX_MS)
+		nexitf("Invalid log rate limit %s, burst must be between 1 and %d ms", limit, RATE_LIMIT_BURST_MAX_MS);
+
+	int64_t now = monotonic_ns();
+	token_bucket_init(&limiter.bytes, bytes, burst_ms, now);
+	token_bucket_init(&limiter.lines, lines, burst_ms, now);
+	limiter.block = mode != NULL && strcmp(mode, "block") == 0;
+	limiter.enabled = true;
+}
+
+bool log_rate_limit_enabled(void)
+{
+	return limiter.enabled;
+}
+
+bool log_rate_limit_blocks(void)
+{
+	return limiter.block;
+}
+
+bool log_rate_limit_admit(int64_t bytes, int64_t lines)
+{
+	if (!limiter.enabled)
+		return true;
+
+	int64_t now = monotonic_ns();
+	token_bucket_refill(&limiter.bytes, now);
+	token_bucket_refill(&limiter.lines, now);
+
+	/* Blocking keeps the buckets from going far into debt by not reading, see log_rate_limit_wait_ms(). */
+	if (!limiter.block && (token_bucket_wait_ns(&limiter.bytes) > 0 || token_bucket_wait_ns(&limiter.lines) > 0))
+		return false;
+
+	if (limiter.bytes.rate > 0)
+		limiter.bytes.tokens -= bytes;
+	if (limiter.lines.rate > 0)
+		limiter.lines.tokens -= lines;
+	return true;
+}
+
+int64_t log_rate_limit_wait_ms(void)
+{
+	if (!limiter.enabled || !limiter.block)
+		return 0;
+
+	int64_t now = monotonic_ns();
+	token_bucket_refill(&limiter.bytes, now);
+	token_bucket_refill(&limiter.lines, now);
+
+	int64_t wait_ns = MAX(token_bucket_wait_ns(&limiter.bytes), token_bucket_wait_ns(&limiter.lines));
+	return (wait_ns + 999999) / 1000000;
+}
@@ -0,0 +1,44 @@
+#if !defined(RATE_LIMIT_H)
+#define RATE_LIMIT_H
+
+/*
+ * Log rate limiting, with --log-rate-limit BYTES:LINES:BURST_MS.
+ *
+ * Container output goes through two token buckets, one counting bytes and
+ * one counting lines, each refilled at its rate a second up to BURST_MS
+ * worth of it. A buffer is let through as a whole while both buckets have
+ * tokens left and may take them below zero, so a buffer is never cut and
+ * the debt is paid off before the next one. Over the limit, output is
+ * either dropped, with a summary line logged once output is let through
+ * again, or left in the pipe until the buckets refill (--log-rate-limit-mode).
+ */
+
+#include <stdbool.h> /* bool */
+#include <stdint.h>  /* int64_t */
+
+struct token_bucket {
+	double rate;   /* tokens a second, 0 for no limit */
+	double burst;  /* most tokens saved up */
+	double tokens; /* below 0 after a buffer larger than what was left */
+	int64_t last_ns;
+};
+
+void token_bucket_init(struct token_bucket *bucket, int64_t rate, int64_t burst_ms, int64_t now_ns);
+void token_bucket_refill(struct token_bucket *bucket, int64_t now_ns);
+/* The time until the bucket has tokens again, 0 if it has some. */
+int64_t token_bucket_wait_ns(const struct token_bucket *bucket);
+
+/* Parse and validate the options, exits on errors. */
+void configure_log_rate_limit(const char *limit, const char *mode);
+
+bool log_rate_limit_enabled(void);
+bool log_rate_limit_blocks(void);
+
+/* Whether a buffer of bytes and lines is within the limit, taking its tokens if so. With the block mode,
+   it always is. */
+bool log_rate_limit_admit(int64_t bytes, int64_t lines);
+
+/* With the block mode, the time in milliseconds until output can be read again, 0 if it can be now. */
+int64_t log_rate_limit_wait_ms(void);
+
+#endif // RATE_LIMIT_H
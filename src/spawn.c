@@ -0,0 +1,170 @@
+#define _GNU_SOURCE
+
+#include "spawn.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#ifdef __linux__
+#include <sched.h>
+#include <sys/mman.h>
+#endif
+
+#ifdef __linux__
+#ifndef CLONE_PIDFD
+#define CLONE_PIDFD 0x00001000
+#endif
+
+/* The child only sets up its stdio and execs, it needs very little stack. */
+#define SPAWN_STACK_SIZE (128 * 1024)
+#endif
+
+struct spawn_args {
+	spawn_child_fn fn;
+	void *arg;
+	const sigset_t *oldmask;
+};
+
+static int spawn_trampoline(void *data)
+{
+	const struct spawn_args *args = data;
+	struct sigaction sa;
+
+	/*
+	 * The parent's signal handlers must not run in the child: they would
+	 * act on the parent's state, which the child may be sharing.
+	 */
+	for (int sig = 1; sig < NSIG; sig++) {
+		if (sigaction(sig, NULL, &sa) < 0)
+			continue;
+		if (sa.sa_handler == SIG_DFL || sa.sa_handler == SIG_IGN)
+			continue;
+		memset(&sa, 0, sizeof(sa));
+		sa.sa_handler = SIG_DFL;
+		sigemptyset(&sa.sa_mask);
+		sigaction(sig, &sa, NULL);
+	}
+
+	if (sigprocmask(SIG_SETMASK, args->oldmask, NULL) < 0)
+		spawn_child_fail("Failed to restore signal mask");
+
+	_exit(args->fn(args->arg));
+}
+
+#ifdef __linux__
+static pid_t clone_child(struct spawn_args *args, gboolean share_memory, int *pidfd)
+{
+	int flags = SIGCHLD;
+	pid_t pid;
+
+	void *stack = mmap(NULL, SPAWN_STACK_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+	if (stack == MAP_FAILED)
+		return -1;
+
+	if (share_memory)
+		flags |= CLONE_VM | CLONE_VFORK;
+	if (pidfd)
+		flags |= CLONE_PIDFD;
+
+	pid = clone(spawn_trampoline, (char *)stack + SPAWN_STACK_SIZE, flags, args, pidfd);
+	if (pid < 0 && errno == EINVAL && (flags & CLONE_PIDFD)) {
+		/* Kernels older than 5.2 may reject CLONE_PIDFD; go on without it. */
+		flags &= ~CLONE_PIDFD;
+		pid = clone(spawn_trampoline, (char *)stack + SPAWN_STACK_SIZE, flags, args, NULL);
+	}
+
+	/*
+	 * With CLONE_VFORK the child is done with its stack by the time clone()
+	 * returns, and without CLONE_VM it has a copy of its own.
+	 */
+	int saved_errno = errno;
+	munmap(stack, SPAWN_STACK_SIZE);
+	errno = saved_errno;
+
+	return pid;
+}
+#endif
+
+pid_t spawn_child(spawn_child_fn fn, void *arg, gboolean share_memory, int *pidfd)
+{
+	struct spawn_args args = {.fn = fn, .arg = arg};
+	sigset_t all, oldmask;
+	pid_t pid = -1;
+
+	if (pidfd)
+		*pidfd = -1;
+
+	/* Keep signals away from the child until it has reset the handlers. */
+	sigfillset(&all);
+	if (sigprocmask(SIG_SETMASK, &all, &oldmask) < 0)
+		return -1;
+	args.oldmask = &oldmask;
+
+#ifdef __linux__
+	pid = clone_child(&args, share_memory, pidfd);
+#else
+	(void)share_memory;
+#endif
+	if (pid < 0) {
+		pid = fork();
+		if (pid == 0)
+			spawn_trampoline(&args);
+	}
+
+	int saved_errno = errno;
+	sigprocmask(SIG_SETMASK, &oldmask, NULL);
+	errno = saved_errno;
+
+	return pid;
+}
+
+size_t spawn_format_int(char *buf, size_t len, long value)
+{
+	char tmp[24];
+	size_t n = 0, i = 0;
+	unsigned long v = value < 0 ? -(unsigned long)value : (unsigned long)value;
+
+	if (len == 0)
+		return 0;
+
+	do {
+		tmp[n++] = '0' + (v % 10);
+		v /= 10;
+	} while (v > 0);
+	if (value < 0)
+		tmp[n++] = '-';
+
+	while (n > 0 && i < len - 1)
+		buf[i++] = tmp[--n];
+	buf[i] = '\0';
+	return i;
+}
+
+static void spawn_child_report(const char *prefix, const char *msg, int err)
+{
+	char errbuf[24];
+	struct iovec iov[] = {
+		{(void *)prefix, strlen(prefix)}, {(void *)msg, strlen(msg)}, {": errno ", 8}, {errbuf, 0}, {"\n", 1},
+	};
+
+	iov[3].iov_len = spawn_format_int(errbuf, sizeof(errbuf), err);
+	if (writev(STDERR_FILENO, iov, G_N_ELEMENTS(iov)) < 0) {
+		/* Nowhere left to report to. */
+	}
+}
+
+void spawn_child_warn(const char *msg)
+{
+	int saved_errno = errno;
+	spawn_child_report("[conmon:w]: ", msg, saved_errno);
+	errno = saved_errno;
+}
+
+void spawn_child_fail(const char *msg)
+{
+	spawn_child_report("[conmon:e]: ", msg, errno);
+	_exit(EXIT_FAILURE);
+}
@@ -0,0 +1,39 @@
+#if !defined(SPAWN_H)
+#define SPAWN_H
+
+/*
+ * Helpers for starting child processes that exec right away (the OCI runtime
+ * and the exit command).
+ *
+ * On Linux the child is created with clone(CLONE_VM | CLONE_VFORK), so no page
+ * tables are copied and the parent is suspended until the child has called
+ * execve() or _exit(). A pidfd for the child is requested with CLONE_PIDFD.
+ * Everywhere else, and if clone() is not usable, fork() is used instead.
+ *
+ * Because the child may share the parent's memory, the child function must only
+ * call async-signal-safe functions, must not write to anything except its own
+ * stack (and data the parent set aside for it), and must not return except to
+ * report a failure: its return value is used as the exit status.
+ */
+
+#include <glib.h>      /* gboolean */
+#include <sys/types.h> /* pid_t */
+
+typedef int (*spawn_child_fn)(void *arg);
+
+/* Run fn(arg) in a new child process. share_memory may be set to FALSE if the
+ * child could block before exec'ing, in which case the child gets a copy of the
+ * parent's memory and the parent is not suspended. If pidfd is not NULL it is
+ * set to a close-on-exec pidfd for the child, or to -1 if pidfds are not
+ * available. Returns the pid of the child, or -1 with errno set on failure. */
+pid_t spawn_child(spawn_child_fn fn, void *arg, gboolean share_memory, int *pidfd);
+
+/* Format value as a decimal number into buf, async-signal-safe. Returns the
+ * number of characters written, not counting the terminating NUL. */
+size_t spawn_format_int(char *buf, size_t len, long value);
+
+/* Async-signal-safe replacements for nwarn() and _pexit() in the child. */
+void spawn_child_warn(const char *msg);
+void spawn_child_fail(const char *msg) __attribute__((noreturn));
+
+#endif // SPAWN_H
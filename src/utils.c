@@ -3,6 +3,8 @@
 #include "utils.h"
 #include <string.h>
 #include <strings.h>
+#include <stdlib.h>
+#include <fcntl.h>
 #ifdef __linux__
 #include <sys/prctl.h>
 #include <sys/signalfd.h>
@@ -29,24 +31,28 @@ void set_conmon_logs(char *level_name, char *cid_, gboolean syslog_, char *tag)
 	// log_level is initialized as Warning, no need to set anything
 	if (level_name == NULL)
 		return;
+	if (set_log_level(level_name) < 0)
+		nexitf("No such log level %s", level_name);
+}
+
+/* Parse level_name and make it the log level. Returns -1 if there is no such
+   level, leaving the log level alone. */
+int set_log_level(const char *level_name)
+{
 	if (!strcasecmp(level_name, "error") || !strcasecmp(level_name, "fatal") || !strcasecmp(level_name, "panic")) {
 		log_level = EXIT_LEVEL;
-		return;
 	} else if (!strcasecmp(level_name, "warn") || !strcasecmp(level_name, "warning")) {
 		log_level = WARN_LEVEL;
-		return;
 	} else if (!strcasecmp(level_name, "info")) {
 		log_level = INFO_LEVEL;
-		return;
 	} else if (!strcasecmp(level_name, "debug")) {
 		log_level = DEBUG_LEVEL;
-		return;
 	} else if (!strcasecmp(level_name, "trace")) {
 		log_level = TRACE_LEVEL;
-		return;
+	} else {
+		return -1;
 	}
-	ntracef("set log level to %s", level_name);
-	nexitf("No such log level %s", level_name);
+	return 0;
 }
 
 static bool retryable_error(int err)
@@ -83,6 +89,48 @@ ssize_t write_all(int fd, const void *buf, size_t count)
 	return count;
 }
 
+/* Replace the file at path with data, atomically but without syncing: the
+   data is written to a temporary file next to it, which is then renamed over
+   it. Returns -1 with errno set on failure. */
+int replace_file(const char *path, const void *data, size_t len)
+{
+	_cleanup_free_ char *tmp_path = g_strdup_printf("%s.%d.tmp", path, getpid());
+	int saved_errno;
+
+	int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+	if (fd < 0)
+		return -1;
+
+	if (write_all(fd, data, len) < 0) {
+		saved_errno = errno;
+		close(fd);
+		goto fail;
+	}
+	if (close(fd) < 0 || rename(tmp_path, path) < 0) {
+		saved_errno = errno;
+		goto fail;
+	}
+	return 0;
+
+fail:
+	unlink(tmp_path);
+	errno = saved_errno;
+	return -1;
+}
+
+/* Parse a non-negative decimal number, as given in the option specs. Unlike
+   strtoll() on its own, a sign, leading space or trailing text is an error. */
+bool parse_count(const char *str, int64_t *value)
+{
+	char *endptr;
+
+	if (str[0] < '0' || str[0] > '9')
+		return false;
+	errno = 0;
+	*value = strtoll(str, &endptr, 10);
+	return errno == 0 && *endptr == '\0';
+}
+
 #ifdef __linux__
 
 int set_subreaper(gboolean enabled)
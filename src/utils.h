@@ -5,6 +5,7 @@
 #include <stdio.h>
 #include <syslog.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <unistd.h>
 #include <errno.h>
 #include <glib.h>
@@ -203,6 +204,7 @@ extern gboolean use_syslog;
    parse the string value of level_name to the appropriate log_level_t enum value
 */
 void set_conmon_logs(char *level_name, char *cid_, gboolean syslog_, char *tag);
+int set_log_level(const char *level_name);
 
 #define _cleanup_(x) __attribute__((cleanup(x)))
 
@@ -257,6 +259,10 @@ static inline void hashtable_free_cleanup(GHashTable **tbl)
 
 ssize_t write_all(int fd, const void *buf, size_t count);
 
+int replace_file(const char *path, const void *data, size_t len);
+
+bool parse_count(const char *str, int64_t *value);
+
 int set_subreaper(gboolean enabled);
 
 int set_pdeathsig(int sig);
@@ -171,4 +171,18 @@ teardown() {
         --log-path "k8s-file:$LOG_PATH" --log-path "$invalid_log_driver:$LOG_PATH"
     assert_failure
     assert_output_contains "No such log driver $invalid_log_driver"
-}
\ No newline at end of file
+}
+
+@test "invalid exit durability should fail" {
+    run_conmon --cid "$CTR_ID" --cuuid "$CTR_ID" --runtime "$VALID_PATH" \
+        --log-path "k8s-file:$LOG_PATH" --exit-durability "invalid"
+    assert_failure
+    assert_output_contains "Invalid --exit-durability invalid"
+}
+
+@test "invalid pressure trigger should fail" {
+    run_conmon --cid "$CTR_ID" --cuuid "$CTR_ID" --runtime "$VALID_PATH" \
+        --log-path "k8s-file:$LOG_PATH" --persist-dir "$TEST_TMPDIR" --pressure-trigger "memory:some:150000:100"
+    assert_failure
+    assert_output_contains "Invalid pressure trigger memory:some:150000:100"
+}
@@ -172,3 +172,215 @@ run_conmon_with_log_opts() {
     run cat "$LOG_PATH"
     assert "${output}" =~ "stdout P"
 }
+
+@test "ctr logs: json-file without a path should fail" {
+    run_conmon_with_log_opts --log-path "json-file:"
+    assert_failure
+    assert_output_contains "json-file requires a filename"
+}
+
+@test "ctr logs: json-file writes docker json records" {
+    setup_container_env "printf 'say \\\"hi\\\"\\\\ttab\\\\n'; echo err >&2; printf tail"
+    run_conmon_with_default_args \
+        --log-path "json-file:$LOG_PATH"
+
+    assert_file_exists "$LOG_PATH"
+    grep -qF '{"log":"say \"hi\"\ttab\n","stream":"stdout","time":"' "$LOG_PATH" || die "$(cat "$LOG_PATH")"
+    grep -qF '{"log":"err\n","stream":"stderr","time":"' "$LOG_PATH" || die "$(cat "$LOG_PATH")"
+    # A line left unterminated keeps "log" without a newline, as with docker.
+    grep -qF '{"log":"tail","stream":"stdout","time":"' "$LOG_PATH" || die "$(cat "$LOG_PATH")"
+    run grep -cvE '^\{"log":".*","stream":"std(out|err)","time":"[0-9]{4}-[0-9]{2}-[0-9]{2}T[0-9]{2}:[0-9]{2}:[0-9]{2}\.[0-9]{9}Z"\}$' "$LOG_PATH"
+    [ "$output" -eq 0 ]
+}
+
+@test "ctr logs: json-file replaces invalid UTF-8" {
+    setup_container_env "printf 'bad \\377 cut \\342\\202 ok \\303\\251\\n'"
+    run_conmon_with_default_args \
+        --log-path "json-file:$LOG_PATH"
+
+    assert_file_exists "$LOG_PATH"
+    # Each invalid byte becomes U+FFFD, as with docker; valid sequences are kept as they are.
+    grep -qF '{"log":"bad \ufffd cut \ufffd\ufffd ok '$'\303\251''\n","stream":"stdout"' "$LOG_PATH" || die "$(cat "$LOG_PATH")"
+    run grep -c $'\377' "$LOG_PATH"
+    [ "$output" -eq 0 ]
+}
+
+@test "ctr logs: json-file is rotated at --log-size-max" {
+    setup_container_env "i=0; while [ \$i -lt 2000 ]; do echo line \$i; i=\$((i + 1)); done"
+    run_conmon_with_default_args \
+        --log-path "json-file:$LOG_PATH" \
+        --log-path "k8s-file:$TEST_TMPDIR/k8s.log" \
+        --log-size-max 20000 --log-rotate --log-max-files 2
+
+    # Each file is rotated on its own, and records are never cut between files.
+    assert_file_exists "$LOG_PATH.1"
+    assert_file_exists "$TEST_TMPDIR/k8s.log.1"
+    run grep -hcv '"}$' "$LOG_PATH" "$LOG_PATH.1"
+    [ "${lines[0]}" -eq 0 ] && [ "${lines[1]}" -eq 0 ]
+}
+
+@test "ctr logs: --log-max-line-size out of range should fail" {
+    run_conmon_with_log_opts --log-path "k8s-file:$LOG_PATH" --log-max-line-size -1
+    assert_failure
+    assert_output_contains "Max line size must be between 0 and"
+}
+
+@test "ctr logs: k8s-file lines split at --log-max-line-size" {
+    setup_container_env "printf '%*s\n' 100000 '' | tr ' ' '#'; echo short; printf tail"
+    run_conmon_with_default_args \
+        --log-path "k8s-file:$LOG_PATH" \
+        --log-max-line-size 4096
+
+    assert_file_exists "$LOG_PATH"
+    # Only the start of the line left at exit makes a shorter P record.
+    run awk '$3 == "P" && length($4) != 4096 && $4 != "tail"' "$LOG_PATH"
+    assert_success
+    [ -z "$output" ] || die "P records not split at 4096 bytes: $output"
+    run awk '$3 == "P" && length($4) == 4096' "$LOG_PATH"
+    [ "${#lines[@]}" -eq 24 ]
+
+    # A reader joining P records up to the next F record gets back what the container wrote.
+    awk '{ printf "%s%s", $4, ($3 == "F" ? "\n" : "") }' "$LOG_PATH" > "$TEST_TMPDIR/joined"
+    { printf '%*s\n' 100000 '' | tr ' ' '#'; echo short; printf tail; } > "$TEST_TMPDIR/expected"
+    cmp "$TEST_TMPDIR/expected" "$TEST_TMPDIR/joined"
+}
+
+@test "ctr logs: --log-max-line-size does not hold a prompt back for long" {
+    setup_container_env "printf 'Password: '; sleep 30"
+    start_conmon_with_default_args \
+        --log-path "k8s-file:$LOG_PATH" \
+        --log-max-line-size 4096
+    wait_for_runtime_status "$CTR_ID" running
+
+    # Written as a P record while the container is still sleeping, not once it exits.
+    for _ in $(seq 50); do
+        grep -q ' stdout P Password: $' "$LOG_PATH" 2>/dev/null && break
+        sleep 0.1
+    done
+    run grep ' stdout P Password: $' "$LOG_PATH"
+    assert_success
+}
+
+@test "ctr logs: invalid --log-rate-limit should fail" {
+    run_conmon_with_log_opts --log-path "k8s-file:$LOG_PATH" --log-rate-limit "1000:0"
+    assert_failure
+    assert_output_contains "expected BYTES:LINES:BURST_MS"
+
+    run_conmon_with_log_opts --log-path "k8s-file:$LOG_PATH" --log-rate-limit "0:0:100"
+    assert_failure
+    assert_output_contains "not both 0"
+
+    run_conmon_with_log_opts --log-path "k8s-file:$LOG_PATH" --log-rate-limit "1000:0:100" --log-rate-limit-mode slow
+    assert_failure
+    assert_output_contains "must be drop or block"
+}
+
+@test "ctr logs: output over --log-rate-limit is dropped and summarized" {
+    setup_container_env "i=0; while [ \$i -lt 5000 ]; do echo line \$i; i=\$((i + 1)); done"
+    run_conmon_with_default_args \
+        --log-path "k8s-file:$LOG_PATH" \
+        --log-rate-limit "0:100:100"
+
+    assert_file_exists "$LOG_PATH"
+    # The lines logged and the ones the summaries account for add up to all of them.
+    local records summaries suppressed
+    records=$(grep -c " stdout F " "$LOG_PATH")
+    summaries=$(grep -c " stdout F conmon: suppressed " "$LOG_PATH")
+    suppressed=$(sed -n 's/.* conmon: suppressed \([0-9]*\) lines .*/\1/p' "$LOG_PATH" | awk '{ n += $1 } END { print n + 0 }')
+    [ "$summaries" -gt 0 ] || die "nothing was dropped"
+    [ $((records - summaries + suppressed)) -eq 5000 ]
+}
+
+@test "ctr logs: the --log-rate-limit summary is not joined onto a cut line" {
+    # The line is logged up to the 2000 #'s, which take the budget, and the rest of it is dropped.
+    setup_container_env "printf 'cut '; sleep 0.2; printf '%*s' 2000 '' | tr ' ' '#'; echo ' rest'; sleep 3; echo end"
+    run_conmon_with_default_args \
+        --log-path "k8s-file:$LOG_PATH" \
+        --log-rate-limit "1000:0:100"
+
+    assert_file_exists "$LOG_PATH"
+    run grep -c " stdout F conmon: suppressed " "$LOG_PATH"
+    [ "$output" -eq 1 ] || die "expected one summary, got $output"
+    # The cut line ends with an empty F record of its own before the summary.
+    run awk '/ stdout F conmon: suppressed / { print prev } { prev = $0 }' "$LOG_PATH"
+    [[ "$output" =~ " stdout F "$ ]] || die "the summary follows '$output'"
+    run grep -c " stdout F end$" "$LOG_PATH"
+    [ "$output" -eq 1 ]
+}
+
+@test "ctr logs: --log-rate-limit-mode block holds off reading" {
+    # About 230KB, well over what the pipe holds once the container is done.
+    setup_container_env "i=0; while [ \$i -lt 20000 ]; do echo line \$i; i=\$((i + 1)); done"
+    local start end
+    start=$(date +%s%N)
+    run_conmon_with_default_args \
+        --log-path "k8s-file:$LOG_PATH" \
+        --log-rate-limit "50000:0:100" \
+        --log-rate-limit-mode block
+    end=$(date +%s%N)
+
+    # Nothing is lost, it only takes longer.
+    assert_file_exists "$LOG_PATH"
+    run grep -c " stdout F line " "$LOG_PATH"
+    [ "$output" -eq 20000 ]
+    [ $(( (end - start) / 1000000 )) -ge 2000 ] || die "230KB at 50000 bytes a second took $(( (end - start) / 1000000 ))ms"
+}
+
+@test "ctr logs: --log-dedup collapses repeated lines" {
+    setup_container_env "echo start; i=0; while [ \$i -lt 1000 ]; do echo 'same error'; i=\$((i + 1)); done; echo end"
+    run_conmon_with_default_args \
+        --log-path "k8s-file:$LOG_PATH" \
+        --log-dedup
+
+    assert_file_exists "$LOG_PATH"
+    # Join up lines split across reads, which are never collapsed.
+    sed -n 's/^[^ ]* stdout \([PF]\) /\1 /p' "$LOG_PATH" | awk '{ printf "%s%s", substr($0, 3), ($1 == "F" ? "\n" : "") }' > "$TEST_TMPDIR/lines"
+
+    # However the copies were read, they add up to 1000.
+    local kept repeats
+    kept=$(grep -c "^same error$" "$TEST_TMPDIR/lines")
+    repeats=$(sed -n 's/^conmon: last message repeated \([0-9]*\) times$/\1/p' "$TEST_TMPDIR/lines" | awk '{ n += $1 } END { print n + 0 }')
+    [ "$kept" -lt 1000 ] || die "no line was collapsed"
+    [ $((kept + repeats)) -eq 1000 ]
+    [ "$(head -n 1 "$TEST_TMPDIR/lines")" = "start" ]
+    [ "$(tail -n 1 "$TEST_TMPDIR/lines")" = "end" ]
+}
+
+@test "ctr logs: --log-index requires a k8s-file log" {
+    run_conmon_with_log_opts --log-path "json-file:$LOG_PATH" --log-index "4096:1"
+    assert_failure
+    assert_output_contains "--log-index requires a k8s-file log"
+
+    run_conmon_with_log_opts --log-path "k8s-file:$LOG_PATH" --log-index "4096"
+    assert_failure
+    assert_output_contains "expected BYTES:SECONDS"
+}
+
+@test "ctr logs: --log-index lets a reader seek to a time" {
+    check_log_seek_binary
+    setup_container_env "i=0; while [ \$i -lt 2000 ]; do echo early \$i; i=\$((i + 1)); done; sleep 1.5; i=0; while [ \$i -lt 2000 ]; do echo late \$i; i=\$((i + 1)); done"
+    run_conmon_with_default_args \
+        --log-path "k8s-file:$LOG_PATH" \
+        --log-index "1024:0"
+
+    assert_file_exists "$LOG_PATH.idx"
+    [ $(( $(stat -c %s "$LOG_PATH.idx") % 16 )) -eq 0 ]
+
+    # Seek to the first late record, which leaves the early ones behind.
+    local since
+    since=$(date -d "$(grep -m 1 " stdout F late 0$" "$LOG_PATH" | cut -d ' ' -f 1)" +%s.%N)
+    run "$LOG_SEEK_BINARY" --stats "$LOG_PATH" "$since"
+    assert_success
+    [ "$(grep -c " stdout F late " <<< "$output")" -eq 2000 ]
+    [ "$(grep -c " early " <<< "$output")" -eq 0 ]
+    [[ "$output" =~ "from offset "[1-9] ]] || die "the index was not used: $output"
+
+    # Which is what reading the whole log finds.
+    diff <("$LOG_SEEK_BINARY" "$LOG_PATH" "$since") <("$LOG_SEEK_BINARY" --scan "$LOG_PATH" "$since")
+}
+
+@test "ctr logs: --follow-socket requires a k8s-file log" {
+    run_conmon_with_log_opts --log-path "json-file:$LOG_PATH" --follow-socket
+    assert_failure
+    assert_output_contains "--follow-socket requires a k8s-file log"
+}
@@ -125,3 +125,83 @@ teardown() {
     assert_json "${output}" =~ "\"message\":"
     assert_json "${output}" =~ "runc create failed"
 }
+
+@test "runtime: exit files are written with every exit durability" {
+    local mode
+    for mode in fsync nosync tmpfile; do
+        rm -rf "$TEST_TMPDIR/exits" "$TEST_TMPDIR/persist"
+        mkdir -p "$TEST_TMPDIR/exits" "$TEST_TMPDIR/persist"
+        "$RUNTIME_BINARY" delete -f "$CTR_ID" 2>/dev/null || true
+
+        run_conmon_with_default_args --log-path "k8s-file:$LOG_PATH" \
+            --exit-dir "$TEST_TMPDIR/exits" --persist-dir "$TEST_TMPDIR/persist" \
+            --exit-durability "$mode"
+
+        run cat "$TEST_TMPDIR/exits/$CTR_ID"
+        assert "${output}" == "0" "exit file written with $mode"
+        run cat "$TEST_TMPDIR/persist/exit"
+        assert "${output}" == "0" "persist exit file written with $mode"
+
+        # No temporary files are left behind.
+        run ls "$TEST_TMPDIR/exits"
+        assert "${output}" == "$CTR_ID" "only the exit file is in the exit dir with $mode"
+    done
+}
+
+@test "runtime: resource usage is sampled into the persist dir" {
+    if [[ ! -f /sys/fs/cgroup/cgroup.controllers ]]; then
+        skip "Not on cgroup v2 system"
+    fi
+    setup_container_env "sleep 2"
+    mkdir -p "$TEST_TMPDIR/persist"
+
+    run_conmon_with_default_args --log-path "k8s-file:$LOG_PATH" \
+        --persist-dir "$TEST_TMPDIR/persist" --stats-interval 1
+
+    assert_file_exists "$TEST_TMPDIR/persist/stats"
+    run cat "$TEST_TMPDIR/persist/stats.json"
+    assert_json "${output}" =~ "\"usage_usec\": [0-9]+"
+    assert_json "${output}" =~ "\"current\": [0-9]+"
+}
+
+@test "runtime: oom-events is created empty without an OOM" {
+    setup_container_env "echo hello"
+    mkdir -p "$TEST_TMPDIR/persist"
+
+    run_conmon_with_default_args --log-path "k8s-file:$LOG_PATH" --persist-dir "$TEST_TMPDIR/persist"
+
+    assert_file_exists "$TEST_TMPDIR/persist/oom-events"
+    [ ! -s "$TEST_TMPDIR/persist/oom-events" ] || die "oom-events has records without an OOM"
+    [ ! -e "$TEST_TMPDIR/persist/oom" ] || die "oom file created without an OOM"
+}
+
+@test "runtime: timeout with --cgroup-kill stops the container" {
+    setup_container_env "sleep 100"
+
+    run_conmon_with_default_args --log-path "k8s-file:$LOG_PATH" --timeout 2 --cgroup-kill
+
+    run_runtime state "$CTR_ID"
+    assert "${output}" =~ "\"status\": *\"stopped\"" "container stopped after the timeout"
+}
+
+@test "runtime: --cgroup-kill reports the exit once the cgroup is empty" {
+    if [[ ! -f /sys/fs/cgroup/cgroup.controllers ]]; then
+        skip "Not on cgroup v2 system"
+    fi
+    # Many processes, out of the container's process group, take a while to be torn down.
+    setup_container_env "for i in \$(seq 200); do setsid sleep 100 & done; sleep 100"
+
+    start_conmon_with_default_args --log-path "k8s-file:$LOG_PATH" --timeout 3 --cgroup-kill
+    wait_for_runtime_status "$CTR_ID" running
+    local pid cgroup
+    pid=$("$RUNTIME_BINARY" state "$CTR_ID" | jq '.pid')
+    cgroup="/sys/fs/cgroup$(sed -n 's/^0:://p' "/proc/$pid/cgroup")"
+
+    wait_for_conmon_exit "$CONMON_PID"
+
+    # By the time conmon has exited, not a single process may be left.
+    if [[ -f "$cgroup/cgroup.events" ]]; then
+        run grep '^populated ' "$cgroup/cgroup.events"
+        assert "${output}" == "populated 0"
+    fi
+}
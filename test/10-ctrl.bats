@@ -32,20 +32,25 @@ test_ctl_command() {
     wait_for_conmon_exit "$main_conmon_pid"
 }
 
-# Helper function to send the resize command. Fails if the resize command
-# triggers the tty resize.
-test_resize_command_fail() {
+# Helper function to send a control command that conmon has to reject. Fails
+# if the command had any effect on the container: it has to run to its end,
+# printing the terminal size it started with (0 0).
+test_ctl_command_fail() {
     local command="$1"
     test_ctl_command "$command"
 
     # Check that the main process noticed the /tmp/test.txt.
     assert_file_exists "$LOG_PATH"
     run cat "$LOG_PATH"
-    # No terminal resize - should show default/initial size (0 0)
-    # When resize fails, terminal stays at initial size
     assert "${output}" =~ "0 0"
 }
 
+# Helper function to send the resize command. Fails if the resize command
+# triggers the tty resize.
+test_resize_command_fail() {
+    test_ctl_command_fail "$1"
+}
+
 # Helper function to send the resize command. Fails if the resize command
 # does not trigger the tty resize.
 test_resize_command_ok() {
@@ -195,3 +200,287 @@ test_resize_command_ok() {
     run cat "$LOG_PATH"
     assert "${output}" =~ "after rotation"
 }
+
+# Helper function to send a stop request to a container ignoring or handling
+# SIGTERM, and check the outcome conmon reports.
+test_stop_command() {
+    local command="$1"
+    local expected_outcome="$2"
+    mkdir -p "$TEST_TMPDIR/persist"
+    start_conmon_with_default_args --log-path "k8s-file:$LOG_PATH" --persist-dir "$TEST_TMPDIR/persist"
+    wait_for_runtime_status "$CTR_ID" running
+
+    echo "$command" > ${CTL_PATH}
+
+    wait_for_runtime_status "$CTR_ID" stopped
+    wait_for_conmon_exit "$CONMON_PID"
+
+    run cat "$TEST_TMPDIR/persist/stop"
+    assert_json "${output}" =~ "$expected_outcome"
+}
+
+@test "ctrl: stop, container exits within the grace period" {
+    setup_container_env "trap 'exit 0' TERM; while true; do sleep 0.1; done"
+    test_stop_command "3 15 10" "\"escalated\": false"
+}
+
+@test "ctrl: stop, escalate to SIGKILL after the grace period" {
+    setup_container_env "trap '' TERM; while true; do sleep 0.1; done"
+    test_stop_command "3 15 1" "\"escalated\": true"
+}
+
+@test "ctrl: stop with an invalid signal" {
+    test_ctl_command_fail "3 0 10"
+}
+
+# Send a request to the control socket and print the reply.
+control_request() {
+    echo "$1" | socat - "UNIX-CONNECT:${CONTROL_PATH}"
+}
+
+# The reply to a stop only comes once the container has exited.
+control_stop() {
+    echo '{"command": "stop", "signal": 15, "grace": 10}' | socat -t 30 - "UNIX-CONNECT:${CONTROL_PATH}"
+}
+
+@test "ctrl: control socket requests" {
+    setup_container_env "echo 'Hello from container'; trap 'exit 0' TERM; while true; do sleep 0.1; done"
+    start_conmon_with_default_args --log-path "k8s-file:$LOG_PATH" --control-socket
+    wait_for_runtime_status "$CTR_ID" running
+
+    run control_request '{"command": "log-level", "level": "debug"}'
+    assert_json "${output}" =~ '"ok": true'
+
+    run control_request '{"command": "log-level", "level": "loud"}'
+    assert_json "${output}" =~ '"ok": false'
+
+    run control_request '{"command": "no-such-command"}'
+    assert_json "${output}" =~ '"error": "unknown command"'
+
+    run control_request 'not json'
+    assert "${output}" =~ '"ok": false'
+
+    run control_request '{"command": "stats"}'
+    assert_json "${output}" =~ '"ok": true'
+    assert_json "${output}" =~ '"control_requests": 4'
+    assert "$(echo "${output}" | jq -c '.stats.log_driver_errors')" == '{"k8s-file":0}'
+
+    run control_stop
+    assert_json "${output}" =~ '"ok": true'
+    assert_json "${output}" =~ '"escalated": false'
+
+    wait_for_runtime_status "$CTR_ID" stopped
+    wait_for_conmon_exit "$CONMON_PID"
+    assert_file_not_exists "$CONTROL_PATH"
+}
+
+@test "ctrl: rotate logs through the control socket" {
+    setup_container_env "echo 'before rotation'; while [ ! -f /tmp/test.txt ]; do sleep 0.1; done; echo 'after rotation'" "true"
+    generate_process_spec "echo 'Hello there!' > /tmp/test.txt"
+    start_conmon_with_default_args --log-path "k8s-file:$LOG_PATH" -t --control-socket
+    wait_for_runtime_status "$CTR_ID" running
+    local main_conmon_pid=$CONMON_PID
+
+    run control_request '{"command": "rotate-logs"}'
+    assert_json "${output}" =~ '"ok": true'
+
+    run_conmon_with_default_args \
+        --log-path "k8s-file:$LOG_PATH.exec" \
+        --exec \
+        --exec-process-spec "${BUNDLE_PATH}/process.json"
+    wait_for_conmon_exit "$main_conmon_pid"
+
+    run cat "$LOG_PATH.1"
+    assert "${output}" =~ "before rotation"
+    run cat "$LOG_PATH"
+    assert "${output}" =~ "after rotation"
+}
+
+@test "ctrl: lazy endpoints" {
+    setup_container_env "while [ ! -f /tmp/test.txt ]; do sleep 0.1; done; stty size" "true"
+    generate_process_spec "echo 'Hello there!' > /tmp/test.txt"
+    start_conmon_with_default_args --log-path "k8s-file:$LOG_PATH" -t --lazy-endpoints
+    wait_for_runtime_status "$CTR_ID" running
+    local main_conmon_pid=$CONMON_PID
+
+    assert_file_exists "$CONTROL_PATH"
+    assert_file_not_exists "$ATTACH_PATH"
+    assert_file_not_exists "$CTL_PATH"
+    assert_file_not_exists "$BUNDLE_PATH/winsz"
+
+    run control_request '{"command": "attach"}'
+    assert_json "${output}" =~ '"ok": true'
+    [ -S "$ATTACH_PATH" ] || die "attach socket not created"
+
+    run control_request '{"command": "resize", "height": 10, "width": 20}'
+    assert_json "${output}" =~ '"ok": true'
+
+    run_conmon_with_default_args \
+        --log-path "k8s-file:$LOG_PATH.exec" \
+        --exec \
+        --exec-process-spec "${BUNDLE_PATH}/process.json"
+    wait_for_conmon_exit "$main_conmon_pid"
+
+    run cat "$LOG_PATH"
+    assert "${output}" =~ "10 20"
+    assert_file_not_exists "$ATTACH_PATH"
+}
+
+@test "ctrl: a flood of resizes is coalesced" {
+    setup_container_env "while [ ! -f /tmp/test.txt ]; do sleep 0.1; done; stty size" "true"
+    generate_process_spec "echo 'Hello there!' > /tmp/test.txt"
+    start_conmon_with_default_args --log-path "k8s-file:$LOG_PATH" -t --control-socket
+    wait_for_runtime_status "$CTR_ID" running
+    local main_conmon_pid=$CONMON_PID
+
+    # A single write of 500 resizes, ending with 42x77.
+    for i in $(seq 1 499); do echo "1 $((i % 100 + 1)) 80"; done > "$TEST_TMPDIR/resizes"
+    echo "1 42 77" >> "$TEST_TMPDIR/resizes"
+    cat "$TEST_TMPDIR/resizes" > ${CTL_PATH}
+
+    # The ctl fifo and the control socket are read independently, give conmon time to catch up.
+    for i in $(seq 1 50); do
+        run control_request '{"command": "stats"}'
+        [[ "${output}" =~ '"resize_requests": 500' ]] && break
+        sleep 0.1
+    done
+    assert_json "${output}" =~ '"resize_requests": 500'
+    local applied
+    applied=$(echo "${output}" | jq '.stats.resize_applied')
+    [ "$applied" -ge 1 ] && [ "$applied" -lt 100 ] || die "expected the resizes to be coalesced, got $applied ioctls"
+
+    run_conmon_with_default_args \
+        --log-path "k8s-file:$LOG_PATH.exec" \
+        --exec \
+        --exec-process-spec "${BUNDLE_PATH}/process.json"
+    wait_for_conmon_exit "$main_conmon_pid"
+
+    run cat "$LOG_PATH"
+    assert "${output}" =~ "42 77"
+}
+
+@test "ctrl: rotating in a loop while the container streams output" {
+    setup_container_env "i=0; while [ \$i -lt 3000 ]; do echo line \$i; i=\$((i + 1)); [ \$((i % 100)) -eq 0 ] && sleep 0.1; done; sleep 1"
+    start_conmon_with_default_args --log-path "k8s-file:$LOG_PATH" --log-rotate --log-max-files 100 --control-socket
+    wait_for_runtime_status "$CTR_ID" running
+
+    # Rotate while measuring how long conmon takes to answer on the control socket.
+    local max_ms=0 start end
+    for i in $(seq 1 20); do
+        echo "2 0 0" > ${CTL_PATH}
+        start=$(date +%s%N)
+        control_request '{"command": "stats"}' > /dev/null
+        end=$(date +%s%N)
+        (( (end - start) / 1000000 > max_ms )) && max_ms=$(( (end - start) / 1000000 ))
+        sleep 0.1
+    done
+    echo "slowest control reply while rotating: ${max_ms}ms"
+    [ "$max_ms" -lt 1000 ] || die "conmon took ${max_ms}ms to reply while rotating logs"
+
+    wait_for_runtime_status "$CTR_ID" stopped
+    wait_for_conmon_exit "$CONMON_PID"
+
+    # No line may be lost or reordered across the rotated files.
+    local files=()
+    for n in $(ls "$LOG_PATH".[0-9]* | sed "s|^$LOG_PATH\.||" | sort -n -r); do files+=("$LOG_PATH.$n"); done
+    files+=("$LOG_PATH")
+    [ "${#files[@]}" -gt 1 ] || die "the log was never rotated"
+    cat "${files[@]}" | sed -n 's/^[^ ]* stdout F //p' > "$TEST_TMPDIR/lines"
+    seq 0 2999 | sed 's/^/line /' > "$TEST_TMPDIR/expected"
+    diff "$TEST_TMPDIR/expected" "$TEST_TMPDIR/lines"
+}
+
+@test "ctrl: live stats page" {
+    check_live_stats_binary
+    setup_container_env "echo one; echo two >&2; echo three; trap 'exit 0' TERM; while true; do sleep 0.1; done"
+    mkdir -p "$TEST_TMPDIR/persist"
+    start_conmon_with_default_args --log-path "k8s-file:$LOG_PATH" --persist-dir "$TEST_TMPDIR/persist" --live-stats --control-socket
+    wait_for_runtime_status "$CTR_ID" running
+    sleep 0.5
+
+    run "$LIVE_STATS_BINARY" "$TEST_TMPDIR/persist/live-stats"
+    assert_success
+    assert_json "${output}" =~ "\"pid\": $CONMON_PID"
+    assert_json "${output}" =~ '"stdout_bytes": 10'
+    assert_json "${output}" =~ '"stdout_lines": 2'
+    assert_json "${output}" =~ '"stderr_lines": 1'
+
+    # The page agrees with the counters behind the control socket.
+    run control_request '{"command": "stats"}'
+    assert_json "${output}" =~ '"stdout_bytes": 10'
+
+    run control_stop
+    wait_for_runtime_status "$CTR_ID" stopped
+    wait_for_conmon_exit "$CONMON_PID"
+}
+
+@test "ctrl: live stats without a persist directory" {
+    run_conmon_expecting_failure --log-path "k8s-file:$LOG_PATH" --live-stats
+    assert_output_contains "Live stats require a persist directory"
+}
+
+@test "ctrl: live stats readers never see a torn update" {
+    check_live_stats_binary
+    run "$LIVE_STATS_BINARY" --torn-test 2
+    echo "$output"
+    assert_success
+    assert "${output}" =~ " torn 0"
+}
+
+# Subscribe to the follow socket and print what is streamed, until conmon closes the connection.
+follow_log() {
+    echo "$1" | socat -t 30 - "UNIX-CONNECT:${FOLLOW_PATH}"
+}
+
+@test "ctrl: follow socket requests" {
+    setup_container_env "echo 'Hello from container'; trap 'exit 0' TERM; while true; do sleep 0.1; done"
+    start_conmon_with_default_args --log-path "k8s-file:$LOG_PATH" --control-socket --follow-socket
+    wait_for_runtime_status "$CTR_ID" running
+
+    run follow_log '{"offset": 100000}'
+    assert_json "${output}" =~ '"ok": false'
+    run follow_log '{"offset": "start"}'
+    assert_json "${output}" =~ '"ok": false'
+
+    # The record already written is sent, and the connection is held open for more.
+    run timeout 1 socat -t 30 - "UNIX-CONNECT:${FOLLOW_PATH}" <<< '{"backlog": 10000}'
+    [[ "${lines[0]}" == '{"ok": true, "offset": 0}' ]]
+    [[ "${lines[1]}" == *" stdout F Hello from container" ]]
+
+    run control_stop
+    wait_for_conmon_exit "$CONMON_PID"
+    assert_file_not_exists "$FOLLOW_PATH"
+}
+
+@test "ctrl: follow socket streams the log across rotations" {
+    # The container outlives the slow subscriber's pause, as the drain at exit does not wait for a client that isn't reading.
+    setup_container_env "sleep 1; i=0; while [ \$i -lt 20000 ]; do echo line \$i; i=\$((i + 1)); done; sleep 3"
+    start_conmon_with_default_args --log-path "k8s-file:$LOG_PATH" --log-size-max 200000 --log-rotate --log-max-files 100 --follow-socket
+
+    # One subscriber keeps up, the other only reads after a while, and is sent what it missed from the log files.
+    follow_log '{"offset": 0}' > "$TEST_TMPDIR/fast" &
+    local fast=$!
+    follow_log '{"offset": 0}' | { sleep 2; cat; } > "$TEST_TMPDIR/slow" &
+    local slow=$!
+
+    wait_for_runtime_status "$CTR_ID" stopped
+    wait_for_conmon_exit "$CONMON_PID"
+    wait "$fast" "$slow"
+
+    local files=()
+    for n in $(ls "$LOG_PATH".[0-9]* | sed "s|^$LOG_PATH\.||" | sort -n -r); do files+=("$LOG_PATH.$n"); done
+    files+=("$LOG_PATH")
+    [ "${#files[@]}" -gt 1 ] || die "the log was never rotated"
+    cat "${files[@]}" > "$TEST_TMPDIR/expected"
+
+    # Each got every record, with a rotate event for each rotation.
+    for subscriber in fast slow; do
+        [ "$(head -n 1 "$TEST_TMPDIR/$subscriber")" = '{"ok": true, "offset": 0}' ]
+        run grep -c '^{"event": "rotate"}$' "$TEST_TMPDIR/$subscriber"
+        [ "$output" -eq $(( ${#files[@]} - 1 )) ]
+        tail -n +2 "$TEST_TMPDIR/$subscriber" | grep -v '^{' > "$TEST_TMPDIR/$subscriber.records"
+        cmp "$TEST_TMPDIR/expected" "$TEST_TMPDIR/$subscriber.records"
+    done
+    run grep -c " stdout F line " "$TEST_TMPDIR/expected"
+    [ "$output" -eq 20000 ]
+}
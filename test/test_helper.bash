@@ -22,6 +22,9 @@ assert_failure() {
 # Default paths and variables
 CONMON_BINARY="${CONMON_BINARY:-/usr/bin/conmon}"
 RUNTIME_BINARY="${RUNTIME_BINARY:-/usr/bin/runc}"
+# The live stats reader is built next to conmon and not installed.
+LIVE_STATS_BINARY="${LIVE_STATS_BINARY:-$(dirname "$CONMON_BINARY")/conmon-live-stats}"
+LOG_SEEK_BINARY="${LOG_SEEK_BINARY:-$(dirname "$CONMON_BINARY")/conmon-log-seek}"
 
 # UBI10-micro container image for test rootfs. Can be overridden to use
 # a local mirror (or to test the failure path).
@@ -320,6 +323,8 @@ setup_test_env() {
     export ROOTFS="$TEST_TMPDIR/rootfs"
     export SOCKET_PATH="$TEST_TMPDIR"
     export ATTACH_PATH="$TEST_TMPDIR/attach"
+    export CONTROL_PATH="$TEST_TMPDIR/control"
+    export FOLLOW_PATH="$TEST_TMPDIR/follow"
     export OCI_ATTACHPIPE_PATH="$TEST_TMPDIR/attach-pipe"
     export OCI_STARTPIPE_PATH="$TEST_TMPDIR/start-pipe"
     export OCI_SYNCPIPE_PATH="$TEST_TMPDIR/sync-pipe"
@@ -367,6 +372,20 @@ check_runtime_binary() {
     fi
 }
 
+# Check if the live stats reader exists and is executable
+check_live_stats_binary() {
+    if [[ ! -x "$LIVE_STATS_BINARY" ]]; then
+        skip "live stats reader not found or not executable at $LIVE_STATS_BINARY"
+    fi
+}
+
+# Check if the log seek tool exists and is executable
+check_log_seek_binary() {
+    if [[ ! -x "$LOG_SEEK_BINARY" ]]; then
+        skip "log seek tool not found or not executable at $LOG_SEEK_BINARY"
+    fi
+}
+
 # Helper to check if a string contains a substring
 assert_output_contains() {
     local expected="$1"